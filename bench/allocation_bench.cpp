@@ -0,0 +1,116 @@
+// Heap allocations per compliance report and per cash billing, measured on a
+// scratch store seeded in an empty directory. Kept out of the pharmacy binary
+// so its replaced operator new never runs in production.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 -pthread bench/allocation_bench.cpp -o allocation_bench
+//   ./allocation_bench <empty directory>
+#define PHARMACY_NO_MAIN
+#include "../finalproject.cpp"
+
+// Off except while measure() runs, when the replaced operator new counts every call
+namespace AllocationCounter {
+    atomic<bool> counting{ false };
+    atomic<uint64_t> allocations{ 0 };
+
+    // Allocations made anywhere in the process while work runs
+    template <typename Work>
+    uint64_t measure(Work&& work) {
+        allocations = 0;
+        counting = true;
+        work();
+        counting = false;
+        return allocations;
+    }
+}
+
+void* operator new(size_t size) {
+    if (AllocationCounter::counting.load(memory_order_relaxed)) {
+        AllocationCounter::allocations.fetch_add(1, memory_order_relaxed);
+    }
+    if (void* memory = malloc(size == 0 ? 1 : size)) return memory;
+    throw bad_alloc();
+}
+
+// Kept out of line so GCC does not see free() meet operator new and warn
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void operator delete(void* memory) noexcept { free(memory); }
+void operator delete(void* memory, size_t) noexcept { operator delete(memory); }
+
+class PharmacyBench {
+public:
+    static constexpr size_t PRODUCTS = 20;
+
+    // Fills an empty directory with a catalogue, some of it expiring or low on
+    // stock so every report section has rows, and `rounds` pending prescriptions;
+    // refuses a directory that already holds a store
+    static bool seed(const string& root, size_t rounds) {
+        error_code ec;
+        filesystem::create_directories(root, ec);
+        if (filesystem::exists(Utils::dataPath(root, "medicines.txt"), ec)) return false;
+        string today = Utils::getCurrentTimestamp().substr(0, 10);
+        string soon = Utils::dayLabel(Utils::dayFromDate(today, 0) + 10);
+        ofstream medicinesFile(Utils::dataPath(root, "medicines.txt"));
+        for (size_t i = 0; i < PRODUCTS; i++) {
+            medicinesFile << "Bench Product " << i << ",100000,2099-12-31,1.50\n"
+                          << "Bench Expiring " << i << ",50," << soon << ",2.00\n"
+                          << "Bench Low " << i << ",5,2099-12-31,3.00\n";
+        }
+        ofstream prescriptionsFile(Utils::dataPath(root, "prescriptions.txt"));
+        for (size_t i = 0; i < rounds; i++) {
+            prescriptionsFile << "BENCH" << i << ",Bench Patient " << i << ",Bench Product " << i % PRODUCTS
+                              << ",2," << today << ",Bench Doctor\n";
+        }
+        return static_cast<bool>(medicinesFile) && static_cast<bool>(prescriptionsFile);
+    }
+
+    // Drives the store's own report and billing code with the menus' input
+    // scripted and their output discarded
+    static void run(PharmacySystem& store, size_t rounds, ostream& out) {
+        struct Discard : streambuf {
+            int overflow(int c) override { return c; }
+        } discard;
+        string script;
+        for (size_t i = 1; i <= rounds; i++) script += "\n" + to_string(i) + "\n1\n\n";
+        istringstream input(script);
+        streambuf* shownTo = cout.rdbuf(&discard);
+        streambuf* readFrom = cin.rdbuf(input.rdbuf());
+
+        uint64_t reports = AllocationCounter::measure([&] {
+            for (size_t i = 0; i < rounds; i++) store.writeComplianceReport();
+        });
+        uint64_t billings = AllocationCounter::measure([&] {
+            for (size_t i = 0; i < rounds; i++) store.processBilling();
+        });
+
+        cin.rdbuf(readFrom);
+        cout.rdbuf(shownTo);
+        size_t billed = store.fulfilments.size();
+        out << "Allocations per report:  " << reports / rounds << " (" << store.medicines.size() << " lots, "
+            << store.prescriptions.size() << " prescriptions)\n";
+        out << "Allocations per billing: " << (billed ? billings / billed : 0) << " (" << billed << " of " << rounds
+            << " billed)\n";
+    }
+};
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        cerr << "Usage: " << argv[0] << " <empty directory>\n";
+        return 2;
+    }
+    const size_t rounds = 50;
+    string root = argv[1];
+    if (!PharmacyBench::seed(root, rounds)) {
+        cerr << "Cannot seed a benchmark store in " << root << " (it must not hold a store already)\n";
+        return 1;
+    }
+    {
+        PharmacySystem store(root);
+        PharmacyBench::run(store, rounds, cout);
+    }
+    FileLogger::shutdownAll();
+    TaskScheduler::shared().shutdown();
+    return 0;
+}
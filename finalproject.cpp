@@ -1,8 +1,14 @@
+#ifdef _WIN32
+#define _CRT_RAND_S  // Declares rand_s, the system CSPRNG, in <stdlib.h>
+#endif
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
 #include <ctime>
 #include <iomanip>
 #include <algorithm>
@@ -10,23 +16,149 @@
 #include <stdexcept>
 #include <cmath>
 #include <cctype>
+#include <variant>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <atomic>
+#include <map>
+#include <array>
+#include <deque>
+#include <queue>
+#include <list>
+#include <filesystem>
+#include <cstring>
+#include <cerrno>
+#include <iterator>
+#include <charconv>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#include <share.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
 
 using namespace std;
 
 // Utility functions
 namespace Utils {
-    string getCurrentTimestamp() {
-        time_t now = time(nullptr);
-        tm* localTime = localtime(&now);
+    // Thread-safe replacement for localtime, which shares one static buffer
+    tm toLocalTime(time_t t) {
+        tm result{};
+#ifdef _WIN32
+        localtime_s(&result, &t);
+#else
+        localtime_r(&t, &result);
+#endif
+        return result;
+    }
+
+    string formatTimestamp(int64_t unixTime) {
+        tm localTime = toLocalTime(static_cast<time_t>(unixTime));
         char buffer[80];
-        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", localTime);
+        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &localTime);
         return string(buffer);
     }
 
-    string trim(const string& str) {
+    string getCurrentTimestamp() {
+        return formatTimestamp(static_cast<int64_t>(time(nullptr)));
+    }
+
+    // Days from 1970-01-01 to a calendar date (Howard Hinnant's days_from_civil)
+    int32_t daysFromCivil(int y, int m, int d) {
+        y -= m <= 2 ? 1 : 0;
+        int era = (y >= 0 ? y : y - 399) / 400;
+        int yoe = y - era * 400;
+        int doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+        int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + doe - 719468;
+    }
+
+    // Local calendar day of a Unix time, counted from 1970-01-01. The time is
+    // converted on its own, so each one gets the UTC offset, daylight saving
+    // included, that applied at that moment
+    int32_t localDay(int64_t unixTime) {
+        tm local = toLocalTime(static_cast<time_t>(unixTime));
+        return daysFromCivil(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday);
+    }
+
+    // Day count for a "YYYY-MM-DD" date; fallback if malformed
+    int32_t dayFromDate(const string& date, int32_t fallback) {
+        int y, m, d;
+        if (sscanf(date.c_str(), "%d-%d-%d", &y, &m, &d) != 3) return fallback;
+        return daysFromCivil(y, m, d);
+    }
+
+    // "YYYY-MM-DD" for a day count (civil_from_days)
+    string dayLabel(int32_t day) {
+        int64_t z = static_cast<int64_t>(day) + 719468;
+        int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+        int64_t doe = z - era * 146097;
+        int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        int64_t mp = (5 * doy + 2) / 153;
+        int64_t d = doy - (153 * mp + 2) / 5 + 1;
+        int64_t m = mp < 10 ? mp + 3 : mp - 9;
+        int64_t y = yoe + era * 400 + (m <= 2 ? 1 : 0);
+        char label[40];
+        snprintf(label, sizeof(label), "%04lld-%02lld-%02lld", static_cast<long long>(y),
+                 static_cast<long long>(m), static_cast<long long>(d));
+        return label;
+    }
+
+    string formatCents(int64_t cents) {
+        char text[32];
+        snprintf(text, sizeof(text), "%s$%lld.%02lld", cents < 0 ? "-" : "",
+                 static_cast<long long>(llabs(cents) / 100), static_cast<long long>(llabs(cents) % 100));
+        return text;
+    }
+
+    // Inverse of formatTimestamp for "YYYY-MM-DD HH:MM:SS" in local time; 0 if malformed
+    int64_t parseTimestamp(const string& timestamp) {
+        tm t{};
+        if (sscanf(timestamp.c_str(), "%d-%d-%d %d:%d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday,
+                   &t.tm_hour, &t.tm_min, &t.tm_sec) != 6) return 0;
+        t.tm_year -= 1900;
+        t.tm_mon -= 1;
+        t.tm_isdst = -1;
+        return static_cast<int64_t>(mktime(&t));
+    }
+
+    // Places a data file under a store's data root; an empty root means the working directory
+    string dataPath(const string& root, const string& fileName) {
+        if (root.empty()) return fileName;
+        char last = root.back();
+        return (last == '/' || last == '\\') ? root + fileName : root + "/" + fileName;
+    }
+
+    // Takes its argument by value so callers passing temporaries trim in place
+    string trim(string str) {
         size_t first = str.find_first_not_of(' ');
         if (string::npos == first) return "";
         size_t last = str.find_last_not_of(' ');
+        str.erase(last + 1);
+        str.erase(0, first);
+        return str;
+    }
+
+    string_view trimView(string_view str) {
+        size_t first = str.find_first_not_of(' ');
+        if (string_view::npos == first) return {};
+        size_t last = str.find_last_not_of(' ');
         return str.substr(first, (last - first + 1));
     }
 
@@ -71,13 +203,31 @@ namespace Utils {
         return true;
     }
 
-    string toLower(const string& s) {
-        string result = s;
+    string toLower(string_view s) {
+        string result(s);
         transform(result.begin(), result.end(), result.begin(), 
                  [](unsigned char c){ return tolower(c); });
         return result;
     }
 
+    // Case-insensitive comparison without building lowered copies
+    bool equalsIgnoreCase(string_view a, string_view b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); i++) {
+            if (tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i])))
+                return false;
+        }
+        return true;
+    }
+
+    // Splits the next comma-separated field off the front of line
+    string_view nextField(string_view& line) {
+        size_t comma = line.find(',');
+        string_view field = line.substr(0, comma);
+        line.remove_prefix(comma == string_view::npos ? line.size() : comma + 1);
+        return field;
+    }
+
     string getInput(const string& prompt) {
         string input;
         cout << prompt;
@@ -85,18 +235,43 @@ namespace Utils {
         return trim(input);
     }
 
-    float getFloatInput(const string& prompt) {
+    // Reads a money amount such as "12", "12.5" or "12.345" into whole cents without going
+    // through floating point; a third decimal rounds half up, further digits are ignored
+    bool parseCents(string_view text, int64_t& cents) {
+        text = trimView(text);
+        size_t dot = text.find('.');
+        string_view whole = text.substr(0, dot);
+        string_view fraction = dot == string_view::npos ? string_view() : text.substr(dot + 1);
+        if (whole.empty() && fraction.empty()) return false;
+        if (whole.size() > 15) return false;
+        int64_t value = 0;
+        for (char c : whole) {
+            if (!isdigit(static_cast<unsigned char>(c))) return false;
+            value = value * 10 + (c - '0');
+        }
+        int64_t fractionCents = 0;
+        for (size_t i = 0; i < fraction.size(); ++i) {
+            if (!isdigit(static_cast<unsigned char>(fraction[i]))) return false;
+            if (i < 2) fractionCents = fractionCents * 10 + (fraction[i] - '0');
+        }
+        if (fraction.size() == 1) fractionCents *= 10;
+        cents = value * 100 + fractionCents + (fraction.size() > 2 && fraction[2] >= '5' ? 1 : 0);
+        return true;
+    }
+
+    // "12.34" for 1234, as stored in the data files
+    string centsToDecimal(int64_t cents) {
+        return formatCents(cents).erase(cents < 0 ? 1 : 0, 1);
+    }
+
+    int64_t getMoneyInput(const string& prompt) {
         while (true) {
             string input = getInput(prompt);
-            try {
-                size_t pos;
-                float value = stof(input, &pos);
-                if (pos == input.size()) {
-                    return value;
-                }
-            } catch (...) {
-                cout << "Invalid input. Please enter a valid number.\n";
+            int64_t cents = 0;
+            if (parseCents(input, cents)) {
+                return cents;
             }
+            cout << "Invalid input. Please enter an amount such as 12.50.\n";
         }
     }
 
@@ -138,430 +313,6451 @@ namespace Utils {
     }
 }
 
-// Abstract Logger interface
-class ILogger {
-public:
-    virtual ~ILogger() = default;
-    virtual void log(const string& action, const string& username) = 0;
-    virtual void viewLogs() = 0;
-};
-
-// Concrete Logger implementation
-class FileLogger : public ILogger {
-private:
-    static FileLogger* instance;
-    int lastTransactionId;
-
-    FileLogger() {
-        ifstream idFile("last_id.txt");
-        if (idFile.is_open()) {
-            idFile >> lastTransactionId;
-            idFile.close();
-        } else {
-            lastTransactionId = 0;
+// Password hashing for the user store: PBKDF2-HMAC-SHA256, deliberately
+// slow so a copied users.txt is expensive to attack. The HMAC key states
+// are computed once per hash, so each iteration costs two compressions.
+namespace PasswordHash {
+    class Sha256 {
+    public:
+        Sha256() { reset(); }
+
+        void reset() {
+            static constexpr uint32_t INITIAL[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                                     0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+            memcpy(state, INITIAL, sizeof(state));
+            length = 0;
+            buffered = 0;
         }
-    }
 
-public:
-    static FileLogger* getInstance() {
-        if (!instance) {
-            instance = new FileLogger();
+        void update(const uint8_t* data, size_t size) {
+            length += size;
+            while (size > 0) {
+                size_t take = min(size, sizeof(buffer) - buffered);
+                memcpy(buffer + buffered, data, take);
+                buffered += take;
+                data += take;
+                size -= take;
+                if (buffered == sizeof(buffer)) {
+                    compress(buffer);
+                    buffered = 0;
+                }
+            }
         }
-        return instance;
-    }
-
-    ~FileLogger() override = default;
 
-    void log(const string& action, const string& username) override {
-        ofstream logFile("transaction_log.txt", ios::app);
-        if (logFile.is_open()) {
-            lastTransactionId++;
-            logFile << "ID: " << lastTransactionId << " | "
-                    << "Time: " << Utils::getCurrentTimestamp() << " | "
-                    << "User: " << username << " | "
-                    << "Action: " << action << "\n";
-            logFile.close();
-
-            ofstream idFile("last_id.txt");
-            if (idFile.is_open()) {
-                idFile << lastTransactionId;
-                idFile.close();
+        array<uint8_t, 32> finish() {
+            uint64_t bits = length * 8;
+            uint8_t pad = 0x80;
+            update(&pad, 1);
+            uint8_t zero = 0;
+            while (buffered != 56) update(&zero, 1);
+            uint8_t lengthBytes[8];
+            for (int i = 0; i < 8; i++) lengthBytes[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+            update(lengthBytes, 8);
+            array<uint8_t, 32> digest;
+            for (size_t i = 0; i < 8; i++) {
+                for (size_t b = 0; b < 4; b++) digest[i * 4 + b] = static_cast<uint8_t>(state[i] >> (24 - 8 * b));
             }
+            return digest;
         }
-    }
 
-    void viewLogs() override {
-        ifstream logFile("transaction_log.txt");
-        if (logFile.is_open()) {
-            string line;
-            while (getline(logFile, line)) {
-                cout << line << "\n";
+    private:
+        uint32_t state[8];
+        uint8_t buffer[64];
+        size_t buffered = 0;
+        uint64_t length = 0;
+
+        static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+        void compress(const uint8_t* block) {
+            static constexpr uint32_t K[64] = {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+            };
+            uint32_t w[64];
+            for (int i = 0; i < 16; i++) {
+                w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16) |
+                       (uint32_t(block[i * 4 + 2]) << 8) | uint32_t(block[i * 4 + 3]);
+            }
+            for (int i = 16; i < 64; i++) {
+                uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
             }
-            logFile.close();
+            uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+            uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+            for (int i = 0; i < 64; i++) {
+                uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+                uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+            state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+            state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+        }
+    };
+
+    using Digest = array<uint8_t, 32>;
+
+    // PBKDF2 with one output block, which is all a 32-byte hash needs
+    Digest pbkdf2(string_view password, string_view salt, uint32_t iterations) {
+        uint8_t key[64] = {};
+        if (password.size() > sizeof(key)) {
+            Sha256 keyHash;
+            keyHash.update(reinterpret_cast<const uint8_t*>(password.data()), password.size());
+            Digest shortened = keyHash.finish();
+            memcpy(key, shortened.data(), shortened.size());
         } else {
-            cout << "No logs found.\n";
+            memcpy(key, password.data(), password.size());
         }
+        uint8_t innerPad[64], outerPad[64];
+        for (int i = 0; i < 64; i++) {
+            innerPad[i] = key[i] ^ 0x36;
+            outerPad[i] = key[i] ^ 0x5c;
+        }
+        Sha256 inner, outer;
+        inner.update(innerPad, sizeof(innerPad));
+        outer.update(outerPad, sizeof(outerPad));
+
+        auto hmac = [&inner, &outer](const uint8_t* message, size_t size) {
+            Sha256 h = inner;
+            h.update(message, size);
+            Digest innerDigest = h.finish();
+            Sha256 o = outer;
+            o.update(innerDigest.data(), innerDigest.size());
+            return o.finish();
+        };
+
+        string first(salt);
+        first.append("\0\0\0\1", 4);  // Block index 1
+        Digest u = hmac(reinterpret_cast<const uint8_t*>(first.data()), first.size());
+        Digest result = u;
+        for (uint32_t i = 1; i < iterations; i++) {
+            u = hmac(u.data(), u.size());
+            for (size_t b = 0; b < result.size(); b++) result[b] ^= u[b];
+        }
+        return result;
     }
-};
 
-FileLogger* FileLogger::instance = nullptr;
+    string toHex(const uint8_t* data, size_t size) {
+        static const char digits[] = "0123456789abcdef";
+        string hex;
+        hex.reserve(size * 2);
+        for (size_t i = 0; i < size; i++) {
+            hex.push_back(digits[data[i] >> 4]);
+            hex.push_back(digits[data[i] & 0xF]);
+        }
+        return hex;
+    }
 
-// Abstract Billing Strategy
-class IBillingStrategy {
-public:
-    virtual ~IBillingStrategy() = default;
-    virtual string getName() const = 0;
-    virtual bool processPayment(float amount) = 0;
-};
+    // Salts and session tokens come from the operating system's CSPRNG;
+    // there is no weaker fallback if it cannot be read
+    string randomHex(size_t bytes) {
+        vector<uint8_t> data(bytes);
+#ifdef _WIN32
+        for (size_t i = 0; i < bytes; i += sizeof(unsigned int)) {
+            unsigned int word = 0;
+            if (rand_s(&word) != 0) throw runtime_error("the system random number generator failed");
+            memcpy(data.data() + i, &word, min(sizeof(word), bytes - i));
+        }
+#else
+        ifstream source("/dev/urandom", ios::binary);
+        if (!source.read(reinterpret_cast<char*>(data.data()), static_cast<streamsize>(bytes)))
+            throw runtime_error("cannot read /dev/urandom");
+#endif
+        return toHex(data.data(), data.size());
+    }
 
-// Concrete Billing Strategies
-class CashBilling : public IBillingStrategy {
-public:
-    string getName() const override { return "Cash"; }
-    
-    bool processPayment(float amount) override {
-        cout << "Processing cash payment of $" << fixed << setprecision(2) << amount << "\n";
-        cout << "Payment received successfully.\n";
-        return true;
+    // Compares every byte whatever the first difference, so timing does not leak the hash
+    bool sameHash(string_view a, string_view b) {
+        if (a.size() != b.size()) return false;
+        unsigned char diff = 0;
+        for (size_t i = 0; i < a.size(); i++) diff |= static_cast<unsigned char>(a[i] ^ b[i]);
+        return diff == 0;
     }
-};
+}
 
-class GCashBilling : public IBillingStrategy {
-public:
-    string getName() const override { return "GCash"; }
-    
-    bool processPayment(float amount) override {
-        string mobileNumber;
-        bool valid = false;
-        do {
-            mobileNumber = Utils::getInput("Enter GCash mobile number (09XXXXXXXXX): ");
-            valid = (mobileNumber.length() == 11 && mobileNumber.substr(0, 2) == "09");
-            if (!valid) {
-                cout << "Invalid GCash mobile number format.\n";
-            }
-        } while (!valid);
+// Small LZ77 codec for sealed log segments, so archives need no external library.
+// Stream: "PLZ1", varint original size, then (literal run, match length, offset)
+// tokens; a match length of zero ends the stream.
+namespace Compression {
+    void appendVarint(string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
 
-        cout << "Sending payment request of $" << fixed << setprecision(2) << amount 
-             << " to " << mobileNumber << "...\n";
-        cout << "Payment confirmed via GCash.\n";
-        return true;
+    bool readVarint(string_view in, size_t& pos, uint64_t& value) {
+        value = 0;
+        for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+            unsigned char byte = static_cast<unsigned char>(in[pos++]);
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
     }
-};
 
-class PayMayaBilling : public IBillingStrategy {
-public:
-    string getName() const override { return "PayMaya"; }
-    
-    bool processPayment(float amount) override {
-        string cardNumber;
-        bool valid = false;
-        do {
-            cardNumber = Utils::getInput("Enter PayMaya card number (16 digits): ");
-            valid = (cardNumber.length() == 16 && all_of(cardNumber.begin(), cardNumber.end(), ::isdigit));
-            if (!valid) {
-                cout << "Invalid card number format.\n";
+    string compress(string_view in) {
+        string out = "PLZ1";
+        appendVarint(out, in.size());
+        vector<int64_t> table(1 << 16, -1);
+        size_t i = 0;
+        size_t anchor = 0;
+        while (i + 4 <= in.size()) {
+            uint32_t sequence;
+            memcpy(&sequence, in.data() + i, 4);
+            uint32_t hash = (sequence * 2654435761u) >> 16;
+            int64_t candidate = table[hash];
+            table[hash] = static_cast<int64_t>(i);
+            size_t match = static_cast<size_t>(candidate);
+            if (candidate >= 0 && i - match <= 65535 && memcmp(in.data() + match, in.data() + i, 4) == 0) {
+                size_t length = 4;
+                while (i + length < in.size() && in[match + length] == in[i + length]) length++;
+                appendVarint(out, i - anchor);
+                out.append(in.data() + anchor, i - anchor);
+                appendVarint(out, length);
+                appendVarint(out, i - match);
+                i += length;
+                anchor = i;
+            } else {
+                i++;
             }
-        } while (!valid);
+        }
+        appendVarint(out, in.size() - anchor);
+        out.append(in.data() + anchor, in.size() - anchor);
+        appendVarint(out, 0);
+        return out;
+    }
 
-        cout << "Processing PayMaya payment of $" << fixed << setprecision(2) << amount << "...\n";
-        cout << "Payment confirmed via PayMaya.\n";
-        return true;
+    bool decompress(string_view in, string& out) {
+        if (in.substr(0, 4) != "PLZ1") return false;
+        size_t pos = 4;
+        uint64_t size;
+        if (!readVarint(in, pos, size)) return false;
+        out.clear();
+        out.reserve(size);
+        while (true) {
+            uint64_t literals, length, offset;
+            if (!readVarint(in, pos, literals) || pos + literals > in.size()) return false;
+            out.append(in.data() + pos, literals);
+            pos += literals;
+            if (!readVarint(in, pos, length)) return false;
+            if (length == 0) break;
+            if (!readVarint(in, pos, offset) || offset == 0 || offset > out.size()) return false;
+            size_t from = out.size() - offset;
+            for (uint64_t k = 0; k < length; k++) out.push_back(out[from + k]);  // Matches may overlap
+        }
+        return out.size() == size;
     }
-};
+}
 
-// Medicine interface
-class IMedicine {
+// Formats tables straight into one growing buffer: integers go through
+// to_chars, cells are padded to fixed column widths (a cell that does not
+// fit ends in '~'), and the result reaches the stream in a single write (or
+// one write per page, or per flushTo when streaming a listing too large to
+// hold).
+class TableRenderer {
 public:
-    virtual ~IMedicine() = default;
-    virtual int getId() const = 0;
-    virtual string getName() const = 0;
-    virtual int getQuantity() const = 0;
-    virtual string getExpiryDate() const = 0;
-    virtual float getPrice() const = 0;
-    virtual void setQuantity(int q) = 0;
-    virtual void setExpiryDate(const string& e) = 0;
-    virtual void setPrice(float p) = 0;
-    virtual void display() const = 0;
-    virtual string toFileString() const = 0;
-};
+    enum class Align { Left, Right };
 
-// Concrete Medicine implementation
-class Medicine : public IMedicine {
-private:
-    int id;
-    string name;
-    int quantity;
-    string expiryDate;
-    float price;
-    static int nextId;
+    struct Column {
+        string title;
+        size_t width;  // Includes the blank that separates it from the next column
+        Align align = Align::Left;
+    };
 
-public:
-     // Modified constructor to handle both new and loaded medicines
-    Medicine(const string& n, int q, const string& e, float p, int existingId = -1)
-        : name(Utils::trim(n)), quantity(q), expiryDate(e), price(p) {
-        if (existingId == -1) {
-            // New medicine - assign next ID
-            id = nextId++;
-        } else {
-            // Loaded from file - use existing ID
-            id = existingId;
-            // Update nextId to avoid future conflicts
-            if (id >= nextId) {
-                nextId = id + 1;
-            }
+private:
+    vector<Column> columns;
+    string head;              // Title and rule lines
+    string body;              // Starts with head until the first flushTo
+    vector<size_t> rowEnds;   // Offset in body just past each row
+    size_t rowCount = 0;      // Every row ever added, including flushed ones
+    size_t column = 0;
+    size_t headSize = 0;
+
+    static void appendCell(string& out, const Column& c, const char* data, size_t length) {
+        size_t area = c.width > 1 ? c.width - 1 : c.width;
+        if (length > area && area > 0) {
+            out.append(data, area - 1).append(1, '~').append(c.width - area, ' ');
+            return;
         }
-        // Validation remains same
-        if (quantity < 0) throw invalid_argument("Quantity cannot be negative");
-        if (price < 0) throw invalid_argument("Price cannot be negative");
-        if (!Utils::isValidDate(expiryDate)) 
-            throw invalid_argument("Invalid expiry date");
+        size_t shown = min(length, area);
+        if (c.align == Align::Right) out.append(area - shown, ' ').append(data, shown).append(c.width - area, ' ');
+        else out.append(data, shown).append(c.width - shown, ' ');
     }
 
-    ~Medicine() override = default;
+    void put(const char* data, size_t length) {
+        appendCell(body, columns[column], data, length);
+        column = min(column + 1, columns.size() - 1);
+    }
 
-    int getId() const override { return id; }
-    string getName() const override { return name; }
-    int getQuantity() const override { return quantity; }
-    string getExpiryDate() const override { return expiryDate; }
-    float getPrice() const override { return price; }
+public:
+    explicit TableRenderer(vector<Column> cols) : columns(move(cols)) {
+        for (const auto& c : columns) appendCell(head, c, c.title.data(), c.title.size());
+        while (!head.empty() && head.back() == ' ') head.pop_back();
+        head.push_back('\n');
+        for (const auto& c : columns) head.append(c.width > 1 ? c.width - 1 : c.width, '-').push_back(' ');
+        head.back() = '\n';
+        body = head;
+        headSize = head.size();
+    }
 
-    void setQuantity(int q) override { 
-        if (q < 0) throw invalid_argument("Quantity cannot be negative");
-        quantity = q; 
+    TableRenderer& text(string_view value) {
+        put(value.data(), value.size());
+        return *this;
     }
-    
-    void setExpiryDate(const string& e) override { 
-        if (!Utils::isValidDate(e)) throw invalid_argument("Invalid expiry date");
-        expiryDate = e; 
+
+    TableRenderer& integer(int64_t value) {
+        char buffer[24];
+        auto result = to_chars(buffer, buffer + sizeof(buffer), value);
+        put(buffer, static_cast<size_t>(result.ptr - buffer));
+        return *this;
     }
-    
-    void setPrice(float p) override { 
-        if (p < 0) throw invalid_argument("Price cannot be negative");
-        price = p; 
+
+    // snprintf rather than to_chars, which older standard libraries lack for floating point
+    TableRenderer& decimal(double value, int precision, string_view prefix = "") {
+        char buffer[64];
+        size_t used = min(prefix.size(), size_t(16));
+        memcpy(buffer, prefix.data(), used);
+        int written = snprintf(buffer + used, sizeof(buffer) - used, "%.*f", precision, value);
+        if (written > 0) used = min(used + static_cast<size_t>(written), sizeof(buffer) - 1);
+        put(buffer, used);
+        return *this;
     }
 
-    void display() const override {
-        cout << "Name: " << name << "\n"
-             << "Quantity: " << quantity << "\n"
-             << "Expiry Date: " << expiryDate << "\n"
-             << "Price: $" << fixed << setprecision(2) << price << "\n";
+    void endRow() {
+        while (!body.empty() && body.back() == ' ') body.pop_back();
+        body.push_back('\n');
+        rowEnds.push_back(body.size());
+        ++rowCount;
+        column = 0;
     }
 
-    string toFileString() const override {
-        return name + "," + to_string(quantity) + "," + expiryDate + "," + to_string(price);
+    void reserveRows(size_t rows) {
+        size_t lineWidth = 1;
+        for (const auto& c : columns) lineWidth += c.width;
+        body.reserve(body.size() + rows * lineWidth);
     }
 
-    static Medicine fromFileString(const string& line) {
-        stringstream ss(line);
-        string name, quantityStr, expiryDate, priceStr;
-        
-        getline(ss, name, ',');
-        getline(ss, quantityStr, ',');
-        getline(ss, expiryDate, ',');
-        getline(ss, priceStr, ',');
+    size_t rows() const { return rowCount; }
+    size_t bufferedBytes() const { return body.size(); }
 
-        try {
-            return Medicine(name, stoi(quantityStr), expiryDate, stof(priceStr));
-        } catch (...) {
-            cerr << "Error parsing medicine data\n";
-            return Medicine("Invalid", 0, "0000-00-00", 0.0f);
+    // Writes everything formatted so far and starts an empty buffer; for streaming
+    void flushTo(ostream& out) {
+        out.write(body.data(), static_cast<streamsize>(body.size()));
+        body.clear();
+        rowEnds.clear();
+        headSize = 0;
+    }
+
+    void write(ostream& out) const {
+        out.write(body.data(), static_cast<streamsize>(body.size()));
+        out.flush();
+    }
+
+    // Writes rowsPerPage rows at a time under the column titles. Between pages
+    // more(shown, total) decides whether to continue.
+    void writePaged(ostream& out, size_t rowsPerPage, const function<bool(size_t, size_t)>& more) const {
+        if (rowEnds.size() <= rowsPerPage) {
+            write(out);
+            return;
+        }
+        size_t start = headSize;
+        string page;
+        for (size_t shown = 0; shown < rowEnds.size();) {
+            size_t last = min(shown + rowsPerPage, rowEnds.size());
+            page.assign(head).append(body, start, rowEnds[last - 1] - start);
+            out.write(page.data(), static_cast<streamsize>(page.size()));
+            out.flush();
+            start = rowEnds[last - 1];
+            shown = last;
+            if (shown < rowEnds.size() && !more(shown, rowEnds.size())) break;
         }
     }
 };
 
-int Medicine::nextId = 1;
-
-// Prescription interface
-class IPrescription {
+// Process-wide pool for housekeeping that must not hold up the menu thread.
+// Every worker owns a queue per priority: it takes work from the back of its
+// own queues and, when they run dry, steals from the front of the others',
+// always trying higher priorities first. Delayed and periodic jobs wait on a
+// timer thread until they are due. Jobs can be tagged with an owner so an
+// object can cancel everything it scheduled and wait for it before going away.
+class TaskScheduler {
 public:
-    virtual ~IPrescription() = default;
-    virtual string getId() const = 0;
-    virtual string getPatientName() const = 0;
-    virtual string getMedicineName() const = 0;
-    virtual int getQuantity() const = 0;
-    virtual string getDate() const = 0;
-    virtual string getPrescribingDoctor() const = 0;
-    virtual void display() const = 0;
-    virtual string toFileString() const = 0;
-};
+    enum class Priority : uint8_t { High, Normal, Low };
+    using TaskId = uint64_t;
 
-// Concrete Prescription implementation
-class Prescription : public IPrescription {
-private:
-    string id;
-    string patientName;
-    string medicineName;
-    int quantity;
-    string date;
-    string prescribingDoctor;
+    struct Handle {
+        TaskId id = 0;
+        shared_future<void> done;  // Ready once the job has run or been cancelled
+    };
 
-public:
-    Prescription(const string& i, const string& pn, const string& mn, int q, 
-                const string& d, const string& pd)
-        : id(Utils::trim(i)), patientName(Utils::trim(pn)), 
-          medicineName(Utils::trim(mn)), quantity(q), date(d), 
-          prescribingDoctor(Utils::trim(pd)) {
-        if (quantity <= 0) throw invalid_argument("Quantity must be positive");
-        if (!Utils::isValidDate(date)) throw invalid_argument("Invalid date");
+    static TaskScheduler& shared() {
+        static TaskScheduler scheduler(max(2u, thread::hardware_concurrency()));
+        return scheduler;
     }
 
-    ~Prescription() override = default;
+    explicit TaskScheduler(size_t workerCount) {
+        for (size_t i = 0; i < workerCount; i++) queues.push_back(make_unique<WorkQueue>());
+        for (size_t i = 0; i < workerCount; i++) workers.emplace_back(&TaskScheduler::workerLoop, this, i);
+        timer = thread(&TaskScheduler::timerLoop, this);
+    }
 
-    string getId() const override { return id; }
-    string getPatientName() const override { return patientName; }
-    string getMedicineName() const override { return medicineName; }
-    int getQuantity() const override { return quantity; }
-    string getDate() const override { return date; }
-    string getPrescribingDoctor() const override { return prescribingDoctor; }
+    ~TaskScheduler() { shutdown(); }
 
-    void display() const override {
-        cout << "Prescription ID: " << id << "\n"
-             << "Patient: " << patientName << "\n"
-             << "Medicine: " << medicineName << "\n"
-             << "Quantity: " << quantity << "\n"
-             << "Date: " << date << "\n"
-             << "Doctor: " << prescribingDoctor << "\n";
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    Handle submit(function<void()> job, Priority priority = Priority::Normal, const void* owner = nullptr) {
+        shared_ptr<Task> task = track(move(job), priority, owner, chrono::milliseconds(0));
+        enqueue(task);
+        return { task->id, task->done };
     }
 
-    string toFileString() const override {
-        return id + "," + patientName + "," + medicineName + "," + 
-               to_string(quantity) + "," + date + "," + prescribingDoctor;
+    Handle schedule(function<void()> job, chrono::milliseconds delay, Priority priority = Priority::Normal,
+                    const void* owner = nullptr) {
+        shared_ptr<Task> task = track(move(job), priority, owner, chrono::milliseconds(0));
+        arm(task, Clock::now() + delay);
+        return { task->id, task->done };
     }
 
-    static Prescription fromFileString(const string& line) {
-        stringstream ss(line);
-        string id, patientName, medicineName, quantityStr, date, prescribingDoctor;
-        
-        getline(ss, id, ',');
-        getline(ss, patientName, ',');
-        getline(ss, medicineName, ',');
-        getline(ss, quantityStr, ',');
-        getline(ss, date, ',');
-        getline(ss, prescribingDoctor, ',');
+    // Runs job every period, measured from the end of one run to the start of the next
+    Handle every(function<void()> job, chrono::milliseconds period, Priority priority = Priority::Normal,
+                 const void* owner = nullptr) {
+        shared_ptr<Task> task = track(move(job), priority, owner, period);
+        arm(task, Clock::now() + period);
+        return { task->id, task->done };
+    }
 
-        try {
-            return Prescription(id, patientName, medicineName, stoi(quantityStr), date, prescribingDoctor);
-        } catch (...) {
-            cerr << "Error parsing prescription data\n";
-            return Prescription("Invalid", "Invalid", "Invalid", 0, "0000-00-00", "Invalid");
+    // A job already running finishes; one still waiting never starts
+    void cancel(TaskId id) {
+        shared_ptr<Task> task;
+        {
+            lock_guard<mutex> lock(liveMutex);
+            auto it = live.find(id);
+            if (it == live.end()) return;
+            task = it->second;
         }
+        cancelTask(task);
     }
-};
-
-// Pharmacy System interface
-class IPharmacySystem {
-public:
-    virtual ~IPharmacySystem() = default;
-    virtual void run() = 0;
-};
-
-// Concrete Pharmacy System implementation
-class PharmacySystem : public IPharmacySystem {
-private:
-    vector<unique_ptr<IMedicine>> medicines;
-    vector<unique_ptr<IPrescription>> prescriptions;
-    string currentUser;
-    string currentRole;
 
-    void loadMedicines() {
-        medicines.clear();
-        ifstream file("medicines.txt");
-        if (file.is_open()) {
-            string line;
-            while (getline(file, line)) {
-                medicines.push_back(make_unique<Medicine>(Medicine::fromFileString(line)));
+    // Cancels every job the owner scheduled and waits for any of them still running
+    void drain(const void* owner) {
+        vector<shared_ptr<Task>> owned;
+        {
+            lock_guard<mutex> lock(liveMutex);
+            for (const auto& entry : live) {
+                if (entry.second->owner == owner) owned.push_back(entry.second);
             }
-            file.close();
         }
+        for (const auto& task : owned) cancelTask(task);
+        unique_lock<mutex> lock(liveMutex);
+        idle.wait(lock, [&] { return running[owner] == 0; });
+        running.erase(owner);
     }
 
-    void saveMedicines() {
-        ofstream file("medicines.txt");
-        if (file.is_open()) {
-            for (const auto& med : medicines) {
-                file << med->toFileString() << "\n";
+    // Drops delayed and periodic jobs, finishes what is already queued and joins the threads.
+    // Anything submitted afterwards runs on the caller's thread.
+    void shutdown() {
+        {
+            lock_guard<mutex> lock(timerMutex);
+            if (stopping) return;
+            stopping = true;
+            while (!timed.empty()) {
+                cancelTask(timed.top().task);
+                timed.pop();
             }
-            file.close();
+        }
+        timerWake.notify_all();
+        {
+            lock_guard<mutex> lock(wakeMutex);
+            workersStopping = true;
+        }
+        wake.notify_all();
+        if (timer.joinable()) timer.join();
+        for (auto& worker : workers) {
+            if (worker.joinable()) worker.join();
         }
     }
 
-    void loadPrescriptions() {
-        prescriptions.clear();
-        ifstream file("prescriptions.txt");
-        if (file.is_open()) {
-            string line;
-            while (getline(file, line)) {
-                prescriptions.push_back(make_unique<Prescription>(Prescription::fromFileString(line)));
-            }
+private:
+    using Clock = chrono::steady_clock;
+    static constexpr size_t PRIORITIES = 3;
+
+    struct Task {
+        TaskId id;
+        Priority priority;
+        const void* owner;
+        chrono::milliseconds period;  // Zero for one-shot jobs
+        function<void()> job;
+        promise<void> finished;
+        shared_future<void> done;
+        atomic<bool> cancelled{ false };
+        atomic<bool> active{ false };
+        atomic<bool> settled{ false };
+    };
+
+    struct WorkQueue {
+        mutex mtx;
+        deque<shared_ptr<Task>> byPriority[PRIORITIES];
+    };
+
+    struct Timed {
+        Clock::time_point due;
+        uint64_t sequence;
+        shared_ptr<Task> task;
+        bool operator>(const Timed& other) const {
+            return due != other.due ? due > other.due : sequence > other.sequence;
+        }
+    };
+
+    vector<unique_ptr<WorkQueue>> queues;
+    vector<thread> workers;
+    atomic<size_t> nextQueue{ 0 };
+    atomic<size_t> queued{ 0 };
+    mutex wakeMutex;
+    condition_variable wake;
+    bool workersStopping = false;
+
+    thread timer;
+    mutex timerMutex;
+    condition_variable timerWake;
+    priority_queue<Timed, vector<Timed>, greater<Timed>> timed;
+    uint64_t timedSequence = 0;
+    bool stopping = false;
+
+    mutex liveMutex;  // Guards live and running
+    condition_variable idle;
+    unordered_map<TaskId, shared_ptr<Task>> live;
+    unordered_map<const void*, size_t> running;  // Jobs currently executing, per owner
+    TaskId nextId = 1;
+
+    static thread_local const TaskScheduler* currentScheduler;
+    static thread_local size_t currentWorker;
+
+    shared_ptr<Task> track(function<void()> job, Priority priority, const void* owner, chrono::milliseconds period) {
+        auto task = make_shared<Task>();
+        task->priority = priority;
+        task->owner = owner;
+        task->period = period;
+        task->job = move(job);
+        task->done = task->finished.get_future().share();
+        lock_guard<mutex> lock(liveMutex);
+        task->id = nextId++;
+        live.emplace(task->id, task);
+        return task;
+    }
+
+    void settle(const shared_ptr<Task>& task) {
+        if (task->settled.exchange(true)) return;
+        {
+            lock_guard<mutex> lock(liveMutex);
+            live.erase(task->id);
+        }
+        task->finished.set_value();
+    }
+
+    void cancelTask(const shared_ptr<Task>& task) {
+        task->cancelled = true;
+        if (!task->active) settle(task);
+    }
+
+    void enqueue(const shared_ptr<Task>& task) {
+        bool runHere = false;
+        {
+            // Counted before it is pushed, so no worker can decide the pool is empty and exit meanwhile
+            lock_guard<mutex> lock(wakeMutex);
+            runHere = workersStopping;
+            if (!runHere) queued++;
+        }
+        if (runHere) {
+            execute(task);
+            return;
+        }
+        // Work spawned by a job stays on that worker's queue, where it is still warm
+        size_t index = currentScheduler == this ? currentWorker : nextQueue++ % queues.size();
+        {
+            lock_guard<mutex> lock(queues[index]->mtx);
+            queues[index]->byPriority[static_cast<size_t>(task->priority)].push_back(task);
+        }
+        wake.notify_one();
+    }
+
+    void arm(const shared_ptr<Task>& task, Clock::time_point due) {
+        {
+            lock_guard<mutex> lock(timerMutex);
+            if (stopping) {
+                cancelTask(task);
+                return;
+            }
+            timed.push({ due, timedSequence++, task });
+        }
+        timerWake.notify_one();
+    }
+
+    shared_ptr<Task> take(size_t self) {
+        for (size_t priority = 0; priority < PRIORITIES; priority++) {
+            for (size_t k = 0; k < queues.size(); k++) {
+                size_t index = (self + k) % queues.size();
+                WorkQueue& queue = *queues[index];
+                lock_guard<mutex> lock(queue.mtx);
+                auto& pending = queue.byPriority[priority];
+                if (pending.empty()) continue;
+                shared_ptr<Task> task;
+                if (index == self) {
+                    task = move(pending.back());
+                    pending.pop_back();
+                } else {
+                    task = move(pending.front());  // Steal the oldest, leaving the owner its recent work
+                    pending.pop_front();
+                }
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    void execute(const shared_ptr<Task>& task) {
+        // Counted as running before the cancel check, so drain() cannot miss a job about to start
+        {
+            lock_guard<mutex> lock(liveMutex);
+            running[task->owner]++;
+        }
+        task->active = true;
+        if (!task->cancelled) {
+            try {
+                task->job();
+            } catch (const exception& e) {
+                cerr << "Background task failed: " << e.what() << "\n";
+            } catch (...) {
+                cerr << "Background task failed\n";
+            }
+        }
+        {
+            lock_guard<mutex> lock(liveMutex);
+            running[task->owner]--;
+        }
+        idle.notify_all();
+        task->active = false;
+        if (task->period.count() > 0 && !task->cancelled) {
+            arm(task, Clock::now() + task->period);
+        } else {
+            settle(task);
+        }
+    }
+
+    void workerLoop(size_t self) {
+        currentScheduler = this;
+        currentWorker = self;
+        while (true) {
+            shared_ptr<Task> task = take(self);
+            if (!task) {
+                unique_lock<mutex> lock(wakeMutex);
+                if (workersStopping && queued == 0) return;
+                wake.wait(lock, [this] { return workersStopping || queued > 0; });
+                continue;
+            }
+            {
+                lock_guard<mutex> lock(wakeMutex);
+                queued--;
+            }
+            execute(task);
+        }
+    }
+
+    void timerLoop() {
+        unique_lock<mutex> lock(timerMutex);
+        while (!stopping) {
+            if (timed.empty()) {
+                timerWake.wait(lock);
+                continue;
+            }
+            if (timed.top().due > Clock::now()) {
+                timerWake.wait_until(lock, timed.top().due);
+                continue;
+            }
+            shared_ptr<Task> task = timed.top().task;
+            timed.pop();
+            lock.unlock();
+            if (task->cancelled) settle(task);
+            else enqueue(task);
+            lock.lock();
+        }
+    }
+};
+
+thread_local const TaskScheduler* TaskScheduler::currentScheduler = nullptr;
+thread_local size_t TaskScheduler::currentWorker = 0;
+
+// Block checksums for the data and log files. A protected file has a
+// "<file>.sums" sidecar with a CRC-32 for every 64 KiB block, written
+// together with the file's size and modification time. Checking that stamp
+// costs one stat, so startup only reads blocks of files that changed since
+// they were last written here. Append-only files extend their sums in memory
+// as they grow, and bursts of appends share one sidecar rewrite done later on
+// the shared scheduler, so appending costs no extra file I/O. Verification splits
+// files into runs of blocks on the shared scheduler, so large logs are
+// checked on every core and damage is pinned to the block.
+class BlockChecksums {
+public:
+    static constexpr size_t BLOCK_SIZE = 1 << 16;
+
+    enum class State { Intact, Damaged, Unprotected, Missing };
+
+    struct Damage {
+        uint64_t block;
+        uint64_t offset;
+        uint64_t length;
+        uint64_t firstLine;  // 1-based; a block starting or ending mid-line includes that line
+        uint64_t lastLine;
+    };
+
+    struct Report {
+        string path;
+        State state = State::Missing;
+        uint64_t size = 0;
+        uint64_t blocks = 0;
+        uint64_t uncheckedBytes = 0;  // Past the end the sums cover, e.g. after a crash mid-append
+        vector<Damage> damaged;
+    };
+
+    // The sidecar is read on the first append, after any startup check has had its say
+    explicit BlockChecksums(string filePath) : path(move(filePath)) {}
+
+    ~BlockChecksums() {
+        TaskScheduler::shared().drain(this);
+        flush();
+    }
+
+    BlockChecksums(const BlockChecksums&) = delete;
+    BlockChecksums& operator=(const BlockChecksums&) = delete;
+
+    // Extends the sums over data the caller has just appended to the file. On the first
+    // call, bytes that reached the file since the sidecar was written are read back too.
+    void append(string_view data) {
+        lock_guard<mutex> lock(mtx);
+        if (!loaded) {
+            loaded = true;
+            Sidecar sidecar;
+            if (readSidecar(path, sidecar)) {
+                sums = move(sidecar.sums);
+                covered = sidecar.size;
+            }
+            error_code ec;
+            uint64_t size = filesystem::file_size(path, ec);
+            if (ec) return;
+            if (size < covered + data.size()) {
+                // Shorter than what the sums describe: the file was replaced, so start over
+                sums.clear();
+                covered = 0;
+                data = string_view();
+            }
+            if (size > covered + data.size()) {
+                ifstream in(path, ios::binary);
+                in.seekg(static_cast<streamoff>(covered));
+                string gap(size - data.size() - covered, '\0');
+                if (!in.read(&gap[0], static_cast<streamsize>(gap.size()))) return;
+                extend(gap);
+            }
+        }
+        extend(data);
+        dirty = true;
+        if (!writeQueued) {
+            writeQueued = true;
+            TaskScheduler::shared().schedule([this] { flush(); }, SIDECAR_WRITE_DELAY,
+                                             TaskScheduler::Priority::Low, this);
+        }
+    }
+
+    // Writes out sums still waiting for the deferred sidecar rewrite
+    void flush() {
+        lock_guard<mutex> writeLock(sidecarMutex);
+        uint64_t size;
+        vector<uint32_t> pending;
+        {
+            lock_guard<mutex> lock(mtx);
+            writeQueued = false;
+            if (!dirty) return;
+            dirty = false;
+            size = covered;
+            pending = sums;
+        }
+        writeSidecar(path, size, pending);
+    }
+
+    // Drops the sums, for a file that has been moved away or emptied
+    void reset() {
+        lock_guard<mutex> writeLock(sidecarMutex);
+        lock_guard<mutex> lock(mtx);
+        sums.clear();
+        covered = 0;
+        loaded = true;
+        dirty = false;
+        error_code ec;
+        filesystem::remove(sumsPathOf(path), ec);
+    }
+
+    // Continues a CRC-32 (IEEE) over more bytes; start from 0
+    static uint32_t crc32(uint32_t crc, const char* data, size_t size) {
+        static const array<uint32_t, 256> table = [] {
+            array<uint32_t, 256> t{};
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                t[i] = c;
+            }
+            return t;
+        }();
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++) {
+            crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    static string sumsPathOf(const string& path) { return path + ".sums"; }
+
+    // Rewrites the sums of a file that was written as a whole
+    static void seal(const string& path) {
+        ifstream in(path, ios::binary);
+        if (!in.is_open()) return;
+        string content((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        seal(path, content);
+    }
+
+    // Same, for callers that still hold the bytes they wrote
+    static void seal(const string& path, string_view content) {
+        vector<uint32_t> sums;
+        sums.reserve(content.size() / BLOCK_SIZE + 1);
+        for (size_t at = 0; at < content.size(); at += BLOCK_SIZE) {
+            sums.push_back(crc32(0, content.data() + at, min(BLOCK_SIZE, content.size() - at)));
+        }
+        writeSidecar(path, content.size(), sums);
+    }
+
+    // True when the file has the size and modification time its sums were written for
+    static bool unchanged(const string& path) {
+        Sidecar sidecar;
+        error_code ec;
+        uint64_t size = filesystem::file_size(path, ec);
+        return !ec && readSidecar(path, sidecar) && sidecar.size == size && sidecar.modified == modifiedTime(path);
+    }
+
+    static Report verify(const string& path) { return move(verifyAll({ path }).front()); }
+
+    // Checks every block of every file against its sums, in parallel
+    static vector<Report> verifyAll(const vector<string>& paths) {
+        struct Scan {
+            vector<uint32_t> expected;
+            uint64_t coveredSize = 0;
+            vector<uint8_t> bad;           // Per block
+            vector<uint32_t> newlines;     // Per block, to turn blocks into line ranges
+            vector<uint8_t> endsLine;      // Per block, whether its last byte is a newline
+        };
+        vector<Report> reports(paths.size());
+        vector<Scan> scans(paths.size());
+        vector<TaskScheduler::Handle> jobs;
+        for (size_t i = 0; i < paths.size(); i++) {
+            Report& report = reports[i];
+            report.path = paths[i];
+            error_code ec;
+            report.size = filesystem::file_size(paths[i], ec);
+            if (ec) {
+                report.size = 0;
+                continue;  // Missing
+            }
+            Sidecar sidecar;
+            if (!readSidecar(paths[i], sidecar)) {
+                report.state = State::Unprotected;
+                continue;
+            }
+            report.state = State::Intact;  // Until a block says otherwise
+            Scan& scan = scans[i];
+            scan.expected = move(sidecar.sums);
+            scan.coveredSize = sidecar.size;
+            scan.bad.assign(scan.expected.size(), 0);
+            scan.newlines.assign(scan.expected.size(), 0);
+            scan.endsLine.assign(scan.expected.size(), 0);
+            report.blocks = scan.expected.size();
+            report.uncheckedBytes = report.size > sidecar.size ? report.size - sidecar.size : 0;
+            for (size_t first = 0; first < scan.expected.size(); first += BLOCKS_PER_JOB) {
+                size_t last = min(scan.expected.size(), first + BLOCKS_PER_JOB);
+                jobs.push_back(TaskScheduler::shared().submit(
+                    [&scan, &path = paths[i], first, last] { checkBlocks(path, scan, first, last); }));
+            }
+        }
+        for (auto& job : jobs) job.done.wait();
+
+        for (size_t i = 0; i < paths.size(); i++) {
+            Report& report = reports[i];
+            if (report.state != State::Intact) continue;
+            const Scan& scan = scans[i];
+            uint64_t line = 1;
+            for (size_t b = 0; b < scan.expected.size(); b++) {
+                uint64_t offset = static_cast<uint64_t>(b) * BLOCK_SIZE;
+                if (scan.bad[b]) {
+                    uint64_t length = min<uint64_t>(BLOCK_SIZE, scan.coveredSize - offset);
+                    uint64_t lastLine = line + scan.newlines[b] - (scan.endsLine[b] && scan.newlines[b] > 0 ? 1 : 0);
+                    report.damaged.push_back({ b, offset, length, line, lastLine });
+                }
+                line += scan.newlines[b];
+            }
+            if (!report.damaged.empty()) report.state = State::Damaged;
+        }
+        return reports;
+    }
+
+    static const char* stateName(State state) {
+        switch (state) {
+            case State::Intact: return "ok";
+            case State::Damaged: return "DAMAGED";
+            case State::Unprotected: return "no checksums";
+            case State::Missing: return "missing";
+        }
+        return "";
+    }
+
+private:
+    static constexpr size_t BLOCKS_PER_JOB = 64;  // 4 MiB of reading per scheduler job
+    static constexpr chrono::milliseconds SIDECAR_WRITE_DELAY{ 200 };
+
+    struct Sidecar {
+        uint64_t size = 0;
+        int64_t modified = 0;
+        vector<uint32_t> sums;
+    };
+
+    string path;
+    mutex mtx;              // Guards the fields below against the deferred writer
+    mutex sidecarMutex;     // Keeps sidecar writes in order; taken before mtx
+    vector<uint32_t> sums;  // One per block, the last possibly partial
+    uint64_t covered = 0;   // Bytes of the file the sums describe
+    bool loaded = false;
+    bool dirty = false;     // Sums have moved on since the sidecar was written
+    bool writeQueued = false;
+
+    void extend(string_view data) {
+        size_t partial = static_cast<size_t>(covered % BLOCK_SIZE);
+        if (partial > 0 && !data.empty()) {
+            size_t take = min(BLOCK_SIZE - partial, data.size());
+            sums.back() = crc32(sums.back(), data.data(), take);
+            covered += take;
+            data.remove_prefix(take);
+        }
+        while (!data.empty()) {
+            size_t take = min(BLOCK_SIZE, data.size());
+            sums.push_back(crc32(0, data.data(), take));
+            covered += take;
+            data.remove_prefix(take);
+        }
+    }
+
+    static int64_t modifiedTime(const string& path) {
+        error_code ec;
+        auto stamp = filesystem::last_write_time(path, ec);
+        return ec ? 0 : static_cast<int64_t>(stamp.time_since_epoch().count());
+    }
+
+    // "blocks,<block size>,<file size>,<modified>" then one hex CRC per line
+    static bool readSidecar(const string& path, Sidecar& sidecar) {
+        ifstream in(sumsPathOf(path));
+        string line;
+        if (!getline(in, line)) return false;
+        string_view header(line);
+        if (Utils::nextField(header) != "blocks") return false;
+        string_view blockSize = Utils::nextField(header);
+        string_view size = Utils::nextField(header);
+        uint64_t declaredBlock = 0;
+        from_chars(blockSize.data(), blockSize.data() + blockSize.size(), declaredBlock);
+        if (declaredBlock != BLOCK_SIZE) return false;
+        from_chars(size.data(), size.data() + size.size(), sidecar.size);
+        from_chars(header.data(), header.data() + header.size(), sidecar.modified);
+        sidecar.sums.clear();
+        while (getline(in, line)) {
+            uint32_t crc = 0;
+            from_chars(line.data(), line.data() + line.size(), crc, 16);
+            sidecar.sums.push_back(crc);
+        }
+        return sidecar.sums.size() == (sidecar.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    }
+
+    static void writeSidecar(const string& path, uint64_t size, const vector<uint32_t>& sums) {
+        string out = "blocks," + to_string(BLOCK_SIZE) + "," + to_string(size) + "," +
+                     to_string(modifiedTime(path)) + "\n";
+        char hex[16];
+        for (uint32_t crc : sums) {
+            snprintf(hex, sizeof(hex), "%08x\n", crc);
+            out.append(hex);
+        }
+        string sumsPath = sumsPathOf(path);
+        {
+            ofstream file(sumsPath + ".tmp", ios::binary | ios::trunc);
+            if (!file.is_open()) return;
+            file.write(out.data(), static_cast<streamsize>(out.size()));
+        }
+        error_code ec;
+        filesystem::rename(sumsPath + ".tmp", sumsPath, ec);
+    }
+
+    // Runs on the scheduler; each job owns its own blocks' slots in the scan
+    template <typename Scan>
+    static void checkBlocks(const string& path, Scan& scan, size_t first, size_t last) {
+        ifstream in(path, ios::binary);
+        in.seekg(static_cast<streamoff>(first * BLOCK_SIZE));
+        vector<char> buffer(BLOCK_SIZE);
+        for (size_t b = first; b < last; b++) {
+            size_t length = static_cast<size_t>(min<uint64_t>(BLOCK_SIZE, scan.coveredSize - b * BLOCK_SIZE));
+            in.read(buffer.data(), static_cast<streamsize>(length));
+            size_t got = in ? length : static_cast<size_t>(max<streamsize>(0, in.gcount()));
+            scan.newlines[b] = static_cast<uint32_t>(count(buffer.begin(), buffer.begin() + static_cast<ptrdiff_t>(got), '\n'));
+            scan.endsLine[b] = got > 0 && buffer[got - 1] == '\n';
+            scan.bad[b] = got != length || crc32(0, buffer.data(), length) != scan.expected[b];
+            if (!in) in.clear(ios::eofbit);
+        }
+    }
+};
+
+// Splits the transaction log into segments. Entries go to the active file;
+// once it outgrows the size limit or a new day starts it is sealed into
+// logs/segment-NNNNNN<ext> and compressed in the background. logs/manifest.txt
+// records every sealed segment's entry-ID and time range, so a reader only
+// opens the segments overlapping its range. logs/active.txt describes the
+// active file; it is rewritten only at rollover and shutdown, and records the
+// file size it describes so the owner can rescan the file after a crash.
+// Segments sealed from the old text log keep a ".log" name so readers can
+// tell the two formats apart.
+class SegmentedLog {
+public:
+    struct Segment {
+        uint64_t segmentId = 0;
+        uint64_t firstId = 0;
+        uint64_t lastId = 0;
+        string startTime;
+        string endTime;
+        string file;
+        bool compressed = false;
+    };
+
+private:
+    string activePath;
+    string directory;
+    string manifestPath;
+    string activeMetaPath;
+    string extension;
+    size_t maxSegmentBytes;
+    bool readOnly;  // Opened by a tool next to a running store: never writes or compresses
+    vector<Segment> sealed;
+    Segment active;  // Range of the entries in the active file; firstId 0 while empty
+    size_t activeBytes = 0;
+    size_t metaBytes = 0;  // Active file size as of the last active.txt write
+    BlockChecksums activeSums;
+    mutex mtx;  // Guards sealed/manifest against the compression threads
+    vector<shared_future<void>> compressions;
+
+    string segmentFile(uint64_t segmentId, const string& ext) const {
+        char name[32];
+        snprintf(name, sizeof(name), "segment-%06llu", static_cast<unsigned long long>(segmentId));
+        return Utils::dataPath(directory, string(name) + ext);
+    }
+
+    static string segmentLine(const Segment& s) {
+        return to_string(s.segmentId) + "," + to_string(s.firstId) + "," + to_string(s.lastId) + "," +
+               s.startTime + "," + s.endTime + "," + s.file + "," + (s.compressed ? "1" : "0");
+    }
+
+    static bool parseSegment(string_view line, Segment& s) {
+        try {
+            s.segmentId = stoull(string(Utils::nextField(line)));
+            s.firstId = stoull(string(Utils::nextField(line)));
+            s.lastId = stoull(string(Utils::nextField(line)));
+            s.startTime = string(Utils::nextField(line));
+            s.endTime = string(Utils::nextField(line));
+            s.file = string(Utils::nextField(line));
+            s.compressed = Utils::nextField(line) == "1";
+            return true;
+        } catch (...) {
+            return false;
+        }
+    }
+
+    // Caller holds mtx
+    void writeManifest() {
+        string tmp = manifestPath + ".tmp";
+        {
+            ofstream out(tmp, ios::trunc);
+            for (const auto& s : sealed) out << segmentLine(s) << "\n";
+        }
+        filesystem::rename(tmp, manifestPath);
+    }
+
+    // The range line, then the active file's size at the time
+    void writeActiveMeta() {
+        ofstream out(activeMetaPath, ios::trunc);
+        out << segmentLine(active) << "\n" << activeBytes << "\n";
+        metaBytes = activeBytes;
+    }
+
+    void compressSegment(uint64_t segmentId) {
+        string rawPath;
+        {
+            lock_guard<mutex> lock(mtx);
+            for (const auto& s : sealed) {
+                if (s.segmentId == segmentId && !s.compressed) rawPath = s.file;
+            }
+        }
+        if (rawPath.empty()) return;
+
+        ifstream in(rawPath, ios::binary);
+        string raw((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        in.close();
+        string packedPath = rawPath + ".lz";
+        string packed = Compression::compress(raw);
+        {
+            ofstream out(packedPath + ".tmp", ios::binary | ios::trunc);
+            out.write(packed.data(), static_cast<streamsize>(packed.size()));
+        }
+        error_code ec;
+        filesystem::rename(packedPath + ".tmp", packedPath, ec);
+        if (ec) return;
+        BlockChecksums::seal(packedPath, packed);
+
+        lock_guard<mutex> lock(mtx);
+        for (auto& s : sealed) {
+            if (s.segmentId == segmentId) {
+                s.file = packedPath;
+                s.compressed = true;
+            }
+        }
+        writeManifest();
+        filesystem::remove(rawPath, ec);
+        filesystem::remove(BlockChecksums::sumsPathOf(rawPath), ec);
+    }
+
+    // Moves a finished text-format log into the sealed set and queues it for compression
+    void sealLegacyFile(const string& path, Segment segment) {
+        lock_guard<mutex> lock(mtx);
+        segment.segmentId = sealed.empty() ? 1 : sealed.back().segmentId + 1;
+        segment.file = segmentFile(segment.segmentId, ".log");
+        segment.compressed = false;
+        error_code ec;
+        filesystem::rename(path, segment.file, ec);
+        if (ec) return;
+        BlockChecksums::seal(segment.file);
+        sealed.push_back(segment);
+        writeManifest();
+        queueCompression(segment.segmentId);
+    }
+
+    void queueCompression(uint64_t segmentId) {
+        compressions.push_back(TaskScheduler::shared().submit([this, segmentId] { compressSegment(segmentId); },
+                                                              TaskScheduler::Priority::Low, this).done);
+    }
+
+    void seal() {
+        lock_guard<mutex> lock(mtx);
+        Segment segment = active;
+        segment.segmentId = sealed.empty() ? 1 : sealed.back().segmentId + 1;
+        segment.file = segmentFile(segment.segmentId, extension);
+        segment.compressed = false;
+        error_code ec;
+        activeSums.flush();
+        filesystem::rename(activePath, segment.file, ec);
+        if (ec) return;
+        filesystem::rename(BlockChecksums::sumsPathOf(activePath), BlockChecksums::sumsPathOf(segment.file), ec);
+        activeSums.reset();
+        sealed.push_back(segment);
+        writeManifest();
+        active = Segment();
+        activeBytes = 0;
+        writeActiveMeta();
+        queueCompression(segment.segmentId);
+    }
+
+public:
+    SegmentedLog(string activeFile, string logDirectory, string segmentExtension, size_t maxBytes = 1 << 20,
+                 bool openReadOnly = false)
+        : activePath(move(activeFile)), directory(move(logDirectory)),
+          manifestPath(Utils::dataPath(directory, "manifest.txt")),
+          activeMetaPath(Utils::dataPath(directory, "active.txt")), extension(move(segmentExtension)),
+          maxSegmentBytes(maxBytes), readOnly(openReadOnly), activeSums(activePath) {
+        error_code ec;
+        if (!readOnly) filesystem::create_directories(directory, ec);
+
+        ifstream manifest(manifestPath);
+        string line;
+        Segment segment;
+        while (getline(manifest, line)) {
+            if (parseSegment(line, segment)) sealed.push_back(segment);
+        }
+        ifstream meta(activeMetaPath);
+        if (getline(meta, line)) parseSegment(line, active);
+        activeBytes = filesystem::exists(activePath, ec) ? static_cast<size_t>(filesystem::file_size(activePath, ec)) : 0;
+        // Older versions rewrote active.txt on every append and recorded no size, so theirs is current
+        metaBytes = activeBytes;
+        if (getline(meta, line)) metaBytes = static_cast<size_t>(strtoull(line.c_str(), nullptr, 10));
+
+        // Segments sealed by a run that ended before compressing them are finished now
+        for (const auto& s : sealed) {
+            if (!s.compressed && !readOnly) {
+                queueCompression(s.segmentId);
+            }
+        }
+    }
+
+    ~SegmentedLog() {
+        waitForCompression();
+        flushActiveMeta();
+    }
+
+    // Records the active file's range in active.txt, as at shutdown
+    void flushActiveMeta() {
+        lock_guard<mutex> lock(mtx);
+        if (!readOnly && metaBytes != activeBytes) writeActiveMeta();
+    }
+
+    // After a crash active.txt describes an older active file. The owner, which
+    // knows the entry format, rescans the file and fills in its range.
+    void recoverActiveRange(const function<void(string_view content, Segment& range)>& scan) {
+        if (metaBytes == activeBytes) return;
+        ifstream in(activePath, ios::binary);
+        string content((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        Segment range;
+        scan(content, range);
+        lock_guard<mutex> lock(mtx);
+        active = range;
+        if (!readOnly) writeActiveMeta();
+    }
+
+    // Writes the active file's pending checksums now rather than when their deferred write comes due
+    void flushChecksums() { activeSums.flush(); }
+
+    // Reads a text-format log where it lies, for a read-only log that may not move it
+    void includeLegacyFile(const string& path, uint64_t firstId, uint64_t lastId,
+                           const string& startTime, const string& endTime) {
+        lock_guard<mutex> lock(mtx);
+        Segment segment;
+        segment.segmentId = sealed.empty() ? 1 : sealed.back().segmentId + 1;
+        segment.firstId = firstId;
+        segment.lastId = lastId;
+        segment.startTime = startTime;
+        segment.endTime = endTime;
+        segment.file = path;
+        sealed.push_back(segment);
+    }
+
+    // Seals a log file written in the old text format as the next segment. Any range
+    // recorded for the active file belonged to that text log if no records exist yet.
+    void adoptLegacyFile(const string& path, uint64_t firstId, uint64_t lastId,
+                         const string& startTime, const string& endTime) {
+        Segment segment;
+        segment.firstId = firstId;
+        segment.lastId = lastId;
+        segment.startTime = startTime;
+        segment.endTime = endTime;
+        sealLegacyFile(path, segment);
+        if (activeBytes == 0) {
+            active = Segment();
+            writeActiveMeta();
+        }
+    }
+
+    // Appends one entry, rolling the active segment over first if it is full or from an earlier day
+    void append(uint64_t id, const string& timestamp, string_view entry) {
+        bool newDay = active.firstId != 0 && active.startTime.compare(0, 10, timestamp, 0, 10) != 0;
+        if (activeBytes > 0 && (activeBytes + entry.size() > maxSegmentBytes || newDay)) seal();
+
+        ofstream logFile(activePath, ios::app | ios::binary);
+        if (!logFile.is_open()) return;
+        logFile.write(entry.data(), static_cast<streamsize>(entry.size()));
+        logFile.close();
+        activeSums.append(entry);
+        activeBytes += entry.size();
+
+        if (active.firstId == 0) {
+            active.firstId = id;
+            active.startTime = timestamp;
+        }
+        active.lastId = id;
+        active.endTime = timestamp;
+    }
+
+    // Streams the content of every segment whose time range overlaps [from, to], oldest first,
+    // flagging segments still in the old text format. Bounds compare as timestamp
+    // prefixes, so "2025-05-17" covers that whole day.
+    void forEachSegment(const string& from, const string& to,
+                        const function<void(string_view content, bool legacyText)>& visit) {
+        string content;
+        for (const auto& s : segmentsInRange(from, to)) {
+            if (readFile(s, content)) visit(content, isLegacyText(s));
+        }
+    }
+
+    // The segments forEachSegment would visit, oldest first, with the active file last
+    vector<Segment> segmentsInRange(const string& from, const string& to) {
+        vector<Segment> candidates;
+        {
+            lock_guard<mutex> lock(mtx);
+            for (const auto& s : sealed) {
+                bool beforeRange = !from.empty() && s.endTime.compare(0, from.size(), from) < 0;
+                bool afterRange = !to.empty() && s.startTime.compare(0, to.size(), to) > 0;
+                if (!beforeRange && !afterRange) candidates.push_back(s);
+            }
+        }
+        bool activeAfter = !to.empty() && !active.startTime.empty() && active.startTime.compare(0, to.size(), to) > 0;
+        if (activeBytes > 0 && !activeAfter) {
+            Segment current = active;
+            current.file = activePath;
+            current.compressed = false;
+            candidates.push_back(current);
+        }
+        return candidates;
+    }
+
+    // Judged by the file's own extension, so a data root whose path contains ".log" is no trouble
+    static bool isLegacyText(const Segment& s) {
+        string name = filesystem::path(s.file).filename().string();
+        if (s.compressed && name.size() > 3 && name.compare(name.size() - 3, 3, ".lz") == 0) name.resize(name.size() - 3);
+        bool text = name.size() > 4 && (name.compare(name.size() - 4, 4, ".log") == 0 ||
+                                        name.compare(name.size() - 4, 4, ".txt") == 0);  // Not yet adopted
+        return text;
+    }
+
+    static bool readFile(const Segment& s, string& content) {
+        ifstream in(s.file, ios::binary);
+        if (!in.is_open()) return false;
+        string raw((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        if (!s.compressed) {
+            content = move(raw);
+            return true;
+        }
+        return Compression::decompress(raw, content);
+    }
+
+    vector<Segment> segments() {
+        lock_guard<mutex> lock(mtx);
+        return sealed;
+    }
+
+    // ID of the newest entry on disk, or 0 for an empty log
+    uint64_t lastId() {
+        lock_guard<mutex> lock(mtx);
+        if (active.firstId != 0) return active.lastId;
+        return sealed.empty() ? 0 : sealed.back().lastId;
+    }
+
+    void waitForCompression() {
+        for (auto& f : compressions) {
+            if (f.valid()) f.wait();
+        }
+        compressions.clear();
+    }
+};
+
+// Payment request handed from a billing strategy to the payment pipeline
+struct PaymentRequest {
+    string method;
+    string account;
+    int64_t amountCents = 0;
+    bool settledLocally = false;  // Cash is settled at the counter, no gateway trip
+};
+
+struct PaymentResult {
+    bool approved = false;
+    string reference;
+    string message;
+};
+
+// Billing strategies are stateless value types dispatched at compile time
+// through BillingRegistry, so no strategy is allocated per transaction.
+// A strategy only gathers payment details; the PaymentPipeline settles it.
+class CashBilling {
+public:
+    static constexpr string_view getName() { return "Cash"; }
+    
+    PaymentRequest prepareRequest(int64_t amountCents) const {
+        cout << "Processing cash payment of " << Utils::formatCents(amountCents) << "\n";
+        return PaymentRequest{ string(getName()), "", amountCents, true };
+    }
+};
+
+class GCashBilling {
+public:
+    static constexpr string_view getName() { return "GCash"; }
+    
+    PaymentRequest prepareRequest(int64_t amountCents) const {
+        string mobileNumber;
+        bool valid = false;
+        do {
+            mobileNumber = Utils::getInput("Enter GCash mobile number (09XXXXXXXXX): ");
+            valid = (mobileNumber.length() == 11 && mobileNumber.substr(0, 2) == "09");
+            if (!valid) {
+                cout << "Invalid GCash mobile number format.\n";
+            }
+        } while (!valid);
+
+        cout << "Sending payment request of " << Utils::formatCents(amountCents)
+             << " to " << mobileNumber << "...\n";
+        return PaymentRequest{ string(getName()), move(mobileNumber), amountCents, false };
+    }
+};
+
+class PayMayaBilling {
+public:
+    static constexpr string_view getName() { return "PayMaya"; }
+    
+    PaymentRequest prepareRequest(int64_t amountCents) const {
+        string cardNumber;
+        bool valid = false;
+        do {
+            cardNumber = Utils::getInput("Enter PayMaya card number (16 digits): ");
+            valid = (cardNumber.length() == 16 && all_of(cardNumber.begin(), cardNumber.end(), ::isdigit));
+            if (!valid) {
+                cout << "Invalid card number format.\n";
+            }
+        } while (!valid);
+
+        cout << "Processing PayMaya payment of " << Utils::formatCents(amountCents) << "...\n";
+        return PaymentRequest{ string(getName()), move(cardNumber), amountCents, false };
+    }
+};
+
+// Compile-time registry of payment methods. Each strategy is instantiated once
+// and shared; adding a payment method means adding its type to PaymentMethods.
+template <typename... Strategies>
+class BillingRegistry {
+public:
+    using Strategy = variant<Strategies...>;
+
+    static constexpr size_t size() { return sizeof...(Strategies); }
+
+    static const Strategy& at(size_t index) {
+        static const Strategy strategies[] = { Strategy(Strategies{})... };
+        return strategies[index];
+    }
+
+    static string_view getName(const Strategy& strategy) {
+        return visit([](const auto& s) { return s.getName(); }, strategy);
+    }
+
+    // 1-based position of the named method as stored in log records, 0 if unknown
+    static uint8_t codeOf(string_view name) {
+        uint8_t code = 1;
+        for (string_view registered : { Strategies::getName()... }) {
+            if (registered == name) return code;
+            ++code;
+        }
+        return 0;
+    }
+
+    static PaymentRequest prepareRequest(const Strategy& strategy, int64_t amountCents) {
+        return visit([amountCents](const auto& s) { return s.prepareRequest(amountCents); }, strategy);
+    }
+
+    // Numbered menu lines in registration order, e.g. "1. Cash\n"
+    static string menu() {
+        string text;
+        size_t number = 1;
+        for (string_view name : { Strategies::getName()... }) {
+            text.append(to_string(number++)).append(". ").append(name).append("\n");
+        }
+        return text;
+    }
+};
+
+using PaymentMethods = BillingRegistry<CashBilling, GCashBilling, PayMayaBilling>;
+
+// Kinds of transaction recorded in the log
+enum class LogOp : uint8_t {
+    Other = 0, Login, Logout, AddMedicine, UpdateMedicine, DeleteMedicine,
+    AddPrescription, UpdatePrescription, DeletePrescription, Bill, Refund,
+    Report, Import, Export
+};
+
+inline const char* logOpName(LogOp op) {
+    static const char* const names[] = {
+        "Other", "Login", "Logout", "Add medicine", "Update medicine", "Delete medicine",
+        "Add prescription", "Update prescription", "Delete prescription", "Bill", "Refund",
+        "Report", "Import", "Export"
+    };
+    size_t index = static_cast<size_t>(op);
+    return index < sizeof(names) / sizeof(names[0]) ? names[index] : "Unknown";
+}
+
+// What a caller hands the logger: typed fields plus the human-readable action
+struct LogEvent {
+    LogOp op = LogOp::Other;
+    int medicineId = 0;
+    int quantity = 0;
+    int64_t amountCents = 0;
+    uint8_t method = 0;  // 1-based position in PaymentMethods, 0 when not a payment
+    string action;
+};
+
+// Fixed-size part of a stored log record; the action text follows it
+struct TransactionRecord {
+    uint64_t id = 0;
+    int64_t timestamp = 0;  // Unix seconds
+    int64_t amountCents = 0;
+    int32_t medicineId = 0;
+    int32_t quantity = 0;
+    uint16_t userId = 0;
+    LogOp op = LogOp::Other;
+    uint8_t method = 0;
+    uint32_t textLength = 0;
+
+    static constexpr size_t ENCODED_SIZE = 40;
+
+    // Fields are little-endian whatever the host, so a log can be read on another machine
+    template <typename Integer>
+    static void putLittle(char* at, Integer value) {
+        auto bits = static_cast<make_unsigned_t<Integer>>(value);
+        for (size_t i = 0; i < sizeof(Integer); i++) at[i] = static_cast<char>((bits >> (8 * i)) & 0xFF);
+    }
+
+    template <typename Integer>
+    static Integer getLittle(const char* at) {
+        using Bits = make_unsigned_t<Integer>;
+        Bits bits = 0;
+        for (size_t i = 0; i < sizeof(Integer); i++) {
+            bits = static_cast<Bits>(bits | static_cast<Bits>(static_cast<Bits>(static_cast<uint8_t>(at[i])) << (8 * i)));
+        }
+        return static_cast<Integer>(bits);
+    }
+
+    void encode(string& out) const {
+        char header[ENCODED_SIZE];
+        putLittle(header, id);
+        putLittle(header + 8, timestamp);
+        putLittle(header + 16, amountCents);
+        putLittle(header + 24, medicineId);
+        putLittle(header + 28, quantity);
+        putLittle(header + 32, userId);
+        header[34] = static_cast<char>(op);
+        header[35] = static_cast<char>(method);
+        putLittle(header + 36, textLength);
+        out.append(header, ENCODED_SIZE);
+    }
+
+    // Decodes the record at the front of data and advances past it and its text
+    bool decode(string_view& data, string_view& text) {
+        if (data.size() < ENCODED_SIZE) return false;
+        const char* header = data.data();
+        id = getLittle<uint64_t>(header);
+        timestamp = getLittle<int64_t>(header + 8);
+        amountCents = getLittle<int64_t>(header + 16);
+        medicineId = getLittle<int32_t>(header + 24);
+        quantity = getLittle<int32_t>(header + 28);
+        userId = getLittle<uint16_t>(header + 32);
+        op = static_cast<LogOp>(static_cast<uint8_t>(header[34]));
+        method = static_cast<uint8_t>(header[35]);
+        textLength = getLittle<uint32_t>(header + 36);
+        if (data.size() - ENCODED_SIZE < textLength) return false;
+        text = data.substr(ENCODED_SIZE, textLength);
+        data.remove_prefix(ENCODED_SIZE + textLength);
+        return true;
+    }
+};
+
+// Abstract Logger interface
+class ILogger {
+public:
+    virtual ~ILogger() = default;
+    virtual void log(const string& action, const string& username) = 0;
+    virtual void log(const LogEvent& event, const string& username) = 0;
+    virtual void viewLogs() = 0;
+    virtual void viewLogs(const string& from, const string& to) = 0;
+};
+
+// Concrete Logger implementation, one instance per data root. Entries are
+// stored as compact binary records in transaction_log.dat; user names are
+// kept once in logs/log_users.txt and referenced by number. The familiar text
+// view is rendered from the records.
+class FileLogger : public ILogger {
+public:
+    using RecordVisitor = function<void(const TransactionRecord&, string_view text, string_view user)>;
+    static constexpr uint16_t UNKNOWN_USER = UINT16_MAX;  // User ID of old text entries by a name not yet registered
+
+private:
+    static map<string, FileLogger*> instances;
+    static mutex instancesMutex;
+    string idPath;
+    string usersPath;
+    int lastTransactionId;
+    atomic<int> unsavedId{ 0 };  // Newest ID waiting for the deferred rewrite of last_id.txt
+    atomic<bool> idWriteQueued{ false };
+    mutex idFileMutex;
+    vector<string> users;
+    unordered_map<string, uint16_t> userIds;
+    bool userTableFull = false;  // Warned once that new names can no longer get an ID
+    bool readOnly;
+    SegmentedLog segments;
+    vector<pair<int, RecordVisitor>> listeners;
+    int nextListenerId = 1;
+
+    uint16_t userId(const string& name) {
+        auto it = userIds.find(name);
+        if (it != userIds.end()) return it->second;
+        // IDs are 16 bits and UNKNOWN_USER is reserved, so names past that are logged without one
+        if (users.size() >= UNKNOWN_USER) {
+            if (!userTableFull) cerr << "Warning: " << usersPath << " is full; new users are logged as unknown\n";
+            userTableFull = true;
+            return UNKNOWN_USER;
+        }
+        uint16_t id = static_cast<uint16_t>(users.size());
+        users.push_back(name);
+        userIds.emplace(name, id);
+        ofstream usersFile(usersPath, ios::app);
+        usersFile << name << "\n";
+        return id;
+    }
+
+    // Readers look names up without registering them; a name never logged under maps to UNKNOWN_USER
+    uint16_t knownUserId(string_view name) const {
+        auto it = userIds.find(string(name));
+        return it == userIds.end() ? UNKNOWN_USER : it->second;
+    }
+
+    // Reads "ID: n | Time: t | User: u | Action: a" lines of the old text log
+    static bool parseTextEntry(string_view line, TransactionRecord& record, string_view& user, string_view& action) {
+        if (line.substr(0, 4) != "ID: ") return false;
+        size_t timeAt = line.find(" | Time: ");
+        size_t userAt = line.find(" | User: ");
+        size_t actionAt = line.find(" | Action: ");
+        if (timeAt == string_view::npos || userAt == string_view::npos || actionAt == string_view::npos) return false;
+        try {
+            record.id = stoull(string(line.substr(4, timeAt - 4)));
+        } catch (...) {
+            return false;
+        }
+        record.timestamp = Utils::parseTimestamp(string(line.substr(timeAt + 9, userAt - timeAt - 9)));
+        user = line.substr(userAt + 9, actionAt - userAt - 9);
+        action = line.substr(actionAt + 11);
+        record.op = LogOp::Other;
+        record.method = 0;
+        record.amountCents = 0;
+        record.medicineId = 0;
+        record.quantity = 0;
+        // Old bills only recorded quantity and method in the text; amounts were never logged
+        if (action.substr(0, 7) == "Billed ") {
+            record.op = LogOp::Bill;
+            size_t qtyAt = action.find(" x");
+            if (qtyAt != string_view::npos) record.quantity = atoi(string(action.substr(qtyAt + 2)).c_str());
+            size_t methodAt = action.find("Method: ");
+            if (methodAt != string_view::npos) {
+                string_view method = action.substr(methodAt + 8);
+                record.method = PaymentMethods::codeOf(method.substr(0, method.find(',')));
+            }
+        } else if (action.substr(0, 10) == "Logged in ") {
+            record.op = LogOp::Login;
+        } else if (action == "Logged out") {
+            record.op = LogOp::Logout;
+        }
+        record.textLength = static_cast<uint32_t>(action.size());
+        return true;
+    }
+
+    // A text log left by an older version becomes a sealed segment of its own;
+    // a read-only logger reads it in place instead
+    void adoptLegacyLog(const string& textPath) {
+        ifstream logFile(textPath);
+        string line;
+        TransactionRecord record;
+        string_view user, action;
+        uint64_t firstId = 0, lastId = 0;
+        int64_t firstTime = 0, lastTime = 0;
+        while (getline(logFile, line)) {
+            if (!parseTextEntry(line, record, user, action)) continue;
+            if (!readOnly) userId(string(user));  // Registered now, while nothing else runs, so readers resolve the name
+            if (firstId == 0) {
+                firstId = record.id;
+                firstTime = record.timestamp;
+            }
+            lastId = record.id;
+            lastTime = record.timestamp;
+        }
+        logFile.close();
+        if (readOnly) {
+            segments.includeLegacyFile(textPath, firstId, lastId, Utils::formatTimestamp(firstTime),
+                                       Utils::formatTimestamp(lastTime));
+        } else {
+            segments.adoptLegacyFile(textPath, firstId, lastId, Utils::formatTimestamp(firstTime),
+                                     Utils::formatTimestamp(lastTime));
+        }
+    }
+
+    explicit FileLogger(const string& dataRoot, bool openReadOnly = false)
+        : idPath(Utils::dataPath(dataRoot, "last_id.txt")),
+          usersPath(Utils::dataPath(dataRoot, "logs/log_users.txt")), readOnly(openReadOnly),
+          segments(Utils::dataPath(dataRoot, "transaction_log.dat"), Utils::dataPath(dataRoot, "logs"), ".rec",
+                   1 << 20, openReadOnly) {
+        ifstream idFile(idPath);
+        if (idFile.is_open()) {
+            idFile >> lastTransactionId;
+            idFile.close();
+        } else {
+            lastTransactionId = 0;
+        }
+
+        // Earlier versions used logs/users.txt, easily mistaken for the account file
+        string oldUsersPath = Utils::dataPath(dataRoot, "logs/users.txt");
+        error_code ec;
+        bool renamePending = !filesystem::exists(usersPath, ec) && filesystem::exists(oldUsersPath, ec);
+        if (renamePending && !readOnly) {
+            filesystem::rename(oldUsersPath, usersPath, ec);
+            renamePending = static_cast<bool>(ec);
+        }
+        if (renamePending) usersPath = oldUsersPath;  // Read-only, or the rename failed: keep using the old file
+        ifstream usersFile(usersPath);
+        string name;
+        while (users.size() < UNKNOWN_USER && getline(usersFile, name)) {
+            userIds.emplace(name, static_cast<uint16_t>(users.size()));
+            users.push_back(name);
+        }
+
+        segments.recoverActiveRange([](string_view content, SegmentedLog::Segment& range) {
+            TransactionRecord record;
+            string_view text;
+            int64_t firstTime = 0, lastTime = 0;
+            while (record.decode(content, text)) {
+                if (range.firstId == 0) {
+                    range.firstId = record.id;
+                    firstTime = record.timestamp;
+                }
+                range.lastId = record.id;
+                lastTime = record.timestamp;
+            }
+            if (range.firstId == 0) return;
+            range.startTime = Utils::formatTimestamp(firstTime);
+            range.endTime = Utils::formatTimestamp(lastTime);
+        });
+
+        string textPath = Utils::dataPath(dataRoot, "transaction_log.txt");
+        if (filesystem::exists(textPath, ec)) adoptLegacyLog(textPath);
+
+        // last_id.txt is written lazily, so after a crash the log itself may be ahead of it
+        lastTransactionId = max(lastTransactionId, static_cast<int>(segments.lastId()));
+        unsavedId = lastTransactionId;
+    }
+
+    static constexpr chrono::milliseconds ID_WRITE_DELAY{ 200 };
+
+    void saveLastId() {
+        if (readOnly) return;
+        idWriteQueued = false;
+        lock_guard<mutex> lock(idFileMutex);
+        ofstream idFile(idPath);
+        if (idFile.is_open()) {
+            idFile << unsavedId.load();
+            idFile.close();
+        }
+    }
+
+public:
+    static FileLogger* getInstance(const string& dataRoot = "") {
+        lock_guard<mutex> lock(instancesMutex);
+        FileLogger*& instance = instances[dataRoot];
+        if (!instance) {
+            instance = new FileLogger(dataRoot);
+        }
+        return instance;
+    }
+
+    // For tools that only read the log, such as --query; not shared with getInstance
+    static unique_ptr<FileLogger> openReadOnly(const string& dataRoot) {
+        return unique_ptr<FileLogger>(new FileLogger(dataRoot, true));
+    }
+
+    // Lets background segment compression finish before the process exits
+    static void shutdownAll() {
+        lock_guard<mutex> lock(instancesMutex);
+        for (auto& entry : instances) {
+            TaskScheduler::shared().drain(entry.second);
+            entry.second->saveLastId();
+            entry.second->segments.flushChecksums();
+            entry.second->segments.waitForCompression();
+            entry.second->segments.flushActiveMeta();
+        }
+    }
+
+    ~FileLogger() override = default;
+
+    void log(const string& action, const string& username) override {
+        log(LogEvent{ LogOp::Other, 0, 0, 0, 0, action }, username);
+    }
+
+    void log(LogOp op, const string& action, const string& username) {
+        log(LogEvent{ op, 0, 0, 0, 0, action }, username);
+    }
+
+    void log(const LogEvent& event, const string& username) override {
+        if (readOnly) return;
+        lastTransactionId++;
+        TransactionRecord record;
+        record.id = static_cast<uint64_t>(lastTransactionId);
+        record.timestamp = static_cast<int64_t>(time(nullptr));
+        record.amountCents = event.amountCents;
+        record.medicineId = event.medicineId;
+        record.quantity = event.quantity;
+        record.userId = userId(username);
+        record.op = event.op;
+        record.method = event.method;
+        record.textLength = static_cast<uint32_t>(event.action.size());
+
+        string entry;
+        entry.reserve(TransactionRecord::ENCODED_SIZE + event.action.size());
+        record.encode(entry);
+        entry.append(event.action);
+        segments.append(record.id, Utils::formatTimestamp(record.timestamp), entry);
+
+        // Bursts of entries share one rewrite of last_id.txt, done off the caller's thread
+        unsavedId = lastTransactionId;
+        if (!idWriteQueued.exchange(true)) {
+            TaskScheduler::shared().schedule([this] { saveLastId(); }, ID_WRITE_DELAY,
+                                             TaskScheduler::Priority::Low, this);
+        }
+
+        for (const auto& listener : listeners) listener.second(record, event.action, username);
+    }
+
+    // Registers a callback run after each new entry is written; returns an id for unsubscribe
+    int subscribe(RecordVisitor listener) {
+        listeners.emplace_back(nextListenerId, move(listener));
+        return nextListenerId++;
+    }
+
+    void unsubscribe(int listenerId) {
+        listeners.erase(remove_if(listeners.begin(), listeners.end(),
+                                  [listenerId](const auto& l) { return l.first == listenerId; }),
+                        listeners.end());
+    }
+
+    // Visits every record whose time falls on or between the given dates (blank = unbounded),
+    // reading only the segments that overlap them
+    void forEachRecord(const string& from, const string& to, const RecordVisitor& visit) {
+        int64_t fromTime = from.empty() ? INT64_MIN : Utils::parseTimestamp(from + " 00:00:00");
+        int64_t toTime = to.empty() ? INT64_MAX : Utils::parseTimestamp(to + " 23:59:59");
+        segments.forEachSegment(from, to, [&](string_view content, bool legacyText) {
+            TransactionRecord record;
+            string_view text, user;
+            while (!content.empty()) {
+                if (legacyText) {
+                    size_t newline = content.find('\n');
+                    string_view line = content.substr(0, newline);
+                    content.remove_prefix(newline == string_view::npos ? content.size() : newline + 1);
+                    if (!parseTextEntry(line, record, user, text)) continue;
+                    record.userId = knownUserId(user);
+                } else {
+                    if (!record.decode(content, text)) break;
+                    user = record.userId < users.size() ? string_view(users[record.userId]) : string_view("?");
+                }
+                if (record.timestamp < fromTime || record.timestamp > toTime) continue;
+                visit(record, text, user);
+            }
+        });
+    }
+
+    // Decodes the segments overlapping the range on a pool of threads. Each segment
+    // is folded into its own Partial by visit(partial, record, text, user); the
+    // partials come back oldest segment first for the caller to merge.
+    template <typename Partial, typename Visit>
+    vector<Partial> scanParallel(const string& from, const string& to, Visit visit) {
+        vector<SegmentedLog::Segment> parts = segments.segmentsInRange(from, to);
+        vector<Partial> partials(parts.size());
+        int64_t fromTime = from.empty() ? INT64_MIN : Utils::parseTimestamp(from + " 00:00:00");
+        int64_t toTime = to.empty() ? INT64_MAX : Utils::parseTimestamp(to + " 23:59:59");
+        atomic<size_t> next{0};
+        auto worker = [&]() {
+            string content;
+            for (size_t i = next++; i < parts.size(); i = next++) {
+                if (!SegmentedLog::readFile(parts[i], content)) continue;
+                bool legacyText = SegmentedLog::isLegacyText(parts[i]);
+                string_view rest = content;
+                TransactionRecord record;
+                string_view text, user;
+                while (!rest.empty()) {
+                    if (legacyText) {
+                        size_t newline = rest.find('\n');
+                        string_view line = rest.substr(0, newline);
+                        rest.remove_prefix(newline == string_view::npos ? rest.size() : newline + 1);
+                        if (!parseTextEntry(line, record, user, text)) continue;
+                        record.userId = knownUserId(user);
+                    } else {
+                        if (!record.decode(rest, text)) break;
+                        user = record.userId < users.size() ? string_view(users[record.userId]) : string_view("?");
+                    }
+                    if (record.timestamp < fromTime || record.timestamp > toTime) continue;
+                    visit(partials[i], record, text, user);
+                }
+            }
+        };
+        size_t threads = min<size_t>(parts.size(), max(1u, thread::hardware_concurrency()));
+        vector<future<void>> pool;
+        for (size_t t = 1; t < threads; ++t) pool.push_back(async(launch::async, worker));
+        worker();
+        for (auto& f : pool) f.get();
+        return partials;
+    }
+
+    const vector<string>& userNames() const { return users; }
+
+    void viewLogs() override {
+        viewLogs("", "");
+    }
+
+    void viewLogs(const string& from, const string& to) override {
+        bool any = false;
+        string line;
+        forEachRecord(from, to, [&](const TransactionRecord& record, string_view text, string_view user) {
+            line.assign("ID: ").append(to_string(record.id))
+                .append(" | Time: ").append(Utils::formatTimestamp(record.timestamp))
+                .append(" | User: ").append(user)
+                .append(" | Action: ").append(text).append("\n");
+            cout << line;
+            any = true;
+        });
+        if (!any) cout << "No logs found.\n";
+    }
+};
+
+map<string, FileLogger*> FileLogger::instances;
+mutex FileLogger::instancesMutex;
+
+
+// Column-wise copy of the transaction records for ad-hoc reporting. Each
+// field lives in its own array, so the aggregation loops below touch only
+// the columns they need and compile to tight, vectorisable passes.
+class TransactionQuery {
+    vector<int32_t> days;  // local calendar day, counted from 1970-01-01
+    vector<uint8_t> ops;
+    vector<uint8_t> methods;
+    vector<int32_t> medicineIds;
+    vector<int32_t> quantities;
+    vector<int64_t> amounts;
+    vector<uint16_t> userIds;
+    vector<string> userNames;
+
+public:
+    static constexpr const char* QUERIES[] = { "revenue", "units", "operations", "users" };
+
+    // Loads every record dated between from and to (YYYY-MM-DD, blank = unbounded)
+    TransactionQuery(FileLogger& logger, const string& from, const string& to) {
+        logger.forEachRecord(from, to, [&](const TransactionRecord& record, string_view, string_view) {
+            days.push_back(Utils::localDay(record.timestamp));
+            ops.push_back(static_cast<uint8_t>(record.op));
+            methods.push_back(record.method);
+            medicineIds.push_back(record.medicineId);
+            quantities.push_back(record.quantity);
+            amounts.push_back(record.amountCents);
+            userIds.push_back(record.userId);
+        });
+        userNames = logger.userNames();
+    }
+
+    size_t size() const { return days.size(); }
+
+    // Billed revenue per day and payment method
+    void revenueByMethod(ostream& out) const {
+        if (days.empty()) {
+            out << "No transactions in range.\n";
+            return;
+        }
+        auto range = minmax_element(days.begin(), days.end());
+        int32_t firstDay = *range.first;
+        size_t dayCount = static_cast<size_t>(*range.second - firstDay) + 1;
+        size_t columns = PaymentMethods::size() + 1;  // column 0 collects bills without a method
+        vector<int64_t> grid(dayCount * columns, 0);
+        const uint8_t bill = static_cast<uint8_t>(LogOp::Bill);
+        for (size_t i = 0; i < days.size(); ++i) {
+            size_t method = methods[i] < columns ? methods[i] : 0;
+            grid[static_cast<size_t>(days[i] - firstDay) * columns + method] += ops[i] == bill ? amounts[i] : 0;
+        }
+
+        out << left << setw(12) << "Date";
+        for (size_t m = 1; m < columns; ++m) out << right << setw(14) << PaymentMethods::getName(PaymentMethods::at(m - 1));
+        out << right << setw(14) << "Unrecorded" << setw(14) << "Total" << "\n";
+        vector<int64_t> totals(columns, 0);
+        for (size_t d = 0; d < dayCount; ++d) {
+            const int64_t* row = &grid[d * columns];
+            int64_t dayTotal = 0;
+            for (size_t m = 0; m < columns; ++m) dayTotal += row[m];
+            if (dayTotal == 0) continue;
+            out << left << setw(12) << Utils::dayLabel(firstDay + static_cast<int32_t>(d));
+            for (size_t m = 1; m < columns; ++m) out << right << setw(14) << Utils::formatCents(row[m]);
+            out << right << setw(14) << Utils::formatCents(row[0]) << setw(14) << Utils::formatCents(dayTotal) << "\n";
+            for (size_t m = 0; m < columns; ++m) totals[m] += row[m];
+        }
+        int64_t grandTotal = 0;
+        out << left << setw(12) << "Total";
+        for (size_t m = 1; m < columns; ++m) {
+            out << right << setw(14) << Utils::formatCents(totals[m]);
+            grandTotal += totals[m];
+        }
+        grandTotal += totals[0];
+        out << right << setw(14) << Utils::formatCents(totals[0]) << setw(14) << Utils::formatCents(grandTotal) << "\n";
+    }
+
+    // Units dispensed per medicine lot, resolving names through the caller
+    void unitsByMedicine(ostream& out, const function<string(int)>& medicineName) const {
+        unordered_map<int32_t, int64_t> units;
+        const uint8_t bill = static_cast<uint8_t>(LogOp::Bill);
+        for (size_t i = 0; i < ops.size(); ++i) {
+            if (ops[i] == bill) units[medicineIds[i]] += quantities[i];
+        }
+        if (units.empty()) {
+            out << "No units dispensed in range.\n";
+            return;
+        }
+        vector<pair<int32_t, int64_t>> sorted(units.begin(), units.end());
+        sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+        out << left << setw(30) << "Medicine" << right << setw(10) << "Units" << "\n";
+        for (const auto& entry : sorted) {
+            string name = entry.first == 0 ? "(not recorded)" : medicineName(entry.first);
+            out << left << setw(30) << name << right << setw(10) << entry.second << "\n";
+        }
+    }
+
+    // Number of records of each kind
+    void countsByOperation(ostream& out) const {
+        size_t counts[256] = {};
+        for (uint8_t op : ops) counts[op]++;
+        out << left << setw(24) << "Operation" << right << setw(10) << "Count" << "\n";
+        for (size_t op = 0; op < 256; ++op) {
+            if (counts[op] == 0) continue;
+            out << left << setw(24) << logOpName(static_cast<LogOp>(op)) << right << setw(10) << counts[op] << "\n";
+        }
+    }
+
+    // Records and billed revenue per user
+    void activityByUser(ostream& out) const {
+        vector<size_t> counts(userNames.size() + 1, 0);
+        vector<int64_t> revenue(userNames.size() + 1, 0);
+        const uint8_t bill = static_cast<uint8_t>(LogOp::Bill);
+        for (size_t i = 0; i < userIds.size(); ++i) {
+            size_t user = userIds[i] < userNames.size() ? userIds[i] : userNames.size();
+            counts[user]++;
+            revenue[user] += ops[i] == bill ? amounts[i] : 0;
+        }
+        out << left << setw(20) << "User" << right << setw(10) << "Records" << setw(14) << "Billed" << "\n";
+        for (size_t u = 0; u < counts.size(); ++u) {
+            if (counts[u] == 0) continue;
+            out << left << setw(20) << (u < userNames.size() ? userNames[u] : "(text log)")
+                << right << setw(10) << counts[u] << setw(14) << Utils::formatCents(revenue[u]) << "\n";
+        }
+    }
+
+    // Runs a query by name; false if the name is unknown
+    bool run(const string& query, ostream& out, const function<string(int)>& medicineName) const {
+        if (query == "revenue") revenueByMethod(out);
+        else if (query == "units") unitsByMedicine(out, medicineName);
+        else if (query == "operations") countsByOperation(out);
+        else if (query == "users") activityByUser(out);
+        else return false;
+        return true;
+    }
+};
+
+// Running sales rollups bucketed by local day. Each measure is kept as its
+// own column aligned with the ascending list of days, so a range query is a
+// binary search for the bounds followed by a straight sum over the slice.
+// Live bills are added as they are logged; rebuild() recomputes everything
+// from the transaction log with one partial rollup per log segment.
+class SalesAnalytics {
+public:
+    struct DayTotals {
+        int32_t day;
+        int64_t revenueCents;
+        int64_t units;
+        int32_t bills;
+    };
+
+    struct Ranked {
+        string name;
+        int64_t units;
+        int64_t revenueCents;
+        int32_t bills;
+    };
+
+private:
+    vector<int32_t> days;
+    vector<int64_t> revenue;
+    vector<int64_t> units;
+    vector<int32_t> bills;
+    // Per-key columns are padded with zeros up to days.size() on first touch
+    unordered_map<string, vector<int64_t>> medicineUnits;
+    unordered_map<string, vector<int64_t>> medicineRevenue;
+    unordered_map<string, vector<int32_t>> pharmacistBills;
+    unordered_map<string, vector<int64_t>> pharmacistRevenue;
+    unordered_map<string, string> displayNames;  // lower-case key to the name as first billed
+    mutable mutex mtx;
+
+    template <typename T>
+    static void insertAt(vector<T>& column, size_t pos) {
+        if (column.size() > pos) column.insert(column.begin() + static_cast<ptrdiff_t>(pos), T{});
+    }
+
+    template <typename T>
+    T& cell(vector<T>& column, size_t pos) {
+        if (column.size() < days.size()) column.resize(days.size(), T{});
+        return column[pos];
+    }
+
+    // Index of the bucket for day, inserting it in order if new
+    size_t bucketFor(int32_t day) {
+        if (days.empty() || day > days.back()) {
+            days.push_back(day);
+            revenue.push_back(0);
+            units.push_back(0);
+            bills.push_back(0);
+            return days.size() - 1;
+        }
+        auto it = lower_bound(days.begin(), days.end(), day);
+        size_t pos = static_cast<size_t>(it - days.begin());
+        if (*it == day) return pos;
+        days.insert(it, day);
+        insertAt(revenue, pos);
+        insertAt(units, pos);
+        insertAt(bills, pos);
+        for (auto& column : medicineUnits) insertAt(column.second, pos);
+        for (auto& column : medicineRevenue) insertAt(column.second, pos);
+        for (auto& column : pharmacistBills) insertAt(column.second, pos);
+        for (auto& column : pharmacistRevenue) insertAt(column.second, pos);
+        return pos;
+    }
+
+    void add(int32_t day, const string& medicine, const string& pharmacist,
+             int64_t quantity, int64_t amountCents, int32_t billCount) {
+        size_t pos = bucketFor(day);
+        revenue[pos] += amountCents;
+        units[pos] += quantity;
+        bills[pos] += billCount;
+        string key = Utils::toLower(medicine);
+        displayNames.emplace(key, medicine);
+        cell(medicineUnits[key], pos) += quantity;
+        cell(medicineRevenue[key], pos) += amountCents;
+        cell(pharmacistBills[pharmacist], pos) += billCount;
+        cell(pharmacistRevenue[pharmacist], pos) += amountCents;
+    }
+
+    // [first, last) bucket positions covering the day range
+    pair<size_t, size_t> slice(int32_t fromDay, int32_t toDay) const {
+        size_t first = static_cast<size_t>(lower_bound(days.begin(), days.end(), fromDay) - days.begin());
+        size_t last = static_cast<size_t>(upper_bound(days.begin(), days.end(), toDay) - days.begin());
+        return { first, max(first, last) };
+    }
+
+    template <typename T>
+    static T sum(const vector<T>& column, pair<size_t, size_t> range) {
+        T total = 0;
+        size_t end = min(range.second, column.size());
+        for (size_t i = range.first; i < end; ++i) total += column[i];
+        return total;
+    }
+
+    void mergeFrom(const SalesAnalytics& other) {
+        for (size_t i = 0; i < other.days.size(); ++i) {
+            size_t pos = bucketFor(other.days[i]);
+            revenue[pos] += other.revenue[i];
+            units[pos] += other.units[i];
+            bills[pos] += other.bills[i];
+        }
+        auto mergeColumns = [this, &other](auto& mine, const auto& theirs) {
+            for (const auto& column : theirs) {
+                auto& target = mine[column.first];
+                for (size_t i = 0; i < column.second.size(); ++i) {
+                    if (column.second[i] != 0) cell(target, bucketFor(other.days[i])) += column.second[i];
+                }
+            }
+        };
+        mergeColumns(medicineUnits, other.medicineUnits);
+        mergeColumns(medicineRevenue, other.medicineRevenue);
+        mergeColumns(pharmacistBills, other.pharmacistBills);
+        mergeColumns(pharmacistRevenue, other.pharmacistRevenue);
+        for (const auto& name : other.displayNames) displayNames.emplace(name.first, name.second);
+    }
+
+public:
+    // Medicine name from a "Billed <name> x<qty>, ..." action; empty for anything else
+    static string billedMedicine(string_view action) {
+        if (action.substr(0, 7) != "Billed ") return "";
+        size_t end = action.find(", Remaining");
+        string_view head = action.substr(7, end == string_view::npos ? string_view::npos : end - 7);
+        size_t qtyAt = head.rfind(" x");
+        return string(qtyAt == string_view::npos ? head : head.substr(0, qtyAt));
+    }
+
+    // Folds one log record in; anything but a bill is ignored
+    void record(const TransactionRecord& entry, string_view action, string_view user) {
+        if (entry.op != LogOp::Bill) return;
+        string medicine = billedMedicine(action);
+        if (medicine.empty()) return;
+        lock_guard<mutex> lock(mtx);
+        add(Utils::localDay(entry.timestamp), medicine, string(user), entry.quantity, entry.amountCents, 1);
+    }
+
+    // Recomputes all rollups from the log, scanning its segments in parallel
+    void rebuild(FileLogger& logger) {
+        vector<SalesAnalytics> partials = logger.scanParallel<SalesAnalytics>("", "",
+            [](SalesAnalytics& partial, const TransactionRecord& entry, string_view action, string_view user) {
+                if (entry.op != LogOp::Bill) return;
+                string medicine = billedMedicine(action);
+                if (!medicine.empty()) {
+                    partial.add(Utils::localDay(entry.timestamp), medicine, string(user),
+                                entry.quantity, entry.amountCents, 1);
+                }
+            });
+        SalesAnalytics merged;
+        for (const auto& partial : partials) merged.mergeFrom(partial);
+        lock_guard<mutex> lock(mtx);
+        days = move(merged.days);
+        revenue = move(merged.revenue);
+        units = move(merged.units);
+        bills = move(merged.bills);
+        medicineUnits = move(merged.medicineUnits);
+        medicineRevenue = move(merged.medicineRevenue);
+        pharmacistBills = move(merged.pharmacistBills);
+        pharmacistRevenue = move(merged.pharmacistRevenue);
+        displayNames = move(merged.displayNames);
+    }
+
+    // Days with at least one bill in the range
+    vector<DayTotals> dailyRevenue(int32_t fromDay, int32_t toDay) const {
+        lock_guard<mutex> lock(mtx);
+        auto range = slice(fromDay, toDay);
+        vector<DayTotals> result;
+        for (size_t i = range.first; i < range.second; ++i) {
+            if (bills[i] != 0) result.push_back({ days[i], revenue[i], units[i], bills[i] });
+        }
+        return result;
+    }
+
+    // Medicines by units sold in the range, best sellers first
+    vector<Ranked> topMedicines(int32_t fromDay, int32_t toDay, size_t limit) const {
+        lock_guard<mutex> lock(mtx);
+        auto range = slice(fromDay, toDay);
+        vector<Ranked> ranked;
+        for (const auto& column : medicineUnits) {
+            int64_t sold = sum(column.second, range);
+            if (sold == 0) continue;
+            ranked.push_back({ displayNames.at(column.first), sold, sum(medicineRevenue.at(column.first), range), 0 });
+        }
+        sort(ranked.begin(), ranked.end(), [](const Ranked& a, const Ranked& b) { return a.units > b.units; });
+        if (ranked.size() > limit) ranked.resize(limit);
+        return ranked;
+    }
+
+    // Bills and revenue handled per pharmacist in the range
+    vector<Ranked> pharmacistThroughput(int32_t fromDay, int32_t toDay) const {
+        lock_guard<mutex> lock(mtx);
+        auto range = slice(fromDay, toDay);
+        vector<Ranked> ranked;
+        for (const auto& column : pharmacistBills) {
+            int32_t handled = sum(column.second, range);
+            if (handled == 0) continue;
+            ranked.push_back({ column.first, 0, sum(pharmacistRevenue.at(column.first), range), handled });
+        }
+        sort(ranked.begin(), ranked.end(), [](const Ranked& a, const Ranked& b) { return a.bills > b.bills; });
+        return ranked;
+    }
+
+    // Units of one medicine sold in the range
+    int64_t unitsSold(const string& medicine, int32_t fromDay, int32_t toDay) const {
+        lock_guard<mutex> lock(mtx);
+        auto it = medicineUnits.find(Utils::toLower(medicine));
+        return it == medicineUnits.end() ? 0 : sum(it->second, slice(fromDay, toDay));
+    }
+
+    // First and last day with sales, or false if there are none yet
+    bool bounds(int32_t& firstDay, int32_t& lastDay) const {
+        lock_guard<mutex> lock(mtx);
+        if (days.empty()) return false;
+        firstDay = days.front();
+        lastDay = days.back();
+        return true;
+    }
+
+    // Calls visit(name, day, units) for every day a medicine sold, oldest day first per medicine
+    template <typename Visit>
+    void forEachMedicineDay(Visit visit) const {
+        lock_guard<mutex> lock(mtx);
+        for (const auto& column : medicineUnits) {
+            const string& name = displayNames.at(column.first);
+            for (size_t i = 0; i < column.second.size(); ++i) {
+                if (column.second[i] != 0) visit(name, days[i], column.second[i]);
+            }
+        }
+    }
+};
+
+// Local stand-in for the GCash/PayMaya gateways. Requests complete on a single
+// dispatcher thread after a configurable latency and fail at a configurable
+// rate, so any number of payments can be in flight without outside services.
+class SimulatedPaymentGateway {
+public:
+    struct Config {
+        int latencyMs = 300;
+        int jitterMs = 100;
+        double failureRate = 0.0;
+
+        // Reads key=value lines (latency_ms, jitter_ms, failure_rate); missing keys keep defaults
+        static Config load(const string& path) {
+            Config config;
+            ifstream file(path);
+            string line;
+            while (getline(file, line)) {
+                size_t eq = line.find('=');
+                if (eq == string::npos) continue;
+                string key = Utils::trim(line.substr(0, eq));
+                string value = Utils::trim(line.substr(eq + 1));
+                try {
+                    if (key == "latency_ms") config.latencyMs = max(0, stoi(value));
+                    else if (key == "jitter_ms") config.jitterMs = max(0, stoi(value));
+                    else if (key == "failure_rate") config.failureRate = min(1.0, max(0.0, stod(value)));
+                } catch (...) {
+                    cerr << "Ignoring invalid gateway setting: " << line << "\n";
+                }
+            }
+            return config;
+        }
+    };
+
+private:
+    struct Pending {
+        chrono::steady_clock::time_point due;
+        PaymentRequest request;
+        promise<PaymentResult> result;
+        bool declined;
+    };
+
+    Config config;
+    mutex mtx;
+    condition_variable wake;
+    vector<unique_ptr<Pending>> queue;  // Min-heap on due time
+    mt19937_64 rng;
+    uint64_t nextReference = 1;
+    bool stopping = false;
+    thread dispatcher;
+
+    static bool dueLater(const unique_ptr<Pending>& a, const unique_ptr<Pending>& b) {
+        return a->due > b->due;
+    }
+
+    static PaymentResult makeResult(const PaymentRequest& request, bool declined, uint64_t reference) {
+        PaymentResult result;
+        result.approved = !declined;
+        result.reference = request.method + "-" + to_string(reference);
+        result.message = declined ? "Payment declined by " + request.method + " gateway."
+                                  : "Payment confirmed via " + request.method + ".";
+        return result;
+    }
+
+    void dispatchLoop() {
+        unique_lock<mutex> lock(mtx);
+        while (true) {
+            if (queue.empty()) {
+                if (stopping) return;
+                wake.wait(lock);
+                continue;
+            }
+            auto due = queue.front()->due;
+            if (!stopping && chrono::steady_clock::now() < due) {
+                wake.wait_until(lock, due);
+                continue;
+            }
+            pop_heap(queue.begin(), queue.end(), dueLater);
+            unique_ptr<Pending> pending = move(queue.back());
+            queue.pop_back();
+            uint64_t reference = nextReference++;
+            bool shuttingDown = stopping;  // Read under the lock; the destructor may set it meanwhile
+            lock.unlock();
+            if (shuttingDown) {
+                pending->result.set_value(PaymentResult{ false, "", "Payment gateway shut down." });
+            } else {
+                pending->result.set_value(makeResult(pending->request, pending->declined, reference));
+            }
+            lock.lock();
+        }
+    }
+
+public:
+    explicit SimulatedPaymentGateway(Config c)
+        : config(c), rng(random_device{}()), dispatcher(&SimulatedPaymentGateway::dispatchLoop, this) {}
+
+    ~SimulatedPaymentGateway() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        wake.notify_all();
+        dispatcher.join();
+    }
+
+    SimulatedPaymentGateway(const SimulatedPaymentGateway&) = delete;
+    SimulatedPaymentGateway& operator=(const SimulatedPaymentGateway&) = delete;
+
+    const Config& getConfig() const { return config; }
+
+    future<PaymentResult> submit(PaymentRequest request) {
+        auto pending = make_unique<Pending>();
+        future<PaymentResult> result = pending->result.get_future();
+        {
+            lock_guard<mutex> lock(mtx);
+            int jitter = config.jitterMs > 0
+                ? uniform_int_distribution<int>(-config.jitterMs, config.jitterMs)(rng) : 0;
+            pending->due = chrono::steady_clock::now() + chrono::milliseconds(max(0, config.latencyMs + jitter));
+            pending->declined = bernoulli_distribution(config.failureRate)(rng);
+            pending->request = move(request);
+            queue.push_back(move(pending));
+            push_heap(queue.begin(), queue.end(), dueLater);
+        }
+        wake.notify_one();
+        return result;
+    }
+};
+
+// Tracks in-flight payments. Results are produced on the gateway thread but
+// completion callbacks always run on the thread that drains the pipeline,
+// so inventory is only ever committed by its owner.
+class PaymentPipeline {
+public:
+    using Callback = function<void(const PaymentRequest&, const PaymentResult&)>;
+
+private:
+    struct InFlight {
+        uint64_t id;
+        PaymentRequest request;
+        future<PaymentResult> result;
+        Callback onComplete;
+    };
+
+    SimulatedPaymentGateway gateway;
+    vector<InFlight> inFlight;
+    uint64_t nextId = 1;
+
+    void complete(size_t index) {
+        InFlight done = move(inFlight[index]);
+        inFlight[index] = move(inFlight.back());
+        inFlight.pop_back();
+        PaymentResult result = done.result.get();
+        if (done.onComplete) done.onComplete(done.request, result);
+    }
+
+public:
+    explicit PaymentPipeline(SimulatedPaymentGateway::Config config) : gateway(config) {}
+
+    const SimulatedPaymentGateway::Config& getGatewayConfig() const { return gateway.getConfig(); }
+
+    size_t pending() const { return inFlight.size(); }
+
+    uint64_t submit(PaymentRequest request, Callback onComplete) {
+        uint64_t id = nextId++;
+        future<PaymentResult> result;
+        if (request.settledLocally) {
+            promise<PaymentResult> settled;
+            settled.set_value(PaymentResult{ true, request.method + "-LOCAL-" + to_string(id),
+                                             "Payment received successfully." });
+            result = settled.get_future();
+        } else {
+            result = gateway.submit(request);
+        }
+        inFlight.push_back(InFlight{ id, move(request), move(result), move(onComplete) });
+        return id;
+    }
+
+    // Runs callbacks for every payment whose result has arrived; returns how many completed
+    size_t drainCompleted() {
+        size_t completed = 0;
+        for (size_t i = 0; i < inFlight.size();) {
+            if (inFlight[i].result.wait_for(chrono::seconds(0)) == future_status::ready) {
+                complete(i);
+                completed++;
+            } else {
+                i++;
+            }
+        }
+        return completed;
+    }
+
+    void waitFor(uint64_t id) {
+        for (size_t i = 0; i < inFlight.size(); i++) {
+            if (inFlight[i].id == id) {
+                inFlight[i].result.wait();
+                complete(i);
+                return;
+            }
+        }
+    }
+
+    void waitAll() {
+        while (!inFlight.empty()) {
+            inFlight.back().result.wait();
+            complete(inFlight.size() - 1);
+        }
+    }
+};
+
+// Time-limited holds on stock while a payment is in flight. Holds expire
+// through a hashed timer wheel, so advancing the clock only touches the slots
+// that came due instead of scanning every outstanding hold. Calls are
+// serialised by a short internal lock so report threads can ask what is held.
+class StockReservations {
+public:
+    using Clock = chrono::steady_clock;
+
+private:
+    struct Hold {
+        string productKey;
+        int quantity;
+        uint64_t expiryTick;
+    };
+
+    static constexpr size_t WHEEL_SLOTS = 256;
+
+    chrono::milliseconds tickLength;
+    Clock::time_point origin;
+    uint64_t currentTick = 0;
+    vector<vector<uint64_t>> wheel;  // Slot -> hold IDs; released IDs are skipped lazily
+    unordered_map<uint64_t, Hold> holds;
+    unordered_map<string, int> heldByProduct;
+    uint64_t nextId = 1;
+    mutable mutex mtx;
+
+    uint64_t tickAt(Clock::time_point t) const {
+        return static_cast<uint64_t>((t - origin) / tickLength);
+    }
+
+    void drop(unordered_map<uint64_t, Hold>::iterator it) {
+        auto heldIt = heldByProduct.find(it->second.productKey);
+        heldIt->second -= it->second.quantity;
+        if (heldIt->second <= 0) heldByProduct.erase(heldIt);
+        holds.erase(it);
+    }
+
+    void expireSlot(size_t slot, uint64_t tick) {
+        auto& ids = wheel[slot];
+        for (size_t i = 0; i < ids.size();) {
+            auto it = holds.find(ids[i]);
+            if (it == holds.end() || it->second.expiryTick <= tick) {
+                if (it != holds.end()) drop(it);
+                ids[i] = ids.back();
+                ids.pop_back();
+            } else {
+                i++;  // Due on a later turn of the wheel
+            }
+        }
+    }
+
+    // Expires every hold whose deadline has passed; caller holds mtx
+    void expireDue() {
+        uint64_t nowTick = tickAt(Clock::now());
+        if (nowTick <= currentTick) return;
+        uint64_t steps = min<uint64_t>(nowTick - currentTick, WHEEL_SLOTS);
+        for (uint64_t i = 1; i <= steps; i++) {
+            uint64_t tick = nowTick - steps + i;
+            expireSlot(static_cast<size_t>(tick % WHEEL_SLOTS), nowTick);
+        }
+        currentTick = nowTick;
+    }
+
+public:
+    explicit StockReservations(chrono::milliseconds tick = chrono::milliseconds(100))
+        : tickLength(tick), origin(Clock::now()), wheel(WHEEL_SLOTS) {}
+
+    // Expires every hold whose deadline has passed
+    void advance() {
+        lock_guard<mutex> lock(mtx);
+        expireDue();
+    }
+
+    // Holds are per product (lower-cased name) because dispensing may span several lots
+    uint64_t reserve(const string& productKey, int quantity, chrono::milliseconds timeout) {
+        lock_guard<mutex> lock(mtx);
+        expireDue();
+        uint64_t expiryTick = tickAt(Clock::now() + timeout) + 1;
+        uint64_t id = nextId++;
+        holds.emplace(id, Hold{ productKey, quantity, expiryTick });
+        heldByProduct[productKey] += quantity;
+        wheel[static_cast<size_t>(expiryTick % WHEEL_SLOTS)].push_back(id);
+        return id;
+    }
+
+    // Consumes a hold; returns false if it already timed out
+    bool commit(uint64_t id) {
+        lock_guard<mutex> lock(mtx);
+        expireDue();
+        auto it = holds.find(id);
+        if (it == holds.end()) return false;
+        drop(it);
+        return true;
+    }
+
+    void release(uint64_t id) {
+        lock_guard<mutex> lock(mtx);
+        auto it = holds.find(id);
+        if (it != holds.end()) drop(it);
+    }
+
+    int held(const string& productKey) {
+        lock_guard<mutex> lock(mtx);
+        expireDue();
+        auto it = heldByProduct.find(productKey);
+        return it == heldByProduct.end() ? 0 : it->second;
+    }
+
+    size_t activeHolds() const {
+        lock_guard<mutex> lock(mtx);
+        return holds.size();
+    }
+};
+
+// Medicine interface
+class IMedicine {
+public:
+    virtual ~IMedicine() = default;
+    virtual int getId() const = 0;
+    virtual const string& getName() const = 0;
+    virtual int getQuantity() const = 0;
+    virtual const string& getExpiryDate() const = 0;
+    virtual int64_t getPriceCents() const = 0;
+    virtual void setQuantity(int q) = 0;
+    virtual void setExpiryDate(string e) = 0;
+    virtual void setPriceCents(int64_t cents) = 0;
+    virtual void display() const = 0;
+    virtual string toFileString() const = 0;
+};
+
+// Concrete Medicine implementation
+class Medicine : public IMedicine {
+private:
+    int id;
+    string name;
+    int quantity;
+    string expiryDate;
+    int64_t priceCents;  // Money is kept in whole cents so totals never drift
+    static atomic<int> nextId;  // Shared by every store hosted in the process
+
+public:
+     // Modified constructor to handle both new and loaded medicines
+    Medicine(string n, int q, string e, int64_t cents, int existingId = -1)
+        : name(Utils::trim(move(n))), quantity(q), expiryDate(move(e)), priceCents(cents) {
+        if (existingId == -1) {
+            // New medicine - assign next ID
+            id = nextId++;
+        } else {
+            // Loaded from file - use existing ID
+            id = existingId;
+            // Update nextId to avoid future conflicts
+            int next = nextId.load();
+            while (id >= next && !nextId.compare_exchange_weak(next, id + 1)) {}
+        }
+        // Validation remains same
+        if (quantity < 0) throw invalid_argument("Quantity cannot be negative");
+        if (priceCents < 0) throw invalid_argument("Price cannot be negative");
+        if (!Utils::isValidDate(expiryDate)) 
+            throw invalid_argument("Invalid expiry date");
+    }
+
+    ~Medicine() override = default;
+
+    int getId() const override { return id; }
+    const string& getName() const override { return name; }
+    int getQuantity() const override { return quantity; }
+    const string& getExpiryDate() const override { return expiryDate; }
+    int64_t getPriceCents() const override { return priceCents; }
+
+    void setQuantity(int q) override { 
+        if (q < 0) throw invalid_argument("Quantity cannot be negative");
+        quantity = q; 
+    }
+    
+    void setExpiryDate(string e) override { 
+        if (!Utils::isValidDate(e)) throw invalid_argument("Invalid expiry date");
+        expiryDate = move(e); 
+    }
+    
+    void setPriceCents(int64_t cents) override { 
+        if (cents < 0) throw invalid_argument("Price cannot be negative");
+        priceCents = cents; 
+    }
+
+    void display() const override {
+        cout << "Name: " << name << "\n"
+             << "Quantity: " << quantity << "\n"
+             << "Expiry Date: " << expiryDate << "\n"
+             << "Price: " << Utils::formatCents(priceCents) << "\n";
+    }
+
+    string toFileString() const override {
+        string quantityStr = to_string(quantity);
+        string priceStr = Utils::centsToDecimal(priceCents);
+        string idStr = to_string(id);
+        string line;
+        line.reserve(name.size() + quantityStr.size() + expiryDate.size() + priceStr.size() + idStr.size() + 4);
+        line.append(name).append(1, ',').append(quantityStr).append(1, ',')
+            .append(expiryDate).append(1, ',').append(priceStr).append(1, ',').append(idStr);
+        return line;
+    }
+
+    // Builds the medicine directly on the heap so loading does not copy it
+    static unique_ptr<Medicine> fromFileString(string_view line) {
+        string_view name = Utils::nextField(line);
+        string_view quantityStr = Utils::nextField(line);
+        string_view expiryDate = Utils::nextField(line);
+        string_view priceStr = Utils::nextField(line);
+        // Lot IDs are persisted so they stay stable across restarts; older files lack the column
+        string_view idStr = Utils::nextField(line);
+
+        // A bad row throws invalid_argument naming the field; callers decide what becomes of it
+        int64_t priceCents = 0;
+        if (!Utils::parseCents(priceStr, priceCents)) throw invalid_argument("invalid price");
+        int quantity = 0;
+        int id = -1;
+        try {
+            quantity = stoi(string(quantityStr));
+            if (!idStr.empty()) id = stoi(string(idStr));
+        } catch (const exception&) {
+            throw invalid_argument("invalid quantity or lot ID");
+        }
+        return make_unique<Medicine>(string(name), quantity, string(expiryDate), priceCents, id);
+    }
+};
+
+atomic<int> Medicine::nextId{ 1 };
+
+// Groups medicine rows into products by name; each row is one lot of its
+// product. A product keeps its sellable lots in a min-heap on expiry for
+// first-expiry-first-out dispensing, and its unit total is maintained
+// incrementally so stock checks never walk the lots. Lots whose expiry date
+// has passed are moved off the top of the heap into an expired list the next
+// time the product is looked at; they no longer count as stock and are never
+// dispensed. All quantity and expiry changes must go through the index to
+// keep it consistent.
+class LotIndex {
+public:
+    struct DispenseStep {
+        IMedicine* lot;
+        int quantity;
+    };
+
+private:
+    struct Product {
+        vector<IMedicine*> lots;     // Every lot, including empty and expired ones
+        vector<IMedicine*> heap;     // Unexpired lots with stock, min-heap on expiry
+        vector<IMedicine*> expired;  // Lots with stock past their expiry date
+        int totalQuantity = 0;       // Units in the heap's lots, i.e. what can be sold
+    };
+
+    unordered_map<string, Product> products;  // Keyed by lower-cased name
+    string cachedToday;
+    time_t todayEndsAt = 0;  // Local midnight after which cachedToday is stale
+
+    static bool expiresLater(const IMedicine* a, const IMedicine* b) {
+        if (a->getExpiryDate() != b->getExpiryDate()) return a->getExpiryDate() > b->getExpiryDate();
+        return a->getId() > b->getId();
+    }
+
+    // A lot is usable up to and including its expiry date. The date is formatted
+    // once a day; a lookup only reads the clock to see whether midnight has passed.
+    const string& today() {
+        time_t now = time(nullptr);
+        if (now >= todayEndsAt) {
+            tm local = Utils::toLocalTime(now);
+            char buffer[16];
+            strftime(buffer, sizeof(buffer), "%Y-%m-%d", &local);
+            cachedToday = buffer;
+            local.tm_hour = 0;
+            local.tm_min = 0;
+            local.tm_sec = 0;
+            local.tm_mday += 1;
+            local.tm_isdst = -1;
+            todayEndsAt = mktime(&local);
+        }
+        return cachedToday;
+    }
+
+    Product* findProduct(string_view name) {
+        auto it = products.find(Utils::toLower(name));
+        return it == products.end() ? nullptr : &it->second;
+    }
+
+    const Product* findProduct(string_view name) const {
+        auto it = products.find(Utils::toLower(name));
+        return it == products.end() ? nullptr : &it->second;
+    }
+
+    // Looks a product up with its newly expired lots already retired
+    Product* currentProduct(string_view name) {
+        Product* product = findProduct(name);
+        if (product) retireExpired(*product, today());
+        return product;
+    }
+
+    static void retireExpired(Product& product, const string& date) {
+        while (!product.heap.empty() && product.heap.front()->getExpiryDate() < date) {
+            IMedicine* lot = product.heap.front();
+            pop_heap(product.heap.begin(), product.heap.end(), expiresLater);
+            product.heap.pop_back();
+            product.totalQuantity -= lot->getQuantity();
+            product.expired.push_back(lot);
+        }
+    }
+
+    // Files a lot with stock under the heap or the expired list
+    void placeStocked(Product& product, IMedicine* lot) {
+        if (lot->getQuantity() <= 0) return;
+        if (lot->getExpiryDate() < today()) {
+            product.expired.push_back(lot);
+            return;
+        }
+        product.heap.push_back(lot);
+        push_heap(product.heap.begin(), product.heap.end(), expiresLater);
+        product.totalQuantity += lot->getQuantity();
+    }
+
+    static void removeStocked(Product& product, const IMedicine* lot) {
+        auto expired = find(product.expired.begin(), product.expired.end(), lot);
+        if (expired != product.expired.end()) {
+            product.expired.erase(expired);
+            return;
+        }
+        auto it = find(product.heap.begin(), product.heap.end(), lot);
+        if (it == product.heap.end()) return;
+        product.heap.erase(it);
+        make_heap(product.heap.begin(), product.heap.end(), expiresLater);
+        product.totalQuantity -= lot->getQuantity();
+    }
+
+public:
+    void rebuild(const vector<unique_ptr<IMedicine>>& medicines) {
+        products.clear();
+        for (const auto& med : medicines) addLot(med.get());
+    }
+
+    void addLot(IMedicine* lot) {
+        Product& product = products[Utils::toLower(lot->getName())];
+        product.lots.push_back(lot);
+        placeStocked(product, lot);
+    }
+
+    void removeLot(IMedicine* lot) {
+        auto it = products.find(Utils::toLower(lot->getName()));
+        if (it == products.end()) return;
+        Product& product = it->second;
+        product.lots.erase(remove(product.lots.begin(), product.lots.end(), lot), product.lots.end());
+        removeStocked(product, lot);
+        if (product.lots.empty()) products.erase(it);
+    }
+
+    void setQuantity(IMedicine& lot, int quantity) {
+        Product* product = findProduct(lot.getName());
+        if (!product) {
+            lot.setQuantity(quantity);
+            return;
+        }
+        bool inHeap = lot.getQuantity() > 0 &&
+                      find(product->expired.begin(), product->expired.end(), &lot) == product->expired.end();
+        if (inHeap && quantity > 0) {
+            // Still stocked, so its place in the heap is unchanged
+            product->totalQuantity += quantity - lot.getQuantity();
+            lot.setQuantity(quantity);
+            return;
+        }
+        removeStocked(*product, &lot);
+        lot.setQuantity(quantity);
+        placeStocked(*product, &lot);
+    }
+
+    void setExpiryDate(IMedicine& lot, string expiryDate) {
+        Product* product = findProduct(lot.getName());
+        if (product) removeStocked(*product, &lot);
+        lot.setExpiryDate(move(expiryDate));
+        if (product) placeStocked(*product, &lot);
+    }
+
+    bool contains(string_view name) const { return findProduct(name) != nullptr; }
+
+    // Units that can be sold; expired lots are left out
+    int totalQuantity(string_view name) {
+        const Product* product = currentProduct(name);
+        return product ? product->totalQuantity : 0;
+    }
+
+    // Lots of the product still holding stock past their expiry date, for reporting
+    vector<const IMedicine*> expiredLots(string_view name) {
+        const Product* product = currentProduct(name);
+        if (!product) return {};
+        return vector<const IMedicine*>(product->expired.begin(), product->expired.end());
+    }
+
+    // The lot an incoming delivery merges into: same name, expiry and price
+    IMedicine* findLot(string_view name, const string& expiryDate, int64_t priceCents) {
+        Product* product = findProduct(name);
+        if (!product) return nullptr;
+        for (IMedicine* lot : product->lots) {
+            if (lot->getExpiryDate() == expiryDate && lot->getPriceCents() == priceCents) return lot;
+        }
+        return nullptr;
+    }
+
+    // FEFO breakdown of a dispense over unexpired lots without changing stock; empty if there is not enough
+    vector<DispenseStep> planDispense(string_view name, int quantity) {
+        vector<DispenseStep> steps;
+        const Product* product = currentProduct(name);
+        if (!product || product->totalQuantity < quantity) return steps;
+        vector<IMedicine*> heap = product->heap;
+        while (quantity > 0 && !heap.empty()) {
+            IMedicine* lot = heap.front();
+            int taken = min(quantity, lot->getQuantity());
+            steps.push_back(DispenseStep{ lot, taken });
+            quantity -= taken;
+            pop_heap(heap.begin(), heap.end(), expiresLater);
+            heap.pop_back();
+        }
+        return steps;
+    }
+
+    // Takes units from the earliest-expiring unexpired lots first; each emptied lot costs one heap pop
+    vector<DispenseStep> dispense(string_view name, int quantity) {
+        vector<DispenseStep> steps;
+        Product* product = currentProduct(name);
+        if (!product || product->totalQuantity < quantity) return steps;
+        while (quantity > 0 && !product->heap.empty()) {
+            IMedicine* lot = product->heap.front();
+            int taken = min(quantity, lot->getQuantity());
+            lot->setQuantity(lot->getQuantity() - taken);
+            product->totalQuantity -= taken;
+            quantity -= taken;
+            steps.push_back(DispenseStep{ lot, taken });
+            if (lot->getQuantity() == 0) {
+                pop_heap(product->heap.begin(), product->heap.end(), expiresLater);
+                product->heap.pop_back();
+            }
+        }
+        return steps;
+    }
+};
+
+// Immutable point-in-time copy of the catalogue. Reports and listings read a
+// snapshot instead of the live medicines, so they never see a half-applied
+// update and never hold up billing while they run.
+struct InventorySnapshot {
+    struct Lot {
+        int id;
+        string name;
+        int quantity;
+        string expiryDate;
+        int64_t priceCents;
+    };
+
+    uint64_t version = 0;
+    string takenAt;
+    vector<Lot> lots;                                   // Catalogue order
+    unordered_map<string, vector<size_t>> products;     // Lower-cased name to positions in lots, earliest expiry first
+
+    // The same lots as flat columns for the valuation kernels
+    vector<int64_t> quantityColumn;
+    vector<int64_t> priceColumn;
+    vector<int64_t> valueColumn;      // quantity * price, in cents
+    vector<int64_t> expiryDayColumn;  // Utils::dayFromDate of the expiry
+
+    int totalQuantity(string_view name) const {
+        auto it = products.find(Utils::toLower(name));
+        if (it == products.end()) return 0;
+        int total = 0;
+        for (size_t index : it->second) total += lots[index].quantity;
+        return total;
+    }
+
+    // Units in lots still usable on the given day (Utils::localDay), as billing counts them
+    int sellableQuantity(string_view name, int32_t today) const {
+        auto it = products.find(Utils::toLower(name));
+        if (it == products.end()) return 0;
+        int total = 0;
+        for (size_t index : it->second) {
+            if (expiryDayColumn[index] >= today) total += lots[index].quantity;
+        }
+        return total;
+    }
+};
+
+// Catalogue valuation over a snapshot's flat columns. Every kernel is one
+// branch-free pass over contiguous 64-bit integers with conditions turned
+// into bit masks. With GCC the main loop runs on four-lane vector types;
+// other compilers, and the last few elements, take the scalar loop.
+struct InventoryValuation {
+    static constexpr size_t BANDS = 5;
+    static constexpr int64_t BAND_LIMITS[BANDS - 1] = { 100, 1000, 10000, 100000 };  // Upper bounds in cents
+
+    int64_t totalCents = 0;
+    int64_t totalUnits = 0;
+    int64_t expiredCents = 0;
+    int64_t atRiskCents = 0;  // Expiring within the risk window, not yet expired
+    int64_t bandCents[BANDS] = {};
+    int64_t bandUnits[BANDS] = {};
+
+#if defined(__GNUC__)
+    typedef int64_t Lanes __attribute__((vector_size(32)));
+#endif
+
+    static int64_t sum(const int64_t* values, size_t n) {
+        int64_t total = 0;
+        size_t i = 0;
+#if defined(__GNUC__)
+        Lanes acc = { 0, 0, 0, 0 };
+        for (; i + 4 <= n; i += 4) {
+            Lanes value;
+            memcpy(&value, values + i, sizeof(value));
+            acc += value;
+        }
+        total = acc[0] + acc[1] + acc[2] + acc[3];
+#endif
+        for (; i < n; ++i) total += values[i];
+        return total;
+    }
+
+    // Sum of values whose key lies in [low, high)
+    static int64_t sumWhereIn(const int64_t* values, const int64_t* keys, size_t n, int64_t low, int64_t high) {
+        int64_t total = 0;
+        size_t i = 0;
+#if defined(__GNUC__)
+        Lanes acc = { 0, 0, 0, 0 };
+        const Lanes lows = { low, low, low, low };
+        const Lanes highs = { high, high, high, high };
+        for (; i + 4 <= n; i += 4) {
+            Lanes value, key;
+            memcpy(&value, values + i, sizeof(value));
+            memcpy(&key, keys + i, sizeof(key));
+            acc += value & ((key >= lows) & (key < highs));
+        }
+        total = acc[0] + acc[1] + acc[2] + acc[3];
+#endif
+        for (; i < n; ++i) total += values[i] & -static_cast<int64_t>((keys[i] >= low) & (keys[i] < high));
+        return total;
+    }
+
+    static InventoryValuation compute(const InventorySnapshot& view, int32_t today, int32_t riskDays) {
+        InventoryValuation result;
+        size_t n = view.lots.size();
+        const int64_t* value = view.valueColumn.data();
+        const int64_t* quantity = view.quantityColumn.data();
+        const int64_t* price = view.priceColumn.data();
+        const int64_t* expiry = view.expiryDayColumn.data();
+        result.totalCents = sum(value, n);
+        result.totalUnits = sum(quantity, n);
+        result.expiredCents = sumWhereIn(value, expiry, n, INT64_MIN, today);
+        result.atRiskCents = sumWhereIn(value, expiry, n, today, static_cast<int64_t>(today) + riskDays + 1);
+        for (size_t band = 0; band < BANDS; ++band) {
+            int64_t low = band == 0 ? INT64_MIN : BAND_LIMITS[band - 1];
+            int64_t high = band == BANDS - 1 ? INT64_MAX : BAND_LIMITS[band];
+            result.bandCents[band] = sumWhereIn(value, price, n, low, high);
+            result.bandUnits[band] = sumWhereIn(quantity, price, n, low, high);
+        }
+        return result;
+    }
+
+    static string bandLabel(size_t band) {
+        if (band == 0) return "under " + Utils::formatCents(BAND_LIMITS[0]);
+        if (band == BANDS - 1) return Utils::formatCents(BAND_LIMITS[BANDS - 2]) + " and up";
+        return Utils::formatCents(BAND_LIMITS[band - 1]) + " - " + Utils::formatCents(BAND_LIMITS[band] - 1);
+    }
+};
+
+// Thin wrappers over Unix domain sockets for replication. On platforms
+// without them every call reports failure, which leaves replication off.
+namespace LocalSocket {
+#ifndef _WIN32
+    bool toAddress(const string& path, sockaddr_un& address) {
+        if (path.size() >= sizeof(address.sun_path)) return false;
+        address = sockaddr_un{};
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+#endif
+
+    int connectTo(const string& path) {
+#ifndef _WIN32
+        sockaddr_un address;
+        if (!toAddress(path, address)) return -1;
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+#else
+        (void)path;
+        return -1;
+#endif
+    }
+
+    // A socket file left by a process that has died is replaced; one that a
+    // live process still answers on is left alone and -1 returned
+    int listenAt(const string& path) {
+#ifndef _WIN32
+        sockaddr_un address;
+        if (!toAddress(path, address)) return -1;
+        int probe = connectTo(path);
+        if (probe >= 0) {
+            close(probe);
+            return -1;
+        }
+        unlink(path.c_str());
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, 8) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+#else
+        (void)path;
+        return -1;
+#endif
+    }
+
+    int acceptFrom(int listenFd) {
+#ifndef _WIN32
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd >= 0) fcntl(fd, F_SETFD, FD_CLOEXEC);
+        return fd;
+#else
+        (void)listenFd;
+        return -1;
+#endif
+    }
+
+    bool sendAll(int fd, string_view data) {
+#ifndef _WIN32
+        int flags = 0;
+#ifdef MSG_NOSIGNAL
+        flags = MSG_NOSIGNAL;  // A replica that went away is an error here, not a SIGPIPE
+#endif
+        while (!data.empty()) {
+            ssize_t sent = send(fd, data.data(), data.size(), flags);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            data.remove_prefix(static_cast<size_t>(sent));
+        }
+        return true;
+#else
+        (void)fd;
+        (void)data;
+        return false;
+#endif
+    }
+
+    // Waits up to timeoutMs for fd to become readable, returning early if wakeFd
+    // is written. Returns true when fd is readable.
+    bool waitReadable(int fd, int wakeFd, int timeoutMs) {
+#ifndef _WIN32
+        pollfd waiters[2] = { { fd, POLLIN, 0 }, { wakeFd, POLLIN, 0 } };
+        int count = fd < 0 ? 0 : 1;
+        pollfd* first = fd < 0 ? &waiters[1] : waiters;
+        if (wakeFd >= 0) count++;
+        if (count == 0) return false;
+        if (::poll(first, static_cast<nfds_t>(count), timeoutMs) <= 0) return false;
+        return fd >= 0 && (waiters[0].revents & (POLLIN | POLLHUP | POLLERR));
+#else
+        (void)fd;
+        (void)wakeFd;
+        this_thread::sleep_for(chrono::milliseconds(timeoutMs));
+        return false;
+#endif
+    }
+
+    // Reads whatever is available without blocking: bytes read, 0 if there is
+    // nothing yet, -1 once the peer has gone
+    long receive(int fd, char* buffer, size_t size) {
+#ifndef _WIN32
+        ssize_t got = recv(fd, buffer, size, MSG_DONTWAIT);
+        if (got > 0) return static_cast<long>(got);
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+        return -1;
+#else
+        (void)fd;
+        (void)buffer;
+        (void)size;
+        return -1;
+#endif
+    }
+
+    // Unblocks any send or receive in progress on fd
+    void shutdownSocket(int fd) {
+#ifndef _WIN32
+        if (fd >= 0) shutdown(fd, SHUT_RDWR);
+#else
+        (void)fd;
+#endif
+    }
+
+    void closeFd(int fd) {
+#ifndef _WIN32
+        if (fd >= 0) close(fd);
+#else
+        (void)fd;
+#endif
+    }
+
+    // A pipe whose write end wakes a thread blocked in waitReadable
+    bool openWakePipe(int fds[2]) {
+#ifndef _WIN32
+        if (pipe(fds) != 0) {
+            fds[0] = fds[1] = -1;
+            return false;
+        }
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        return true;
+#else
+        fds[0] = fds[1] = -1;
+        return false;
+#endif
+    }
+
+    void wake(int fd) {
+#ifndef _WIN32
+        if (fd >= 0 && write(fd, "x", 1) < 0) {}
+#else
+        (void)fd;
+#endif
+    }
+}
+
+
+// Raises a flag when a file is changed on disk by someone else's program.
+// On Linux an inotify watch on the parent directory sees in-place writes as
+// well as tools that replace the file by renaming a new one over it; where
+// inotify is unavailable the file's size and modification time are polled.
+// The flag is only a hint: callers diff the file themselves when it is set.
+class FileWatcher {
+public:
+    explicit FileWatcher(string watchedPath) : path(move(watchedPath)) {
+#ifdef __linux__
+        if (pipe2(wakePipe, O_CLOEXEC) != 0) wakePipe[0] = wakePipe[1] = -1;
+#endif
+        worker = thread([this] {
+#ifdef __linux__
+            if (watchWithInotify()) return;
+#endif
+            watchByPolling();
+        });
+    }
+
+    // Wakes the watcher thread rather than waiting out its poll interval
+    ~FileWatcher() {
+        {
+            lock_guard<mutex> lock(stopMutex);
+            stopping = true;
+        }
+        stopSignal.notify_all();
+#ifdef __linux__
+        if (wakePipe[1] >= 0 && write(wakePipe[1], "x", 1) < 0) {}
+#endif
+        if (worker.joinable()) worker.join();
+#ifdef __linux__
+        for (int fd : wakePipe) {
+            if (fd >= 0) close(fd);
+        }
+#endif
+    }
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // True once per burst of changes since the last call
+    bool consumeChange() { return changed.exchange(false); }
+
+private:
+    static constexpr chrono::milliseconds POLL_INTERVAL{ 500 };
+
+    string path;
+    atomic<bool> changed{ false };
+    atomic<bool> stopping{ false };
+    mutex stopMutex;
+    condition_variable stopSignal;
+    thread worker;
+
+#ifdef __linux__
+    int wakePipe[2] = { -1, -1 };  // Written once by the destructor to end the inotify wait
+
+    // Returns false if the watch could not be set up, leaving polling to take over
+    bool watchWithInotify() {
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0) return false;
+        filesystem::path file(path);
+        string directory = file.has_parent_path() ? file.parent_path().string() : ".";
+        string name = file.filename().string();
+        if (inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE) < 0) {
+            close(fd);
+            return false;
+        }
+
+        alignas(inotify_event) char buffer[4096];
+        pollfd waiters[2] = { { fd, POLLIN, 0 }, { wakePipe[0], POLLIN, 0 } };
+        int timeout = wakePipe[0] >= 0 ? -1 : static_cast<int>(POLL_INTERVAL.count());
+        while (!stopping) {
+            if (::poll(waiters, wakePipe[0] >= 0 ? 2 : 1, timeout) <= 0) continue;
+            ssize_t length;
+            while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+                for (char* at = buffer; at < buffer + length;) {
+                    auto* event = reinterpret_cast<inotify_event*>(at);
+                    if (event->len > 0 && name == event->name) changed = true;
+                    at += sizeof(inotify_event) + event->len;
+                }
+            }
+        }
+        close(fd);
+        return true;
+    }
+#endif
+
+    void watchByPolling() {
+        auto stamp = [this] {
+            error_code ec;
+            auto modified = filesystem::last_write_time(path, ec);
+            uintmax_t size = ec ? 0 : filesystem::file_size(path, ec);
+            return make_pair(ec ? filesystem::file_time_type{} : modified, ec ? 0 : size);
+        };
+        auto last = stamp();
+        unique_lock<mutex> lock(stopMutex);
+        while (!stopSignal.wait_for(lock, POLL_INTERVAL, [this] { return stopping.load(); })) {
+            auto now = stamp();
+            if (now != last) {
+                last = now;
+                changed = true;
+            }
+        }
+    }
+};
+
+// Publishes inventory snapshots copy-on-write: a writer builds the next
+// version off to the side and swaps the pointer in; readers take the current
+// pointer and keep that version alive for as long as they hold it.
+class InventoryVersions {
+    shared_ptr<const InventorySnapshot> current = make_shared<const InventorySnapshot>();
+    uint64_t lastVersion = 0;
+
+public:
+    void publish(const vector<unique_ptr<IMedicine>>& medicines) {
+        auto next = make_shared<InventorySnapshot>();
+        next->version = ++lastVersion;
+        next->takenAt = Utils::getCurrentTimestamp();
+        next->lots.reserve(medicines.size());
+        next->quantityColumn.reserve(medicines.size());
+        next->priceColumn.reserve(medicines.size());
+        next->valueColumn.reserve(medicines.size());
+        next->expiryDayColumn.reserve(medicines.size());
+        for (const auto& med : medicines) {
+            next->products[Utils::toLower(med->getName())].push_back(next->lots.size());
+            next->lots.push_back({ med->getId(), med->getName(), med->getQuantity(),
+                                   med->getExpiryDate(), med->getPriceCents() });
+            next->quantityColumn.push_back(med->getQuantity());
+            next->priceColumn.push_back(med->getPriceCents());
+            next->valueColumn.push_back(med->getQuantity() * med->getPriceCents());
+            next->expiryDayColumn.push_back(Utils::dayFromDate(med->getExpiryDate(), INT32_MAX));
+        }
+        // Same order LotIndex dispenses in, worked out once per version rather than by every reader
+        const vector<int64_t>& expiry = next->expiryDayColumn;
+        const vector<InventorySnapshot::Lot>& lots = next->lots;
+        for (auto& product : next->products) {
+            vector<size_t>& positions = product.second;
+            if (positions.size() < 2) continue;
+            sort(positions.begin(), positions.end(), [&](size_t a, size_t b) {
+                return expiry[a] != expiry[b] ? expiry[a] < expiry[b] : lots[a].id < lots[b].id;
+            });
+        }
+        atomic_store(&current, shared_ptr<const InventorySnapshot>(move(next)));
+    }
+
+    shared_ptr<const InventorySnapshot> acquire() const {
+        return atomic_load(&current);
+    }
+};
+
+// Change history of the catalogue for point-in-time questions. Each change
+// appends the lots it touched to deltas.log; every CHECKPOINT_EVERY deltas the
+// whole state is written out as a checkpoint in the background. The stock at
+// any moment is rebuilt from the newest checkpoint at or before it plus the
+// deltas that follow. The newest RECENT_CHECKPOINTS are all kept; older ones
+// are thinned to one per OLD_CHECKPOINT_SPACING, so the directory stays small
+// and an old query replays at most about that much history.
+class InventoryHistory {
+public:
+    using Lot = InventorySnapshot::Lot;
+    using State = map<int, Lot>;  // Keyed by lot ID
+
+    explicit InventoryHistory(string historyDirectory)
+        : directory(move(historyDirectory)), deltasPath(Utils::dataPath(directory, "deltas.log")),
+          checkpointsPath(Utils::dataPath(directory, "checkpoints.txt")), deltaSums(deltasPath) {
+        error_code ec;
+        filesystem::create_directories(directory, ec);
+        ifstream index(checkpointsPath);
+        string line;
+        while (getline(index, line)) {
+            string_view rest(line);
+            Checkpoint checkpoint;
+            if (parseInteger(Utils::nextField(rest), checkpoint.timestamp) &&
+                parseInteger(Utils::nextField(rest), checkpoint.deltaOffset)) {
+                checkpoint.file = string(rest);
+                checkpoints.push_back(move(checkpoint));
+            }
+        }
+        deltaBytes = filesystem::exists(deltasPath, ec) ? filesystem::file_size(deltasPath, ec) : 0;
+        sinceCheckpoint = rebuild(INT64_MAX, current, &lastTimestamp);
+    }
+
+    ~InventoryHistory() { TaskScheduler::shared().drain(this); }
+
+    InventoryHistory(const InventoryHistory&) = delete;
+    InventoryHistory& operator=(const InventoryHistory&) = delete;
+
+    // Appends a delta for each named lot that differs from the recorded state.
+    // Returns the lines appended, empty when nothing changed.
+    string record(const vector<Lot>& changed, const vector<int>& removed, int64_t timestamp) {
+        timestamp = max(timestamp, lastTimestamp);  // Keeps the file in time order if the clock steps back
+        string out;
+        size_t changes = 0;
+        for (const Lot& lot : changed) {
+            auto it = current.find(lot.id);
+            if (it != current.end() && sameLot(it->second, lot)) continue;
+            appendDelta(out, timestamp, 'S', lot);
+            current[lot.id] = lot;
+            changes++;
+        }
+        for (int id : removed) {
+            auto it = current.find(id);
+            if (it == current.end()) continue;
+            appendDelta(out, timestamp, 'D', it->second);
+            current.erase(it);
+            changes++;
+        }
+        if (changes == 0) return out;
+
+        ofstream deltas(deltasPath, ios::app | ios::binary);
+        if (!deltas.is_open()) return out;
+        deltas.write(out.data(), static_cast<streamsize>(out.size()));
+        deltas.close();
+        deltaSums.append(out);
+        deltaBytes += out.size();
+        lastTimestamp = timestamp;
+        sinceCheckpoint += changes;
+        if (sinceCheckpoint >= CHECKPOINT_EVERY) {
+            sinceCheckpoint = 0;
+            TaskScheduler::shared().submit(
+                [this, state = current, timestamp, offset = deltaBytes]() mutable {
+                    writeCheckpoint(move(state), timestamp, offset);
+                },
+                TaskScheduler::Priority::Low, this);
+        }
+        return out;
+    }
+
+    // Compares a whole snapshot with the recorded state, for changes whose
+    // lots nobody named, such as an edit to medicines.txt made elsewhere
+    string recordAll(const InventorySnapshot& snapshot, int64_t timestamp) {
+        unordered_set<int> present;
+        present.reserve(snapshot.lots.size());
+        for (const Lot& lot : snapshot.lots) present.insert(lot.id);
+        vector<int> removed;
+        for (const auto& entry : current) {
+            if (!present.count(entry.first)) removed.push_back(entry.first);
+        }
+        return record(snapshot.lots, removed, timestamp);
+    }
+
+    // The catalogue as it stood at the given Unix time
+    State stateAt(int64_t timestamp) {
+        State state;
+        rebuild(timestamp, state, nullptr);
+        return state;
+    }
+
+    // The catalogue after the last recorded change
+    const State& latest() const { return current; }
+
+    size_t checkpointCount() {
+        lock_guard<mutex> lock(checkpointMutex);
+        return checkpoints.size();
+    }
+
+    // "time,op,id,quantity,expiry,priceCents,name"; op is S (set) or D (delete)
+    static void appendDelta(string& out, int64_t timestamp, char op, const Lot& lot) {
+        out.append(to_string(timestamp)).append(1, ',').append(1, op).append(1, ',')
+            .append(to_string(lot.id)).append(1, ',').append(to_string(lot.quantity)).append(1, ',')
+            .append(lot.expiryDate).append(1, ',').append(to_string(lot.priceCents)).append(1, ',')
+            .append(lot.name).append(1, '\n');
+    }
+
+    static bool parseDelta(string_view line, int64_t& at, char& op, Lot& lot) {
+        if (!parseInteger(Utils::nextField(line), at)) return false;
+        string_view opField = Utils::nextField(line);
+        if (opField != "S" && opField != "D") return false;
+        op = opField.front();
+        return parseLot(line, lot);
+    }
+
+private:
+    static constexpr size_t CHECKPOINT_EVERY = 512;
+    static constexpr size_t RECENT_CHECKPOINTS = 16;
+    static constexpr int64_t OLD_CHECKPOINT_SPACING = 30 * 86400;  // Seconds
+
+    struct Checkpoint {
+        int64_t timestamp = 0;  // Time of the last delta it includes
+        uint64_t deltaOffset = 0;  // Where the deltas after it start in deltas.log
+        string file;
+    };
+
+    string directory;
+    string deltasPath;
+    string checkpointsPath;
+    BlockChecksums deltaSums;
+    State current;  // State after the last recorded delta
+    uint64_t deltaBytes = 0;
+    size_t sinceCheckpoint = 0;
+    int64_t lastTimestamp = INT64_MIN;
+    mutex checkpointMutex;  // Guards checkpoints against the background writer
+    vector<Checkpoint> checkpoints;  // Oldest first
+
+    template <typename Integer>
+    static bool parseInteger(string_view text, Integer& value) {
+        auto [end, error] = from_chars(text.data(), text.data() + text.size(), value);
+        return error == errc() && end == text.data() + text.size();
+    }
+
+    static bool sameLot(const Lot& a, const Lot& b) {
+        return a.quantity == b.quantity && a.priceCents == b.priceCents && a.expiryDate == b.expiryDate &&
+               a.name == b.name;
+    }
+
+    static bool parseLot(string_view& rest, Lot& lot) {
+        if (!parseInteger(Utils::nextField(rest), lot.id)) return false;
+        if (!parseInteger(Utils::nextField(rest), lot.quantity)) return false;
+        lot.expiryDate = string(Utils::nextField(rest));
+        if (!parseInteger(Utils::nextField(rest), lot.priceCents)) return false;
+        lot.name = string(rest);
+        return true;
+    }
+
+    // Loads the newest checkpoint at or before the time, then replays the deltas up to it.
+    // Returns the number of deltas replayed; lastSeen receives the time of the last one.
+    size_t rebuild(int64_t timestamp, State& state, int64_t* lastSeen) {
+        Checkpoint start;
+        {
+            lock_guard<mutex> lock(checkpointMutex);
+            auto after = upper_bound(checkpoints.begin(), checkpoints.end(), timestamp,
+                                     [](int64_t t, const Checkpoint& c) { return t < c.timestamp; });
+            if (after != checkpoints.begin()) start = *prev(after);
+        }
+        state.clear();
+        ifstream file;
+        if (!start.file.empty()) file.open(Utils::dataPath(directory, start.file));
+        // Pruned since it was looked up: replaying every delta gives the same state
+        if (!start.file.empty() && !file.is_open()) start = Checkpoint{};
+        if (!start.file.empty()) {
+            string line;
+            while (getline(file, line)) {
+                string_view rest(line);
+                Lot lot;
+                if (parseLot(rest, lot)) state[lot.id] = move(lot);
+            }
+            if (lastSeen) *lastSeen = start.timestamp;
+        }
+
+        ifstream deltas(deltasPath, ios::binary);
+        deltas.seekg(static_cast<streamoff>(start.deltaOffset));
+        size_t replayed = 0;
+        string line;
+        while (getline(deltas, line)) {
+            int64_t at = 0;
+            char op = 0;
+            Lot lot;
+            if (!parseDelta(line, at, op, lot)) continue;
+            if (at > timestamp) break;
+            if (op == 'D') state.erase(lot.id);
+            else state[lot.id] = move(lot);
+            replayed++;
+            if (lastSeen) *lastSeen = at;
+        }
+        return replayed;
+    }
+
+    // Runs on the scheduler with its own copy of the state
+    void writeCheckpoint(State state, int64_t timestamp, uint64_t offset) {
+        string name = "checkpoint-" + to_string(offset) + ".txt";
+        string path = Utils::dataPath(directory, name);
+        string out;
+        for (const auto& entry : state) {
+            const Lot& lot = entry.second;
+            out.append(to_string(lot.id)).append(1, ',').append(to_string(lot.quantity)).append(1, ',')
+                .append(lot.expiryDate).append(1, ',').append(to_string(lot.priceCents)).append(1, ',')
+                .append(lot.name).append(1, '\n');
+        }
+        {
+            ofstream file(path + ".tmp", ios::binary);
+            if (!file.is_open()) return;
+            file.write(out.data(), static_cast<streamsize>(out.size()));
+            if (!file) return;
+        }
+        error_code ec;
+        filesystem::rename(path + ".tmp", path, ec);
+        if (ec) return;
+        BlockChecksums::seal(path, out);
+
+        lock_guard<mutex> lock(checkpointMutex);
+        ofstream index(checkpointsPath, ios::app);
+        index << timestamp << "," << offset << "," << name << "\n";
+        index.close();
+        // Two checkpoint jobs may finish out of order; keep the list sorted by position
+        Checkpoint checkpoint{ timestamp, offset, name };
+        auto at = upper_bound(checkpoints.begin(), checkpoints.end(), offset,
+                              [](uint64_t o, const Checkpoint& c) { return o < c.deltaOffset; });
+        checkpoints.insert(at, move(checkpoint));
+        pruneCheckpoints();
+    }
+
+    // Caller holds checkpointMutex. Past the recent ones, keeps the oldest
+    // checkpoint of each OLD_CHECKPOINT_SPACING period and deletes the rest
+    void pruneCheckpoints() {
+        if (checkpoints.size() <= RECENT_CHECKPOINTS) return;
+        size_t oldCount = checkpoints.size() - RECENT_CHECKPOINTS;
+        vector<Checkpoint> kept;
+        vector<string> dropped;
+        int64_t lastPeriod = INT64_MIN;
+        for (size_t i = 0; i < checkpoints.size(); i++) {
+            int64_t period = checkpoints[i].timestamp / OLD_CHECKPOINT_SPACING;
+            if (i >= oldCount || period != lastPeriod) {
+                kept.push_back(checkpoints[i]);
+                lastPeriod = period;
+            } else {
+                dropped.push_back(checkpoints[i].file);
+            }
+        }
+        if (dropped.empty()) return;
+
+        string content;
+        for (const Checkpoint& checkpoint : kept) {
+            content.append(to_string(checkpoint.timestamp)).append(1, ',').append(to_string(checkpoint.deltaOffset))
+                .append(1, ',').append(checkpoint.file).append(1, '\n');
+        }
+        {
+            ofstream file(checkpointsPath + ".tmp", ios::binary | ios::trunc);
+            if (!file.is_open()) return;
+            file.write(content.data(), static_cast<streamsize>(content.size()));
+            if (!file) return;
+        }
+        error_code ec;
+        filesystem::rename(checkpointsPath + ".tmp", checkpointsPath, ec);
+        if (ec) return;
+        checkpoints = move(kept);
+        // Deleted only once the index no longer names them
+        for (const string& file : dropped) {
+            string path = Utils::dataPath(directory, file);
+            filesystem::remove(path, ec);
+            filesystem::remove(BlockChecksums::sumsPathOf(path), ec);
+        }
+    }
+};
+
+// Name lookup for the prompts that ask for a medicine. Product names sit in
+// a sorted array for prefix completion and in a trigram index for typos;
+// only names sharing trigrams with the query get an edit-distance score, so
+// a lookup stays cheap however large the catalogue grows.
+class MedicineSearchIndex {
+public:
+    struct Match {
+        string name;
+        int distance;  // 0 for prefix matches
+    };
+
+private:
+    vector<string> keys;   // Lower-cased product names, sorted
+    vector<string> names;  // Display names in the same order
+    unordered_map<uint32_t, vector<uint32_t>> trigrams;  // Trigram -> positions in keys
+    uint64_t indexedVersion = UINT64_MAX;
+    vector<uint16_t> hits;  // Scratch counters reused across searches
+    vector<uint32_t> touched;
+
+    static constexpr size_t FUZZY_CANDIDATES = 64;
+
+    // Trigrams of the name padded with two leading blanks and one trailing, so
+    // the first letters weigh more and short names still produce some
+    template <typename Visit>
+    static void forEachTrigram(const string& key, Visit visit) {
+        string padded = "  " + key + " ";
+        for (size_t i = 0; i + 3 <= padded.size(); ++i) {
+            visit(static_cast<uint32_t>(static_cast<uint8_t>(padded[i])) << 16 |
+                  static_cast<uint32_t>(static_cast<uint8_t>(padded[i + 1])) << 8 |
+                  static_cast<uint32_t>(static_cast<uint8_t>(padded[i + 2])));
+        }
+    }
+
+    // Levenshtein distance, giving up once it must exceed limit
+    static int editDistance(string_view a, string_view b, int limit) {
+        if (static_cast<int>(a.size() > b.size() ? a.size() - b.size() : b.size() - a.size()) > limit) return limit + 1;
+        vector<int> previous(b.size() + 1), current(b.size() + 1);
+        for (size_t j = 0; j <= b.size(); ++j) previous[j] = static_cast<int>(j);
+        for (size_t i = 1; i <= a.size(); ++i) {
+            current[0] = static_cast<int>(i);
+            int rowMin = current[0];
+            for (size_t j = 1; j <= b.size(); ++j) {
+                int substitute = previous[j - 1] + (a[i - 1] == b[j - 1] ? 0 : 1);
+                current[j] = min({ previous[j] + 1, current[j - 1] + 1, substitute });
+                rowMin = min(rowMin, current[j]);
+            }
+            if (rowMin > limit) return limit + 1;
+            swap(previous, current);
+        }
+        return previous[b.size()];
+    }
+
+public:
+    // Re-indexes when the snapshot is newer than the one last indexed
+    void refresh(const InventorySnapshot& view) {
+        if (view.version == indexedVersion) return;
+        vector<pair<string, string>> products;
+        products.reserve(view.products.size());
+        for (const auto& product : view.products) {
+            products.emplace_back(product.first, view.lots[product.second.front()].name);
+        }
+        sort(products.begin(), products.end());
+        keys.clear();
+        names.clear();
+        trigrams.clear();
+        for (auto& product : products) {
+            uint32_t position = static_cast<uint32_t>(keys.size());
+            forEachTrigram(product.first, [&](uint32_t gram) {
+                auto& postings = trigrams[gram];
+                if (postings.empty() || postings.back() != position) postings.push_back(position);
+            });
+            keys.push_back(move(product.first));
+            names.push_back(move(product.second));
+        }
+        hits.assign(keys.size(), 0);
+        indexedVersion = view.version;
+    }
+
+    // Up to limit names: prefix completions first, then the closest typo corrections
+    vector<Match> search(const string& query, size_t limit) {
+        vector<Match> matches;
+        string key = Utils::toLower(Utils::trim(query));
+        if (key.empty() || limit == 0) return matches;
+
+        auto it = lower_bound(keys.begin(), keys.end(), key);
+        for (; it != keys.end() && matches.size() < limit && it->compare(0, key.size(), key) == 0; ++it) {
+            matches.push_back({ names[static_cast<size_t>(it - keys.begin())], 0 });
+        }
+        if (matches.size() == limit) return matches;
+
+        forEachTrigram(key, [&](uint32_t gram) {
+            auto postings = trigrams.find(gram);
+            if (postings == trigrams.end()) return;
+            for (uint32_t position : postings->second) {
+                if (hits[position]++ == 0) touched.push_back(position);
+            }
+        });
+        size_t keep = min(touched.size(), FUZZY_CANDIDATES);
+        partial_sort(touched.begin(), touched.begin() + static_cast<ptrdiff_t>(keep), touched.end(),
+                     [this](uint32_t a, uint32_t b) { return hits[a] > hits[b]; });
+
+        // A typo in a half-typed name is judged against the same-length prefix, plus one
+        int maxDistance = max(1, static_cast<int>(key.size()) / 3);
+        vector<pair<int, uint32_t>> scored;
+        for (size_t i = 0; i < keep; ++i) {
+            const string& candidate = keys[touched[i]];
+            if (candidate.compare(0, key.size(), key) == 0) continue;  // Already listed as a prefix match
+            int distance = editDistance(key, candidate, maxDistance);
+            if (candidate.size() > key.size()) {
+                distance = min(distance, editDistance(key, string_view(candidate).substr(0, key.size()), maxDistance) + 1);
+            }
+            if (distance <= maxDistance) scored.emplace_back(distance, touched[i]);
+        }
+        for (uint32_t position : touched) hits[position] = 0;
+        touched.clear();
+
+        sort(scored.begin(), scored.end());
+        for (const auto& entry : scored) {
+            if (matches.size() == limit) break;
+            matches.push_back({ names[entry.second], entry.first });
+        }
+        return matches;
+    }
+};
+
+// Per-medicine demand estimated by exponential smoothing of the units sold
+// each day. A sale updates its product in constant time; days without sales
+// decay the estimate, so slow movers fade instead of keeping an old peak.
+class DemandForecaster {
+public:
+    static constexpr double ALPHA = 0.3;         // Weight of the newest day
+    static constexpr int LEAD_TIME_DAYS = 7;     // Supplier delivery time
+    static constexpr int SAFETY_DAYS = 7;        // Extra cover kept on top of the lead time
+    static constexpr int ORDER_COVER_DAYS = 30;  // Cover a reorder should bring stock up to
+    static constexpr double MIN_RATE = 0.01;     // Below this a product counts as not selling
+
+    struct Forecast {
+        double unitsPerDay = 0.0;
+        int usableStock = 0;      // Units expected to sell before their lot expires
+        int expiringUnits = 0;    // Units expected to expire unsold
+        int32_t runOutDay = -1;   // -1 when there is no demand
+        int reorderQuantity = 0;
+    };
+
+private:
+    struct State {
+        double level = 0.0;
+        int32_t lastDay = 0;
+        int64_t pending = 0;  // Units sold so far on lastDay
+        bool seen = false;
+        bool primed = false;  // The first complete day seeds the level directly
+    };
+
+    unordered_map<string, State> states;  // Keyed by lower-cased name
+    mutable mutex mtx;
+
+    static double closeDay(const State& state) {
+        return state.primed ? ALPHA * static_cast<double>(state.pending) + (1 - ALPHA) * state.level
+                            : static_cast<double>(state.pending);
+    }
+
+public:
+    void recordSale(string_view medicine, int32_t day, int64_t units) {
+        if (medicine.empty() || units <= 0) return;
+        lock_guard<mutex> lock(mtx);
+        State& state = states[Utils::toLower(medicine)];
+        if (!state.seen) {
+            state.seen = true;
+            state.lastDay = day;
+            state.pending = units;
+        } else if (day > state.lastDay) {
+            state.level = closeDay(state) * pow(1 - ALPHA, day - state.lastDay - 1);
+            state.primed = true;
+            state.lastDay = day;
+            state.pending = units;
+        } else {
+            state.pending += units;  // Same day, or a late entry folded into the open day
+        }
+    }
+
+    // Smoothed units per day as of today
+    double rate(string_view medicine, int32_t today) const {
+        lock_guard<mutex> lock(mtx);
+        auto it = states.find(Utils::toLower(medicine));
+        if (it == states.end() || !it->second.seen) return 0.0;
+        const State& state = it->second;
+        return closeDay(state) * pow(1 - ALPHA, max(0, today - state.lastDay - 1));
+    }
+
+    // Projects a product's stock forward. Lots, given earliest expiry first as the
+    // snapshot keeps them, are consumed at the forecast rate; whatever a lot still
+    // holds when it expires is lost.
+    Forecast assess(const InventorySnapshot& inventory, const vector<size_t>& lots, int heldUnits,
+                    int32_t today) const {
+        Forecast forecast;
+        forecast.unitsPerDay = lots.empty() ? 0.0 : rate(inventory.lots[lots.front()].name, today);
+        if (forecast.unitsPerDay < MIN_RATE) forecast.unitsPerDay = 0.0;
+        double consumed = 0.0;
+        for (size_t index : lots) {
+            int quantity = inventory.lots[index].quantity;
+            if (quantity <= 0) continue;
+            int32_t expiryDay = static_cast<int32_t>(inventory.expiryDayColumn[index]);
+            int sellable = 0;
+            if (expiryDay >= today) {
+                if (forecast.unitsPerDay <= 0 || expiryDay == INT32_MAX) {
+                    sellable = quantity;
+                } else {
+                    double demandUntilExpiry = forecast.unitsPerDay * (static_cast<double>(expiryDay) - today + 1);
+                    sellable = static_cast<int>(min<double>(quantity, max(0.0, demandUntilExpiry - consumed)));
+                }
+            }
+            consumed += sellable;
+            forecast.usableStock += sellable;
+            forecast.expiringUnits += quantity - sellable;
+        }
+        forecast.usableStock = max(0, forecast.usableStock - heldUnits);
+
+        if (forecast.unitsPerDay > 0) {
+            forecast.runOutDay = today + static_cast<int32_t>(forecast.usableStock / forecast.unitsPerDay);
+            double reorderPoint = forecast.unitsPerDay * (LEAD_TIME_DAYS + SAFETY_DAYS);
+            if (forecast.usableStock <= reorderPoint) {
+                double target = forecast.unitsPerDay * (LEAD_TIME_DAYS + ORDER_COVER_DAYS);
+                forecast.reorderQuantity = static_cast<int>(ceil(target)) - forecast.usableStock;
+            }
+        }
+        return forecast;
+    }
+};
+
+// Streams supplier catalogue files (name,quantity,expiry,price per line) in
+// fixed-size chunks so memory stays flat however large the file is. Rows of
+// each chunk are validated in parallel and handed to the caller in file order.
+class CatalogueImporter {
+public:
+    struct Row {
+        size_t lineNumber;
+        string name;
+        int quantity;
+        string expiryDate;
+        int64_t priceCents;
+    };
+
+    struct Rejection {
+        size_t lineNumber;
+        string reason;
+        string line;
+    };
+
+    static constexpr size_t CHUNK_SIZE = 1 << 20;
+    static constexpr const char* HEADER = "name,quantity,expiry,price";  // Written by exportTo
+
+private:
+    struct Parsed {
+        bool valid = false;
+        Row row;
+        string reason;
+    };
+
+    static bool parseNumber(string_view text, int& value) {
+        string s(Utils::trimView(text));
+        if (s.empty() || !all_of(s.begin(), s.end(), ::isdigit)) return false;
+        try {
+            value = stoi(s);
+        } catch (...) {
+            return false;
+        }
+        return true;
+    }
+
+    static void parseRow(string_view line, size_t lineNumber, Parsed& out) {
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        out.row.lineNumber = lineNumber;
+        out.row.name = Utils::trim(string(Utils::nextField(line)));
+        string_view quantityStr = Utils::nextField(line);
+        out.row.expiryDate = Utils::trim(string(Utils::nextField(line)));
+        string_view priceStr = Utils::nextField(line);
+
+        if (out.row.name.empty()) out.reason = "Missing medicine name";
+        else if (!parseNumber(quantityStr, out.row.quantity) || out.row.quantity <= 0)
+            out.reason = "Quantity must be a positive whole number";
+        else if (!Utils::isValidDate(out.row.expiryDate)) out.reason = "Invalid expiry date";
+        else if (!Utils::parseCents(priceStr, out.row.priceCents) || out.row.priceCents <= 0)
+            out.reason = "Price must be a positive number";
+        else if (!line.empty()) out.reason = "Too many columns";
+        else out.valid = true;
+    }
+
+    // Validates one chunk's lines across worker threads, then reports them in file order
+    static void processLines(const vector<pair<size_t, string_view>>& lines,
+                             const function<void(Row&)>& onRow, vector<Rejection>& rejects) {
+        vector<Parsed> parsed(lines.size());
+        size_t workers = min<size_t>(max(1u, thread::hardware_concurrency()), lines.size() / 4096 + 1);
+        size_t perWorker = (lines.size() + workers - 1) / workers;
+        vector<thread> threads;
+        for (size_t w = 0; w < workers; w++) {
+            size_t begin = w * perWorker;
+            size_t end = min(lines.size(), begin + perWorker);
+            if (begin >= end) break;
+            threads.emplace_back([&lines, &parsed, begin, end]() {
+                for (size_t i = begin; i < end; i++) parseRow(lines[i].second, lines[i].first, parsed[i]);
+            });
+        }
+        for (auto& t : threads) t.join();
+
+        for (size_t i = 0; i < parsed.size(); i++) {
+            if (parsed[i].valid) onRow(parsed[i].row);
+            else rejects.push_back(Rejection{ lines[i].first, move(parsed[i].reason), string(lines[i].second) });
+        }
+    }
+
+public:
+    // Feeds every valid row to onRow and collects the rest; returns false if the file cannot be read
+    static bool import(const string& path, const function<void(Row&)>& onRow,
+                       vector<Rejection>& rejects, size_t& rowsRead) {
+        ifstream file(path, ios::binary);
+        if (!file.is_open()) return false;
+
+        rowsRead = 0;
+        size_t lineNumber = 0;
+        string buffer;
+        string carry;  // Partial line left over from the previous chunk
+        vector<pair<size_t, string_view>> lines;
+        vector<char> chunk(CHUNK_SIZE);
+
+        auto addLine = [&](string_view line) {
+            lineNumber++;
+            string_view content = Utils::trimView(line.substr(0, line.find_last_not_of('\r') + 1));
+            if (content.empty()) return;
+            // An optional header on the first line is skipped; a product named "Name..." is still a row
+            if (lineNumber == 1 && Utils::equalsIgnoreCase(content, HEADER)) return;
+            lines.emplace_back(lineNumber, line);
+        };
+        auto flush = [&]() {
+            rowsRead += lines.size();
+            processLines(lines, onRow, rejects);
+            lines.clear();
+        };
+
+        while (file) {
+            file.read(chunk.data(), static_cast<streamsize>(chunk.size()));
+            size_t got = static_cast<size_t>(file.gcount());
+            if (got == 0) break;
+            buffer.assign(carry);
+            buffer.append(chunk.data(), got);
+
+            size_t start = 0;
+            size_t newline;
+            while ((newline = buffer.find('\n', start)) != string::npos) {
+                addLine(string_view(buffer.data() + start, newline - start));
+                start = newline + 1;
+            }
+            flush();
+            carry.assign(buffer, start, string::npos);
+        }
+        if (!carry.empty()) {
+            addLine(carry);
+            flush();
+        }
+        return true;
+    }
+
+    // Writes the catalogue as CSV through a chunk-sized buffer
+    static bool exportTo(const string& path, const vector<unique_ptr<IMedicine>>& medicines) {
+        ofstream file(path, ios::binary);
+        if (!file.is_open()) return false;
+        string buffer = string(HEADER) + "\n";
+        buffer.reserve(CHUNK_SIZE + 256);
+        for (const auto& med : medicines) {
+            string priceStr = Utils::centsToDecimal(med->getPriceCents());
+            buffer.append(med->getName()).append(1, ',').append(to_string(med->getQuantity())).append(1, ',')
+                  .append(med->getExpiryDate()).append(1, ',').append(priceStr).append(1, '\n');
+            if (buffer.size() >= CHUNK_SIZE) {
+                file.write(buffer.data(), static_cast<streamsize>(buffer.size()));
+                buffer.clear();
+            }
+        }
+        file.write(buffer.data(), static_cast<streamsize>(buffer.size()));
+        return static_cast<bool>(file);
+    }
+};
+
+enum class FulfilmentStatus { Pending, Billed };
+
+// Prescription interface
+class IPrescription {
+public:
+    virtual ~IPrescription() = default;
+    virtual const string& getId() const = 0;
+    virtual const string& getPatientName() const = 0;
+    virtual const string& getMedicineName() const = 0;
+    virtual int getQuantity() const = 0;
+    virtual const string& getDate() const = 0;
+    virtual const string& getPrescribingDoctor() const = 0;
+    virtual FulfilmentStatus getStatus() const = 0;
+    virtual void setStatus(FulfilmentStatus s) = 0;
+    virtual void display() const = 0;
+    virtual string toFileString() const = 0;
+};
+
+// Concrete Prescription implementation
+class Prescription : public IPrescription {
+private:
+    string id;
+    string patientName;
+    string medicineName;
+    int quantity;
+    string date;
+    string prescribingDoctor;
+    FulfilmentStatus status;
+
+public:
+    Prescription(string i, string pn, string mn, int q, string d, string pd,
+                 FulfilmentStatus s = FulfilmentStatus::Pending)
+        : id(Utils::trim(move(i))), patientName(Utils::trim(move(pn))), 
+          medicineName(Utils::trim(move(mn))), quantity(q), date(move(d)), 
+          prescribingDoctor(Utils::trim(move(pd))), status(s) {
+        if (quantity <= 0) throw invalid_argument("Quantity must be positive");
+        if (!Utils::isValidDate(date)) throw invalid_argument("Invalid date");
+    }
+
+    ~Prescription() override = default;
+
+    const string& getId() const override { return id; }
+    const string& getPatientName() const override { return patientName; }
+    const string& getMedicineName() const override { return medicineName; }
+    int getQuantity() const override { return quantity; }
+    const string& getDate() const override { return date; }
+    const string& getPrescribingDoctor() const override { return prescribingDoctor; }
+    FulfilmentStatus getStatus() const override { return status; }
+    void setStatus(FulfilmentStatus s) override { status = s; }
+
+    static string_view statusName(FulfilmentStatus s) {
+        return s == FulfilmentStatus::Billed ? "Billed" : "Pending";
+    }
+
+    void display() const override {
+        cout << "Prescription ID: " << id << "\n"
+             << "Patient: " << patientName << "\n"
+             << "Medicine: " << medicineName << "\n"
+             << "Quantity: " << quantity << "\n"
+             << "Date: " << date << "\n"
+             << "Doctor: " << prescribingDoctor << "\n"
+             << "Status: " << statusName(status) << "\n";
+    }
+
+    string toFileString() const override {
+        string quantityStr = to_string(quantity);
+        string_view statusStr = statusName(status);
+        string line;
+        line.reserve(id.size() + patientName.size() + medicineName.size() + quantityStr.size() +
+                     date.size() + prescribingDoctor.size() + statusStr.size() + 6);
+        line.append(id).append(1, ',').append(patientName).append(1, ',')
+            .append(medicineName).append(1, ',').append(quantityStr).append(1, ',')
+            .append(date).append(1, ',').append(prescribingDoctor).append(1, ',')
+            .append(statusStr);
+        return line;
+    }
+
+    // Builds the prescription directly on the heap so loading does not copy it
+    static unique_ptr<Prescription> fromFileString(string_view line) {
+        string_view id = Utils::nextField(line);
+        string_view patientName = Utils::nextField(line);
+        string_view medicineName = Utils::nextField(line);
+        string_view quantityStr = Utils::nextField(line);
+        string_view date = Utils::nextField(line);
+        string_view prescribingDoctor = Utils::nextField(line);
+        // Files written before fulfilment tracking have no status column
+        FulfilmentStatus status = Utils::nextField(line) == "Billed" ? FulfilmentStatus::Billed
+                                                                      : FulfilmentStatus::Pending;
+
+        // Like Medicine::fromFileString, a bad row throws rather than loading as a placeholder
+        int quantity = 0;
+        try {
+            quantity = stoi(string(quantityStr));
+        } catch (const exception&) {
+            throw invalid_argument("invalid quantity");
+        }
+        return make_unique<Prescription>(string(id), string(patientName), string(medicineName), quantity,
+                                         string(date), string(prescribingDoctor), status);
+    }
+};
+
+// Prescriptions grouped by patient and kept in date order, so a patient's
+// history is one hash lookup and their recent medications a short range scan
+// instead of a pass over every prescription on file. Entries hold IDs, which
+// the caller resolves, so a replaced or deleted prescription can never leave
+// a dangling reference behind.
+class PatientHistoryIndex {
+public:
+    struct Entry {
+        int32_t day;  // Utils::dayFromDate of the prescription date
+        string id;
+    };
+
+    void rebuild(const vector<unique_ptr<IPrescription>>& prescriptions) {
+        patients.clear();
+        for (const auto& pres : prescriptions) {
+            add(*pres);
+        }
+    }
+
+    // Same-day prescriptions keep the order they were added in
+    void add(const IPrescription& pres) {
+        vector<Entry>& entries = patients[Utils::toLower(pres.getPatientName())];
+        Entry entry{ Utils::dayFromDate(pres.getDate(), 0), pres.getId() };
+        auto at = upper_bound(entries.begin(), entries.end(), entry.day,
+                              [](int32_t day, const Entry& e) { return day < e.day; });
+        entries.insert(at, entry);
+    }
+
+    void remove(const IPrescription& pres) {
+        auto patient = patients.find(Utils::toLower(pres.getPatientName()));
+        if (patient == patients.end()) return;
+        vector<Entry>& entries = patient->second;
+        entries.erase(remove_if(entries.begin(), entries.end(),
+                                [&pres](const Entry& e) { return e.id == pres.getId(); }),
+                      entries.end());
+        if (entries.empty()) patients.erase(patient);
+    }
+
+    // Oldest first
+    const vector<Entry>& history(string_view patientName) const {
+        static const vector<Entry> none;
+        auto patient = patients.find(Utils::toLower(Utils::trimView(patientName)));
+        return patient == patients.end() ? none : patient->second;
+    }
+
+    // Calls visit for each of the patient's prescriptions dated within [fromDay, toDay]
+    template <typename Visit>
+    void forEachInRange(string_view patientName, int32_t fromDay, int32_t toDay, Visit visit) const {
+        const vector<Entry>& entries = history(patientName);
+        auto it = lower_bound(entries.begin(), entries.end(), fromDay,
+                              [](const Entry& e, int32_t day) { return e.day < day; });
+        for (; it != entries.end() && it->day <= toDay; ++it) {
+            visit(*it);
+        }
+    }
+
+    size_t patientCount() const { return patients.size(); }
+
+private:
+    unordered_map<string, vector<Entry>> patients;  // Keyed by lower-cased patient name
+};
+
+// Cold tier for prescriptions nobody is working on any more. Records are
+// packed BLOCK_RECORDS at a time into compressed blocks appended to one data
+// file; a small text index maps IDs and patients to blocks. Nothing is read
+// until the first lookup, and only the blocks a lookup touches are inflated,
+// with the most recent few kept in a cache.
+class PrescriptionArchive {
+public:
+    using Block = vector<unique_ptr<IPrescription>>;
+
+    PrescriptionArchive(string dataPath, string indexPath)
+        : dataFile(move(dataPath)), indexFile(move(indexPath)), dataSums(dataFile) {}
+
+    // Moves the given prescriptions into the archive. IDs already archived are
+    // skipped, so repeating an interrupted move does not duplicate them.
+    void append(const vector<unique_ptr<IPrescription>>& cold) {
+        ensureIndex();
+        ofstream data(dataFile, ios::binary | ios::app);
+        ofstream index(indexFile, ios::app);
+        if (!data.is_open() || !index.is_open()) {
+            cerr << "Warning: could not write prescription archive\n";
+            return;
+        }
+        data.seekp(0, ios::end);
+        uint64_t offset = static_cast<uint64_t>(data.tellp());
+
+        unordered_set<string> ids;
+        for (const auto& pres : cold) ids.insert(pres->getId());
+        unordered_set<string> archived = archivedAmong(ids);
+        vector<const IPrescription*> pending;
+        for (const auto& pres : cold) {
+            if (!archived.count(pres->getId())) pending.push_back(pres.get());
+        }
+        for (size_t start = 0; start < pending.size(); start += BLOCK_RECORDS) {
+            size_t end = min(pending.size(), start + BLOCK_RECORDS);
+            string text;
+            for (size_t i = start; i < end; i++) {
+                text.append(pending[i]->toFileString()).append(1, '\n');
+            }
+            string packed = Compression::compress(text);
+            data.write(packed.data(), static_cast<streamsize>(packed.size()));
+            data.flush();  // Block bytes land before the index points at them
+            dataSums.append(packed);
+
+            string entries = "B," + to_string(offset) + "," + to_string(packed.size()) + "\n";
+            for (size_t i = start; i < end; i++) {
+                entries.append("R,").append(pending[i]->getId()).append(1, ',')
+                    .append(pending[i]->getPatientName()).append(1, '\n');
+            }
+            index << entries;
+            index.flush();
+            addBlock(offset, packed.size());
+            for (size_t i = start; i < end; i++) addRecord(pending[i]->getPatientName());
+            offset += packed.size();
+        }
+    }
+
+    // IDs are looked up in the index file, so memory does not grow with the archive
+    bool contains(const string& id) const { return !archivedAmong({ id }).empty(); }
+
+    // Visits the patient's archived prescriptions dated within [fromDay, toDay]
+    template <typename Visit>
+    void forEachForPatient(string_view patientName, int32_t fromDay, int32_t toDay, Visit visit) {
+        ensureIndex();
+        auto patient = byPatient.find(Utils::toLower(Utils::trimView(patientName)));
+        if (patient == byPatient.end()) return;
+        string key = patient->first;
+        for (uint32_t blockId : patient->second) {
+            shared_ptr<const Block> block = loadBlock(blockId);
+            if (!block) continue;
+            for (const auto& pres : *block) {
+                if (Utils::toLower(pres->getPatientName()) != key) continue;
+                int32_t day = Utils::dayFromDate(pres->getDate(), 0);
+                if (day >= fromDay && day <= toDay) visit(*pres);
+            }
+        }
+    }
+
+private:
+    static constexpr size_t BLOCK_RECORDS = 256;
+    static constexpr size_t CACHED_BLOCKS = 8;
+
+    struct BlockRef {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    string dataFile;
+    string indexFile;
+    BlockChecksums dataSums;
+    bool indexLoaded = false;
+    vector<BlockRef> blocks;
+    unordered_map<string, vector<uint32_t>> byPatient;  // Lower-cased name to the blocks holding them
+    list<pair<uint32_t, shared_ptr<const Block>>> cache;  // Most recently used first
+
+    void addBlock(uint64_t offset, uint64_t length) {
+        blocks.push_back({ offset, length });
+    }
+
+    void addRecord(string_view patientName) {
+        uint32_t blockId = static_cast<uint32_t>(blocks.size() - 1);
+        vector<uint32_t>& patientBlocks = byPatient[Utils::toLower(Utils::trimView(patientName))];
+        if (patientBlocks.empty() || patientBlocks.back() != blockId) patientBlocks.push_back(blockId);
+    }
+
+    void ensureIndex() {
+        if (indexLoaded) return;
+        indexLoaded = true;
+        ifstream index(indexFile);
+        if (!index.is_open()) return;
+        error_code ec;
+        uint64_t dataSize = filesystem::file_size(dataFile, ec);
+        if (ec) dataSize = 0;
+        bool blockValid = false;  // Records after a damaged block line belong to it, so they are dropped too
+        string line;
+        while (getline(index, line)) {
+            string_view rest(line);
+            string_view kind = Utils::nextField(rest);
+            if (kind == "B") {
+                string offset(Utils::nextField(rest));
+                string length(Utils::nextField(rest));
+                try {
+                    uint64_t start = stoull(offset);
+                    uint64_t size = stoull(length);
+                    blockValid = start <= dataSize && size <= dataSize - start;
+                    if (blockValid) addBlock(start, size);
+                } catch (...) {
+                    blockValid = false;
+                }
+                if (!blockValid) cerr << "Warning: skipping damaged archive index entry\n";
+            } else if (kind == "R" && blockValid) {
+                Utils::nextField(rest);
+                addRecord(rest);
+            }
+        }
+    }
+
+    // Those of ids that the index file lists
+    unordered_set<string> archivedAmong(const unordered_set<string>& ids) const {
+        unordered_set<string> found;
+        ifstream index(indexFile);
+        string line;
+        while (!ids.empty() && getline(index, line)) {
+            string_view rest(line);
+            if (Utils::nextField(rest) != "R") continue;
+            auto it = ids.find(string(Utils::nextField(rest)));
+            if (it != ids.end()) found.insert(*it);
+        }
+        return found;
+    }
+
+    shared_ptr<const Block> loadBlock(uint32_t blockId) {
+        for (auto it = cache.begin(); it != cache.end(); ++it) {
+            if (it->first == blockId) {
+                cache.splice(cache.begin(), cache, it);
+                return it->second;
+            }
+        }
+        if (blockId >= blocks.size()) return nullptr;
+
+        ifstream data(dataFile, ios::binary);
+        error_code ec;
+        uint64_t dataSize = filesystem::file_size(dataFile, ec);
+        const auto& where = blocks[blockId];
+        if (ec || where.offset > dataSize || where.length > dataSize - where.offset) {
+            cerr << "Warning: prescription archive block " << blockId << " lies past the end of the archive\n";
+            return nullptr;
+        }
+        string packed(where.length, '\0');
+        data.seekg(static_cast<streamoff>(where.offset));
+        string text;
+        if (!data.read(&packed[0], static_cast<streamsize>(packed.size())) || !Compression::decompress(packed, text)) {
+            cerr << "Warning: prescription archive block " << blockId << " is unreadable\n";
+            return nullptr;
+        }
+        auto block = make_shared<Block>();
+        string_view rest(text);
+        while (!rest.empty()) {
+            size_t newline = rest.find('\n');
+            try {
+                block->push_back(Prescription::fromFileString(rest.substr(0, newline)));
+            } catch (const exception& e) {
+                cerr << "Warning: skipped a record in prescription archive block " << blockId << " (" << e.what()
+                     << ")\n";
+            }
+            rest.remove_prefix(newline == string_view::npos ? rest.size() : newline + 1);
+        }
+        cache.emplace_front(blockId, block);
+        if (cache.size() > CACHED_BLOCKS) cache.pop_back();
+        return block;
+    }
+};
+
+// Known drug pairs that should not be dispensed together, read from a local
+// file so the check never leaves the machine. Pairs are stored under a key
+// that is the same whichever way round the drugs are named.
+class InteractionTable {
+public:
+    enum class Severity : uint8_t { Minor, Moderate, Major };
+
+    struct Interaction {
+        Severity severity;
+        string note;
+    };
+
+    static string_view severityName(Severity severity) {
+        switch (severity) {
+            case Severity::Major: return "Major";
+            case Severity::Moderate: return "Moderate";
+            default: return "Minor";
+        }
+    }
+
+    // Lines are "drugA,drugB,severity,note" or "alias,product,ingredient"; drugs
+    // are matched on their ingredient, so "Ibuprofen 400mg" hits an Ibuprofen pair.
+    // Returns false when the file is missing.
+    bool load(const string& path) {
+        pairs.clear();
+        aliases.clear();
+        ingredients.clear();
+        ifstream file(path);
+        if (!file.is_open()) return false;
+        vector<string> pairLines;  // Keyed once every alias is known, wherever it sits in the file
+        string line;
+        while (getline(file, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            string_view rest(line);
+            string_view first = Utils::trimView(Utils::nextField(rest));
+            string_view second = Utils::trimView(Utils::nextField(rest));
+            string_view ingredient = Utils::trimView(Utils::nextField(rest));
+            if (first.empty() || second.empty()) continue;
+            if (!Utils::equalsIgnoreCase(first, "alias")) pairLines.push_back(move(line));
+            else if (!ingredient.empty()) addAlias(second, ingredient);
+        }
+        for (const auto& pairLine : pairLines) {
+            string_view rest(pairLine);
+            string_view first = Utils::trimView(Utils::nextField(rest));
+            string_view second = Utils::trimView(Utils::nextField(rest));
+            string_view severity = Utils::trimView(Utils::nextField(rest));
+            add(first, second, parseSeverity(severity), string(Utils::trimView(rest)));
+        }
+        return true;
+    }
+
+    // A small starter table, written only when someone imports it with --import-interactions
+    void seedDefaults() {
+        add("Warfarin", "Aspirin", Severity::Major, "Raised bleeding risk");
+        add("Warfarin", "Ibuprofen", Severity::Major, "Raised bleeding risk");
+        add("Warfarin", "Mefenamic", Severity::Major, "Raised bleeding risk");
+        add("Sildenafil", "Nitroglycerin", Severity::Major, "Severe drop in blood pressure");
+        add("Simvastatin", "Clarithromycin", Severity::Major, "Statin levels rise; muscle damage risk");
+        add("Tramadol", "Fluoxetine", Severity::Major, "Serotonin syndrome risk");
+        add("Lisinopril", "Spironolactone", Severity::Moderate, "High potassium risk");
+        add("Aspirin", "Ibuprofen", Severity::Moderate, "Ibuprofen blunts aspirin's antiplatelet effect");
+        add("Ciprofloxacin", "Antacid", Severity::Moderate, "Antacids reduce ciprofloxacin absorption");
+        add("Metformin", "Alcohol", Severity::Minor, "Lactic acidosis risk with heavy use");
+    }
+
+    bool save(const string& path) const {
+        ofstream file(path);
+        if (!file.is_open()) return false;
+        for (const auto& [product, alias] : aliases) {
+            file << "alias," << alias.product << "," << alias.ingredient << "\n";
+        }
+        for (const auto& [key, entry] : pairs) {
+            file << entry.first << "," << entry.second << "," << severityName(entry.interaction.severity)
+                 << "," << entry.interaction.note << "\n";
+        }
+        return static_cast<bool>(file);
+    }
+
+    void add(string_view first, string_view second, Severity severity, string note) {
+        pairs[pairKey(first, second)] = { string(first), string(second), { severity, move(note) } };
+    }
+
+    // For brand names whose first word is not the ingredient
+    void addAlias(string_view product, string_view ingredient) {
+        aliases[Utils::toLower(Utils::trimView(product))] = { string(product), string(ingredient) };
+        ingredients.insert(Utils::toLower(Utils::trimView(ingredient)));
+    }
+
+    const Interaction* find(string_view first, string_view second) const {
+        auto it = pairs.find(pairKey(first, second));
+        return it == pairs.end() ? nullptr : &it->second.interaction;
+    }
+
+    size_t size() const { return pairs.size(); }
+
+private:
+    struct Entry {
+        string first;
+        string second;
+        Interaction interaction;
+    };
+    struct Alias {
+        string product;
+        string ingredient;
+    };
+    unordered_map<string, Entry> pairs;
+    unordered_map<string, Alias> aliases;  // Keyed by lower-cased product name
+    unordered_set<string> ingredients;  // Lower-cased ingredients that aliases name, kept whole
+
+    // An alias's ingredient is used as written, and so is a name that is one;
+    // anything else is cut to its first word, which drops strength and form
+    string ingredientKey(string_view name) const {
+        string key = Utils::toLower(Utils::trimView(name));
+        if (auto it = aliases.find(key); it != aliases.end()) return Utils::toLower(Utils::trimView(it->second.ingredient));
+        if (ingredients.count(key)) return key;
+        size_t end = key.find_first_of(" \t");
+        if (end != string::npos) key.resize(end);
+        return key;
+    }
+
+    string pairKey(string_view first, string_view second) const {
+        string a = ingredientKey(first);
+        string b = ingredientKey(second);
+        if (b < a) a.swap(b);
+        return a.append(1, '\0').append(b);
+    }
+
+    static Severity parseSeverity(string_view text) {
+        if (Utils::equalsIgnoreCase(text, "major")) return Severity::Major;
+        if (Utils::equalsIgnoreCase(text, "moderate")) return Severity::Moderate;
+        return Severity::Minor;
+    }
+};
+
+// Outcome of a completed bill, kept per prescription so retries can replay it.
+// A bill is written twice: first as pending, with each lot's quantity before
+// and after the dispense, then again once the stock and status are saved.
+struct BillingReceipt {
+    string prescriptionId;
+    string reference;
+    string method;
+    string medicineName;
+    int quantity = 0;
+    int64_t totalCents = 0;
+    string timestamp;
+    string pendingLots;  // "lot:before:after" separated by spaces; empty once the bill is done
+
+    string toFileString() const {
+        string line = prescriptionId + "," + reference + "," + method + "," + medicineName + "," +
+                      to_string(quantity) + "," + Utils::centsToDecimal(totalCents) + "," + timestamp;
+        if (!pendingLots.empty()) line.append(",pending,").append(pendingLots);
+        return line;
+    }
+
+    static bool fromFileString(string_view line, BillingReceipt& receipt) {
+        receipt.prescriptionId = string(Utils::nextField(line));
+        receipt.reference = string(Utils::nextField(line));
+        receipt.method = string(Utils::nextField(line));
+        receipt.medicineName = string(Utils::nextField(line));
+        string quantityStr(Utils::nextField(line));
+        string totalStr(Utils::nextField(line));
+        receipt.timestamp = string(Utils::nextField(line));
+        receipt.pendingLots.clear();
+        if (Utils::nextField(line) == "pending") receipt.pendingLots = string(line);
+        try {
+            receipt.quantity = stoi(quantityStr);
+        } catch (...) {
+            return false;
+        }
+        if (!Utils::parseCents(totalStr, receipt.totalCents)) return false;
+        return !receipt.prescriptionId.empty();
+    }
+};
+
+// Streams a store's inventory and prescription changes to read-only replica
+// processes over a Unix socket in its data root. A replica that connects is
+// sent the whole current state, then every change as it is published. Each
+// replica has its own queue and sender thread, so a slow one only falls
+// behind and never holds up billing; one that falls too far behind is
+// dropped and resyncs when it reconnects. Replicas acknowledge what they
+// have applied and how long after sending it was applied, which is how lag
+// shows up on this side.
+//
+// Lines on the wire are "<kind>,<sequence>,<sent micros>,<payload>": B starts
+// a full sync and R ends it, I carries an InventoryHistory delta line, P a
+// prescription ("S,<file line>" or "D,<id>"), H is a heartbeat. Replicas
+// answer with "A,<sequence>,<apply lag micros>".
+class ReplicationPublisher {
+public:
+    struct ReplicaStatus {
+        int id;
+        uint64_t ackedSequence;
+        double lagMillis;  // Send-to-apply time the replica reported for its newest change
+        size_t queuedBytes;
+    };
+
+    explicit ReplicationPublisher(string path) : socketPath(move(path)) {
+        listenFd = LocalSocket::listenAt(socketPath);
+        if (listenFd < 0) return;
+        if (!LocalSocket::openWakePipe(wakePipe)) {
+            LocalSocket::closeFd(listenFd);
+            listenFd = -1;
+            return;
+        }
+        acceptor = thread(&ReplicationPublisher::acceptLoop, this);
+    }
+
+    ~ReplicationPublisher() {
+        stopping = true;
+        LocalSocket::wake(wakePipe[1]);
+        if (acceptor.joinable()) acceptor.join();
+        vector<shared_ptr<Replica>> all;
+        {
+            lock_guard<mutex> lock(mtx);
+            all.swap(replicas);
+        }
+        for (const auto& replica : all) stopReplica(*replica);
+        if (listenFd >= 0) {
+            LocalSocket::closeFd(listenFd);
+            error_code ec;
+            filesystem::remove(socketPath, ec);
+        }
+        LocalSocket::closeFd(wakePipe[0]);
+        LocalSocket::closeFd(wakePipe[1]);
+    }
+
+    ReplicationPublisher(const ReplicationPublisher&) = delete;
+    ReplicationPublisher& operator=(const ReplicationPublisher&) = delete;
+
+    bool listening() const { return listenFd >= 0; }
+    const string& path() const { return socketPath; }
+
+    uint64_t sequence() {
+        lock_guard<mutex> lock(mtx);
+        return lastSequence;
+    }
+
+    // Sets the state new replicas are sent, without sending anything; called once after loading
+    void seed(const InventorySnapshot& snapshot, const vector<unique_ptr<IPrescription>>& current) {
+        lock_guard<mutex> lock(mtx);
+        lots.clear();
+        for (const auto& lot : snapshot.lots) {
+            string line;
+            InventoryHistory::appendDelta(line, 0, 'S', lot);
+            line.pop_back();
+            lots[lot.id] = move(line);
+        }
+        prescriptions.clear();
+        for (const auto& pres : current) prescriptions[pres->getId()] = pres->toFileString();
+    }
+
+    // Forwards the delta lines InventoryHistory::record just wrote
+    void publishLots(string_view deltaLines) {
+        if (!listening() || deltaLines.empty()) return;
+        lock_guard<mutex> lock(mtx);
+        string batch;
+        while (!deltaLines.empty()) {
+            size_t newline = deltaLines.find('\n');
+            string_view line = deltaLines.substr(0, newline);
+            deltaLines.remove_prefix(newline == string_view::npos ? deltaLines.size() : newline + 1);
+            int64_t at = 0;
+            char op = 0;
+            InventoryHistory::Lot lot;
+            if (!InventoryHistory::parseDelta(line, at, op, lot)) continue;
+            if (op == 'D') lots.erase(lot.id);
+            else lots[lot.id] = string(line);
+            appendMessage(batch, 'I', line);
+        }
+        broadcast(batch);
+    }
+
+    // Sends the prescriptions added, changed or removed since the last call
+    void publishPrescriptions(const vector<unique_ptr<IPrescription>>& current) {
+        if (!listening()) return;
+        lock_guard<mutex> lock(mtx);
+        unordered_map<string, string> next;
+        next.reserve(current.size());
+        string batch;
+        for (const auto& pres : current) {
+            string line = pres->toFileString();
+            auto it = prescriptions.find(pres->getId());
+            if (it == prescriptions.end() || it->second != line) appendMessage(batch, 'P', "S," + line);
+            next.emplace(pres->getId(), move(line));
+        }
+        for (const auto& entry : prescriptions) {
+            if (!next.count(entry.first)) appendMessage(batch, 'P', "D," + entry.first);
+        }
+        prescriptions = move(next);
+        broadcast(batch);
+    }
+
+    vector<ReplicaStatus> status() {
+        lock_guard<mutex> lock(mtx);
+        vector<ReplicaStatus> result;
+        for (const auto& replica : replicas) {
+            lock_guard<mutex> replicaLock(replica->mtx);
+            result.push_back({ replica->id, replica->ackedSequence, static_cast<double>(replica->lagMicros) / 1000.0,
+                               replica->pending.size() });
+        }
+        return result;
+    }
+
+private:
+    static constexpr int HEARTBEAT_MILLIS = 1000;
+    static constexpr size_t MAX_QUEUED_BYTES = 64 << 20;  // A replica this far behind is dropped
+
+    struct Replica {
+        int id = 0;
+        int fd = -1;
+        mutex mtx;  // Guards everything below
+        condition_variable ready;
+        string pending;
+        bool closed = false;
+        uint64_t ackedSequence = 0;
+        int64_t lagMicros = 0;
+        thread sender;
+    };
+
+    string socketPath;
+    int listenFd = -1;
+    int wakePipe[2] = { -1, -1 };
+    atomic<bool> stopping{ false };
+    thread acceptor;
+
+    mutex mtx;  // Guards the mirrored state, the sequence and the replica list
+    map<int, string> lots;  // Delta line per lot ID
+    unordered_map<string, string> prescriptions;  // File line per prescription ID
+    uint64_t lastSequence = 0;
+    vector<shared_ptr<Replica>> replicas;
+    int nextReplicaId = 1;
+
+    static int64_t nowMicros() {
+        return chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static void appendLine(string& out, char kind, uint64_t sequence, int64_t sentAt, string_view payload) {
+        out.append(1, kind).append(1, ',').append(to_string(sequence)).append(1, ',')
+            .append(to_string(sentAt)).append(1, ',').append(payload).append(1, '\n');
+    }
+
+    void appendMessage(string& batch, char kind, string_view payload) {
+        appendLine(batch, kind, ++lastSequence, nowMicros(), payload);
+    }
+
+    // Caller holds mtx
+    void broadcast(const string& batch) {
+        if (batch.empty()) return;
+        for (const auto& replica : replicas) {
+            {
+                lock_guard<mutex> lock(replica->mtx);
+                if (replica->closed) continue;
+                if (replica->pending.size() + batch.size() > MAX_QUEUED_BYTES) {
+                    replica->closed = true;
+                    replica->pending.clear();
+                } else {
+                    replica->pending.append(batch);
+                }
+            }
+            replica->ready.notify_one();
+        }
+    }
+
+    void acceptLoop() {
+        while (!stopping) {
+            bool incoming = LocalSocket::waitReadable(listenFd, wakePipe[0], HEARTBEAT_MILLIS);
+            if (stopping) break;
+            if (incoming) {
+                int fd = LocalSocket::acceptFrom(listenFd);
+                if (fd >= 0) addReplica(fd);
+                continue;
+            }
+            // Quiet second: tell replicas the sequence is unchanged, and clear out any that left
+            vector<shared_ptr<Replica>> gone;
+            {
+                lock_guard<mutex> lock(mtx);
+                string heartbeat;
+                appendLine(heartbeat, 'H', lastSequence, nowMicros(), "");
+                broadcast(heartbeat);
+                auto isClosed = [](const shared_ptr<Replica>& r) {
+                    lock_guard<mutex> replicaLock(r->mtx);
+                    return r->closed;
+                };
+                auto split = stable_partition(replicas.begin(), replicas.end(),
+                                              [&](const shared_ptr<Replica>& r) { return !isClosed(r); });
+                gone.assign(split, replicas.end());
+                replicas.erase(split, replicas.end());
+            }
+            for (const auto& replica : gone) stopReplica(*replica);
+        }
+    }
+
+    // The full state goes out under the same lock as later changes, so nothing is missed or sent twice
+    void addReplica(int fd) {
+        auto replica = make_shared<Replica>();
+        replica->fd = fd;
+        lock_guard<mutex> lock(mtx);
+        replica->id = nextReplicaId++;
+        int64_t sentAt = nowMicros();
+        string& out = replica->pending;
+        appendLine(out, 'B', lastSequence, sentAt, "");
+        for (const auto& entry : lots) appendLine(out, 'I', lastSequence, sentAt, entry.second);
+        for (const auto& entry : prescriptions) appendLine(out, 'P', lastSequence, sentAt, "S," + entry.second);
+        appendLine(out, 'R', lastSequence, sentAt, "");
+        replica->ackedSequence = 0;
+        replica->sender = thread(&ReplicationPublisher::sendLoop, this, replica.get());
+        replicas.push_back(move(replica));
+    }
+
+    void stopReplica(Replica& replica) {
+        {
+            lock_guard<mutex> lock(replica.mtx);
+            replica.closed = true;
+        }
+        replica.ready.notify_all();
+        LocalSocket::shutdownSocket(replica.fd);
+        if (replica.sender.joinable()) replica.sender.join();
+        LocalSocket::closeFd(replica.fd);
+    }
+
+    void sendLoop(Replica* replica) {
+        string out;
+        string acks;
+        char buffer[512];
+        while (true) {
+            {
+                unique_lock<mutex> lock(replica->mtx);
+                replica->ready.wait_for(lock, chrono::milliseconds(200),
+                                        [replica] { return replica->closed || !replica->pending.empty(); });
+                if (replica->closed) break;
+                out.swap(replica->pending);
+            }
+            if (!out.empty() && !LocalSocket::sendAll(replica->fd, out)) break;
+            out.clear();
+
+            long got;
+            while ((got = LocalSocket::receive(replica->fd, buffer, sizeof(buffer))) > 0) {
+                acks.append(buffer, static_cast<size_t>(got));
+            }
+            if (got < 0) break;
+            size_t newline;
+            while ((newline = acks.find('\n')) != string::npos) {
+                string_view line(acks.data(), newline);
+                if (Utils::nextField(line) == "A") {
+                    string_view sequence = Utils::nextField(line);
+                    uint64_t acked = 0;
+                    int64_t lag = 0;
+                    from_chars(sequence.data(), sequence.data() + sequence.size(), acked);
+                    from_chars(line.data(), line.data() + line.size(), lag);
+                    lock_guard<mutex> lock(replica->mtx);
+                    if (acked >= replica->ackedSequence) {
+                        replica->ackedSequence = acked;
+                        replica->lagMicros = lag;
+                    }
+                }
+                acks.erase(0, newline + 1);
+            }
+        }
+        lock_guard<mutex> lock(replica->mtx);
+        replica->closed = true;
+    }
+};
+
+
+// Ordered feed of catalogue and prescription changes for downstream tools.
+// PharmacySystem emits a typed event at each mutation; events get the next
+// sequence number and are appended to changes.log, so a consumer can stop
+// and later resume from the last sequence it saw. changes.idx records the
+// offset of every INDEX_EVERY-th event, so resuming reads only the events
+// after the requested one, never the whole log.
+//
+// In-process consumers subscribe with a callback. Other programs connect to
+// changes.sock, send "<after>\n" and receive every later event as a line,
+// live events included. Socket consumers read straight from the log file at
+// their own pace, so one that is slow or far behind costs the store nothing.
+//
+// Lines are "<sequence>,<unix millis>,<type>,<key>,<payload>": the key is the
+// lot or prescription ID and the payload the record's data-file row, or for
+// stock.dispensed "<quantity>,<remaining>,<prescription ID>".
+class ChangeFeed {
+public:
+    enum class Type {
+        MedicineAdded,
+        MedicineUpdated,
+        MedicineDeleted,
+        StockDispensed,
+        PrescriptionAdded,
+        PrescriptionUpdated,
+        PrescriptionDeleted,
+        PrescriptionArchived
+    };
+
+    struct Event {
+        uint64_t sequence = 0;
+        int64_t timeMillis = 0;
+        Type type = Type::MedicineUpdated;
+        string key;
+        string payload;
+    };
+
+    using Listener = function<void(const Event&)>;
+
+    // Only the process holding changes.log.lock appends to the feed or repairs its
+    // tail; any other process opened on the same data root reads it and emits nothing
+    ChangeFeed(string logFile, string indexFile, string socketFile)
+        : logPath(move(logFile)), indexPath(move(indexFile)), socketPath(move(socketFile)), logSums(logPath) {
+        writer = acquireWriterLock();
+        loadIndex();
+        if (!writer) {
+            cerr << "Warning: another process owns " << logPath << "; this session's changes stay off the feed\n";
+            return;
+        }
+        listenFd = LocalSocket::listenAt(socketPath);
+        if (listenFd >= 0 && LocalSocket::openWakePipe(wakePipe)) {
+            acceptor = thread(&ChangeFeed::acceptLoop, this);
+        } else if (listenFd >= 0) {
+            LocalSocket::closeFd(listenFd);
+            listenFd = -1;
+        }
+    }
+
+    ~ChangeFeed() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        grew.notify_all();
+        LocalSocket::wake(wakePipe[1]);
+        if (acceptor.joinable()) acceptor.join();
+        for (auto& consumer : consumers) stopConsumer(*consumer);
+        if (listenFd >= 0) {
+            LocalSocket::closeFd(listenFd);
+            error_code ec;
+            filesystem::remove(socketPath, ec);
+        }
+        LocalSocket::closeFd(wakePipe[0]);
+        LocalSocket::closeFd(wakePipe[1]);
+        releaseWriterLock();
+    }
+
+    ChangeFeed(const ChangeFeed&) = delete;
+    ChangeFeed& operator=(const ChangeFeed&) = delete;
+
+    // Appends the event and hands it to every subscriber; returns its sequence number
+    uint64_t emit(Type type, string key, string payload) {
+        if (!writer) return 0;
+        Event event;
+        event.timeMillis = chrono::duration_cast<chrono::milliseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+        event.type = type;
+        event.key = move(key);
+        event.payload = move(payload);
+        {
+            lock_guard<mutex> lock(mtx);
+            event.sequence = ++lastSequence;
+            string line = encode(event);
+            ofstream log(logPath, ios::app | ios::binary);
+            if (!log.is_open()) {
+                lastSequence--;
+                return 0;
+            }
+            log.write(line.data(), static_cast<streamsize>(line.size()));
+            log.close();
+            logSums.append(line);
+            if (event.sequence % INDEX_EVERY == 1) {
+                index.emplace_back(event.sequence, committedBytes);
+                ofstream(indexPath, ios::app) << event.sequence << "," << committedBytes << "\n";
+            }
+            committedBytes += line.size();
+            // Listeners run under the lock, which is what keeps every subscriber in sequence order
+            for (const auto& listener : listeners) listener.second(event);
+        }
+        grew.notify_all();
+        return event.sequence;
+    }
+
+    // Replays the events after the given sequence, then delivers new ones as they are emitted.
+    // Listeners run on the emitting thread and must not emit or subscribe themselves.
+    int subscribe(uint64_t after, Listener listener) {
+        lock_guard<mutex> lock(mtx);
+        uint64_t offset = offsetAfter(after);
+        readRange(offset, committedBytes, [&](string_view line) {
+            Event event;
+            if (decode(line, event) && event.sequence > after) listener(event);
+        });
+        int id = nextListenerId++;
+        listeners.emplace_back(id, move(listener));
+        return id;
+    }
+
+    void unsubscribe(int id) {
+        lock_guard<mutex> lock(mtx);
+        listeners.erase(remove_if(listeners.begin(), listeners.end(),
+                                  [id](const pair<int, Listener>& l) { return l.first == id; }),
+                        listeners.end());
+    }
+
+    uint64_t sequence() {
+        lock_guard<mutex> lock(mtx);
+        return lastSequence;
+    }
+
+    bool listening() const { return listenFd >= 0; }
+    const string& path() const { return socketPath; }
+
+    size_t socketConsumers() {
+        lock_guard<mutex> lock(mtx);
+        size_t open = 0;
+        for (const auto& consumer : consumers) {
+            if (!consumer->closed) open++;
+        }
+        return open;
+    }
+
+    // Client side of changes.sock: prints every event after the given sequence as it arrives.
+    // Returns once the store closes the feed; 1 if no store is serving it.
+    static int follow(const string& socketPath, uint64_t after, ostream& out) {
+        int fd = LocalSocket::connectTo(socketPath);
+        if (fd < 0) return 1;
+        LocalSocket::sendAll(fd, to_string(after) + "\n");
+        vector<char> buffer(1 << 16);
+        while (true) {
+            if (!LocalSocket::waitReadable(fd, -1, 1000)) continue;
+            long got = LocalSocket::receive(fd, buffer.data(), buffer.size());
+            if (got < 0) break;
+            out.write(buffer.data(), got);
+            out.flush();
+        }
+        LocalSocket::closeFd(fd);
+        return 0;
+    }
+
+    static const char* typeName(Type type) {
+        switch (type) {
+            case Type::MedicineAdded: return "medicine.added";
+            case Type::MedicineUpdated: return "medicine.updated";
+            case Type::MedicineDeleted: return "medicine.deleted";
+            case Type::StockDispensed: return "stock.dispensed";
+            case Type::PrescriptionAdded: return "prescription.added";
+            case Type::PrescriptionUpdated: return "prescription.updated";
+            case Type::PrescriptionDeleted: return "prescription.deleted";
+            case Type::PrescriptionArchived: return "prescription.archived";
+        }
+        return "";
+    }
+
+    static string encode(const Event& event) {
+        string line;
+        line.reserve(48 + event.key.size() + event.payload.size());
+        line.append(to_string(event.sequence)).append(1, ',').append(to_string(event.timeMillis)).append(1, ',')
+            .append(typeName(event.type)).append(1, ',').append(event.key).append(1, ',')
+            .append(event.payload).append(1, '\n');
+        return line;
+    }
+
+    static bool decode(string_view line, Event& event) {
+        string_view sequence = Utils::nextField(line);
+        string_view millis = Utils::nextField(line);
+        string_view type = Utils::nextField(line);
+        auto [end, error] = from_chars(sequence.data(), sequence.data() + sequence.size(), event.sequence);
+        if (error != errc() || end != sequence.data() + sequence.size()) return false;
+        from_chars(millis.data(), millis.data() + millis.size(), event.timeMillis);
+        bool known = false;
+        for (int t = 0; t <= static_cast<int>(Type::PrescriptionArchived); t++) {
+            if (type == typeName(static_cast<Type>(t))) {
+                event.type = static_cast<Type>(t);
+                known = true;
+            }
+        }
+        event.key = string(Utils::nextField(line));
+        event.payload = string(line);
+        return known;
+    }
+
+private:
+    static constexpr uint64_t INDEX_EVERY = 256;
+    static constexpr size_t READ_CHUNK = 1 << 20;
+    static constexpr int REQUEST_TIMEOUT_MILLIS = 5000;
+
+    struct Consumer {
+        int fd = -1;
+        atomic<bool> closed{ false };
+        thread worker;
+    };
+
+    string logPath;
+    string indexPath;
+    string socketPath;
+    BlockChecksums logSums;
+    mutex mtx;  // Guards the log's end, the index and the subscriber lists
+    condition_variable grew;  // Signalled when events are appended, for socket consumers
+    uint64_t lastSequence = 0;
+    uint64_t committedBytes = 0;  // Log bytes holding complete events
+    vector<pair<uint64_t, uint64_t>> index;  // (sequence, offset) of every INDEX_EVERY-th event
+    vector<pair<int, Listener>> listeners;
+    int nextListenerId = 1;
+    bool stopping = false;
+    int listenFd = -1;
+    int wakePipe[2] = { -1, -1 };
+    thread acceptor;
+    vector<unique_ptr<Consumer>> consumers;
+    bool writer = false;
+    int lockFd = -1;
+
+    bool acquireWriterLock() {
+        string lockPath = logPath + ".lock";
+#ifdef _WIN32
+        // Denying other opens is the lock; it ends when the handle closes
+        return _sopen_s(&lockFd, lockPath.c_str(), _O_CREAT | _O_RDWR, _SH_DENYRW, _S_IREAD | _S_IWRITE) == 0;
+#else
+        lockFd = open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (lockFd < 0) return false;
+        struct flock lock {};
+        lock.l_type = F_WRLCK;
+        lock.l_whence = SEEK_SET;
+        if (fcntl(lockFd, F_SETLK, &lock) == 0) return true;
+        close(lockFd);
+        lockFd = -1;
+        return false;
+#endif
+    }
+
+    void releaseWriterLock() {
+        if (lockFd < 0) return;
+#ifdef _WIN32
+        _close(lockFd);
+#else
+        close(lockFd);  // Drops the fcntl lock with it
+#endif
+        lockFd = -1;
+    }
+
+    // Reads the sparse index, then only the events after its last entry to find the end of the log
+    void loadIndex() {
+        ifstream indexFile(indexPath);
+        string line;
+        while (getline(indexFile, line)) {
+            string_view rest(line);
+            string_view sequence = Utils::nextField(rest);
+            uint64_t seq = 0, offset = 0;
+            from_chars(sequence.data(), sequence.data() + sequence.size(), seq);
+            from_chars(rest.data(), rest.data() + rest.size(), offset);
+            if (seq > 0 && (index.empty() || seq > index.back().first)) index.emplace_back(seq, offset);
+        }
+        error_code ec;
+        uint64_t size = filesystem::exists(logPath, ec) ? filesystem::file_size(logPath, ec) : 0;
+        while (!index.empty() && index.back().second >= size) index.pop_back();
+
+        uint64_t offset = index.empty() ? 0 : index.back().second;
+        uint64_t end = offset;
+        readRange(offset, size, [&](string_view event) {
+            end += event.size() + 1;
+            Event decoded;
+            if (decode(event, decoded)) lastSequence = max(lastSequence, decoded.sequence);
+        });
+        // A line cut short by a crash would run into the next event; drop it. A reader
+        // leaves it, since it may be a line the writer is still appending.
+        if (end < size && writer) filesystem::resize_file(logPath, end, ec);
+        committedBytes = end;
+    }
+
+    // Offset to start reading from to see every event after the given sequence. Caller holds mtx.
+    uint64_t offsetAfter(uint64_t after) const {
+        auto next = upper_bound(index.begin(), index.end(), after + 1,
+                                [](uint64_t seq, const pair<uint64_t, uint64_t>& entry) { return seq < entry.first; });
+        return next == index.begin() ? 0 : prev(next)->second;
+    }
+
+    // Visits the complete lines in [from, to) of the log, without their newlines
+    void readRange(uint64_t from, uint64_t to, const function<void(string_view)>& visit) const {
+        if (from >= to) return;
+        ifstream in(logPath, ios::binary);
+        in.seekg(static_cast<streamoff>(from));
+        string carry;
+        vector<char> chunk(READ_CHUNK);
+        uint64_t remaining = to - from;
+        while (remaining > 0 && in) {
+            size_t want = static_cast<size_t>(min<uint64_t>(chunk.size(), remaining));
+            in.read(chunk.data(), static_cast<streamsize>(want));
+            size_t got = static_cast<size_t>(in.gcount());
+            if (got == 0) break;
+            remaining -= got;
+            carry.append(chunk.data(), got);
+            size_t start = 0, newline;
+            while ((newline = carry.find('\n', start)) != string::npos) {
+                visit(string_view(carry).substr(start, newline - start));
+                start = newline + 1;
+            }
+            carry.erase(0, start);
+        }
+    }
+
+    void acceptLoop() {
+        while (true) {
+            bool incoming = LocalSocket::waitReadable(listenFd, wakePipe[0], 1000);
+            {
+                lock_guard<mutex> lock(mtx);
+                if (stopping) return;
+            }
+            if (incoming) {
+                int fd = LocalSocket::acceptFrom(listenFd);
+                if (fd < 0) continue;
+                auto consumer = make_unique<Consumer>();
+                consumer->fd = fd;
+                consumer->worker = thread(&ChangeFeed::serve, this, consumer.get());
+                lock_guard<mutex> lock(mtx);
+                consumers.push_back(move(consumer));
+                continue;
+            }
+            // Quiet second: clear out consumers that have gone
+            vector<unique_ptr<Consumer>> gone;
+            {
+                lock_guard<mutex> lock(mtx);
+                auto split = stable_partition(consumers.begin(), consumers.end(),
+                                              [](const unique_ptr<Consumer>& c) { return !c->closed; });
+                move(split, consumers.end(), back_inserter(gone));
+                consumers.erase(split, consumers.end());
+            }
+            for (auto& consumer : gone) stopConsumer(*consumer);
+        }
+    }
+
+    void stopConsumer(Consumer& consumer) {
+        consumer.closed = true;
+        grew.notify_all();
+        LocalSocket::shutdownSocket(consumer.fd);
+        if (consumer.worker.joinable()) consumer.worker.join();
+        LocalSocket::closeFd(consumer.fd);
+    }
+
+    // One thread per socket consumer: reads its resume point, then follows the log file
+    void serve(Consumer* consumer) {
+        string request;
+        char buffer[64];
+        auto deadline = chrono::steady_clock::now() + chrono::milliseconds(REQUEST_TIMEOUT_MILLIS);
+        while (request.find('\n') == string::npos && !consumer->closed) {
+            if (chrono::steady_clock::now() > deadline) break;
+            if (!LocalSocket::waitReadable(consumer->fd, -1, 200)) continue;
+            long got = LocalSocket::receive(consumer->fd, buffer, sizeof(buffer));
+            if (got < 0 || request.size() > 32) break;
+            request.append(buffer, static_cast<size_t>(got));
+        }
+        uint64_t after = 0;
+        auto [end, error] = from_chars(request.data(), request.data() + request.size(), after);
+        if (request.find('\n') == string::npos || error != errc() || (*end != '\n' && *end != '\r')) {
+            LocalSocket::sendAll(consumer->fd, "ERROR expected \"<sequence>\\n\"\n");
+            consumer->closed = true;
+            return;
+        }
+
+        uint64_t offset;
+        {
+            lock_guard<mutex> lock(mtx);
+            offset = offsetAfter(after);
+        }
+        string out;
+        while (!consumer->closed) {
+            uint64_t until;
+            {
+                unique_lock<mutex> lock(mtx);
+                grew.wait_for(lock, chrono::seconds(1),
+                              [&] { return stopping || consumer->closed || committedBytes > offset; });
+                if (stopping) break;
+                until = committedBytes;
+            }
+            if (until <= offset) {
+                // Nothing new: make sure the consumer is still there
+                if (LocalSocket::receive(consumer->fd, buffer, sizeof(buffer)) < 0) break;
+                continue;
+            }
+            out.clear();
+            bool sent = true;
+            readRange(offset, until, [&](string_view line) {
+                uint64_t sequence = 0;
+                from_chars(line.data(), line.data() + line.size(), sequence);
+                if (sequence <= after) return;
+                out.append(line).append(1, '\n');
+                if (out.size() >= READ_CHUNK) {
+                    sent = sent && LocalSocket::sendAll(consumer->fd, out);
+                    out.clear();
+                }
+            });
+            if (!sent || !LocalSocket::sendAll(consumer->fd, out)) break;
+            offset = until;
+        }
+        consumer->closed = true;
+    }
+};
+
+// Offline check of a data root behind --verify and --repair. Every data and
+// log file with checksums is verified in one parallel pass. Damaged rows of
+// medicines.txt can be rebuilt from the inventory history, which holds the
+// last state of every lot; other files have no second copy, so their damage
+// is reported for restoring from a backup. Rows that are dropped are kept
+// in "<file>.rejected".
+class IntegrityCheck {
+public:
+    explicit IntegrityCheck(string root) : dataRoot(move(root)) {}
+
+    // Returns the process exit code: 0 when no damage is left
+    int run(ostream& out, bool repair) {
+        vector<string> files = protectedFiles();
+        auto start = chrono::steady_clock::now();
+        vector<BlockChecksums::Report> reports = BlockChecksums::verifyAll(files);
+        double millis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        using Align = TableRenderer::Align;
+        TableRenderer table({ { "File", 40 }, { "Size", 12, Align::Right }, { "Blocks", 8, Align::Right },
+                              { "Status", 24 } });
+        uint64_t bytes = 0;
+        for (const auto& report : reports) {
+            string status = BlockChecksums::stateName(report.state);
+            if (report.uncheckedBytes > 0) status += " +" + to_string(report.uncheckedBytes) + " B unchecked";
+            table.text(displayName(report.path)).integer(static_cast<int64_t>(report.size))
+                .integer(static_cast<int64_t>(report.blocks)).text(status);
+            table.endRow();
+            if (report.state == BlockChecksums::State::Intact || report.state == BlockChecksums::State::Damaged) {
+                bytes += report.size - report.uncheckedBytes;
+            }
+        }
+        table.flushTo(out);
+        out << "Verified " << bytes << " bytes in " << fixed << setprecision(2) << millis << " ms.\n";
+
+        size_t damagedFiles = 0;
+        for (const auto& report : reports) {
+            string name = displayName(report.path);
+            // Line numbers only mean something in the text files
+            bool text = name.size() > 4 && (name.compare(name.size() - 4, 4, ".txt") == 0 ||
+                                            name.compare(name.size() - 4, 4, ".log") == 0);
+            for (const auto& damage : report.damaged) {
+                out << name << ": block " << damage.block << " (bytes " << damage.offset << "-"
+                    << damage.offset + damage.length - 1;
+                if (text) out << ", lines " << damage.firstLine << "-" << damage.lastLine;
+                out << ") fails its checksum\n";
+            }
+            if (report.state == BlockChecksums::State::Damaged) {
+                if (repair && name == "medicines.txt" && repairMedicines(report, out)) continue;
+                if (repair) out << name << ": no second copy to repair from; restore it from a backup\n";
+                damagedFiles++;
+            } else if (repair && (report.uncheckedBytes > 0 || report.state == BlockChecksums::State::Unprotected)) {
+                BlockChecksums::seal(report.path);
+                out << name << ": checksums now cover the whole file\n";
+            }
+        }
+        if (damagedFiles > 0) {
+            out << damagedFiles << " file(s) damaged" << (repair ? "." : "; run with --repair to fix what can be.")
+                << "\n";
+        }
+        return damagedFiles == 0 ? 0 : 1;
+    }
+
+private:
+    string dataRoot;
+
+    string displayName(const string& path) const {
+        error_code ec;
+        string relative = filesystem::relative(path, dataRoot.empty() ? "." : dataRoot, ec).generic_string();
+        return ec || relative.empty() ? path : relative;
+    }
+
+    vector<string> protectedFiles() const {
+        vector<string> files;
+        for (const char* name : { "medicines.txt", "prescriptions.txt", "fulfilments.txt",
+                                  "prescriptions_archive.dat", "transaction_log.dat", "changes.log", "users.txt" }) {
+            files.push_back(Utils::dataPath(dataRoot, name));
+        }
+        for (const char* directory : { "logs", "inventory_history" }) {
+            vector<string> found;
+            error_code ec;
+            for (const auto& entry : filesystem::directory_iterator(Utils::dataPath(dataRoot, directory), ec)) {
+                string name = entry.path().filename().string();
+                bool logFile = name.rfind("segment-", 0) == 0 || name.rfind("checkpoint-", 0) == 0 ||
+                               name == "deltas.log";
+                bool sideFile = name.find(".sums") != string::npos || name.find(".tmp") != string::npos;
+                if (logFile && !sideFile) found.push_back(entry.path().string());
+            }
+            sort(found.begin(), found.end());
+            files.insert(files.end(), found.begin(), found.end());
+        }
+        // Files a store has not created yet are left out
+        files.erase(remove_if(files.begin(), files.end(),
+                              [](const string& path) {
+                                  error_code ec;
+                                  return !filesystem::exists(path, ec);
+                              }),
+                    files.end());
+        return files;
+    }
+
+    // Drops the rows in damaged blocks and brings back, from the inventory history,
+    // every lot no intact row still holds
+    bool repairMedicines(const BlockChecksums::Report& report, ostream& out) {
+        InventoryHistory history(Utils::dataPath(dataRoot, "inventory_history"));
+        const InventoryHistory::State& latest = history.latest();
+        if (latest.empty()) return false;
+
+        ifstream in(report.path);
+        string kept, rejected, line;
+        unordered_set<int> present;
+        uint64_t lineNumber = 0;
+        size_t dropped = 0, restored = 0;
+        while (getline(in, line)) {
+            lineNumber++;
+            bool damaged = any_of(report.damaged.begin(), report.damaged.end(), [lineNumber](const auto& d) {
+                return lineNumber >= d.firstLine && lineNumber <= d.lastLine;
+            });
+            if (damaged) {
+                rejected.append(line).append(1, '\n');
+                dropped++;
+                continue;
+            }
+            try {
+                present.insert(Medicine::fromFileString(line)->getId());
+            } catch (const exception&) {
+                // An unreadable row in an intact block was written that way; the loader deals with it
+            }
+            kept.append(line).append(1, '\n');
+        }
+        in.close();
+        for (const auto& [id, lot] : latest) {
+            if (present.count(id)) continue;
+            try {
+                kept.append(Medicine(lot.name, lot.quantity, lot.expiryDate, lot.priceCents, id).toFileString())
+                    .append(1, '\n');
+                restored++;
+            } catch (const exception&) {
+                out << "medicines.txt: lot " << id << " in the inventory history is unreadable\n";
+            }
+        }
+
+        ofstream(report.path + ".rejected", ios::app) << rejected;
+        {
+            ofstream file(report.path + ".tmp", ios::binary | ios::trunc);
+            if (!file.is_open()) return false;
+            file.write(kept.data(), static_cast<streamsize>(kept.size()));
+        }
+        error_code ec;
+        filesystem::rename(report.path + ".tmp", report.path, ec);
+        if (ec) return false;
+        BlockChecksums::seal(report.path, kept);
+        out << "medicines.txt: set aside " << dropped << " row(s) in medicines.txt.rejected and restored "
+            << restored << " lot(s) from the inventory history\n";
+        return true;
+    }
+};
+
+// Roles are bits, so one account can hold several
+enum class Role : uint8_t {
+    Pharmacist = 1 << 0,
+    Admin = 1 << 1
+};
+
+using Roles = uint8_t;
+
+inline bool hasRole(Roles roles, Role role) {
+    return (roles & static_cast<Roles>(role)) != 0;
+}
+
+struct UserAccount {
+    string name;
+    Roles roles = 0;
+    uint32_t iterations = 0;
+    string salt;  // Hex
+    string hash;  // Hex PBKDF2 output
+    bool passwordExpired = false;  // Stored as "expired" among the roles; set on seeded accounts
+
+    static string roleNames(Roles roles) {
+        string names;
+        if (hasRole(roles, Role::Admin)) names = "admin";
+        if (hasRole(roles, Role::Pharmacist)) names += names.empty() ? "pharmacist" : "|pharmacist";
+        return names;
+    }
+
+    // "admin", "pharmacist" or both joined by '|'; 0 if none is recognised
+    static Roles parseRoles(string_view text) {
+        Roles roles = 0;
+        while (!text.empty()) {
+            size_t bar = text.find('|');
+            string_view name = Utils::trimView(text.substr(0, bar));
+            if (Utils::equalsIgnoreCase(name, "admin")) roles |= static_cast<Roles>(Role::Admin);
+            else if (Utils::equalsIgnoreCase(name, "pharmacist")) roles |= static_cast<Roles>(Role::Pharmacist);
+            text.remove_prefix(bar == string_view::npos ? text.size() : bar + 1);
+        }
+        return roles;
+    }
+
+    // "name,roles,iterations,salt,hash"
+    string toFileString() const {
+        return name + "," + roleNames(roles) + (passwordExpired ? "|expired," : ",") + to_string(iterations) + "," +
+               salt + "," + hash;
+    }
+
+    static bool fromFileString(string_view line, UserAccount& account) {
+        account.name = string(Utils::nextField(line));
+        string_view roleText = Utils::nextField(line);
+        account.roles = parseRoles(roleText);
+        account.passwordExpired = false;
+        while (!roleText.empty()) {
+            size_t bar = roleText.find('|');
+            if (Utils::equalsIgnoreCase(Utils::trimView(roleText.substr(0, bar)), "expired")) account.passwordExpired = true;
+            roleText.remove_prefix(bar == string_view::npos ? roleText.size() : bar + 1);
+        }
+        string_view iterations = Utils::nextField(line);
+        account.iterations = 0;
+        from_chars(iterations.data(), iterations.data() + iterations.size(), account.iterations);
+        account.salt = string(Utils::nextField(line));
+        account.hash = string(line);
+        return !account.name.empty() && account.roles != 0 && account.iterations > 0 && !account.hash.empty();
+    }
+};
+
+// Where accounts and their credentials live
+class IUserStore {
+public:
+    virtual ~IUserStore() = default;
+    // Checks the password and returns the account's roles, or 0 if either is wrong
+    virtual Roles authenticate(const string& name, const string& password) = 0;
+    virtual vector<UserAccount> accounts() = 0;
+    // True while the account still has a password it was given rather than chose
+    virtual bool passwordExpired(const string& name) = 0;
+    virtual bool addUser(const string& name, const string& password, Roles roles) = 0;
+    virtual bool setPassword(const string& name, const string& password) = 0;
+    virtual bool removeUser(const string& name) = 0;
+};
+
+// Accounts in users.txt beside the other data files, one salted PBKDF2 hash
+// each. Only a first install, with neither the file nor its checksums, gets
+// the two starter accounts, and their passwords must be changed at first
+// login; a file that has gone missing later is reported, never recreated.
+// Hashes made with fewer iterations than the current setting are upgraded
+// the next time their user logs in. The file is read again whenever its
+// modification time changes, so a replica sees accounts added on the primary.
+class FileUserStore : public IUserStore {
+public:
+    static constexpr uint32_t HASH_ITERATIONS = 100000;
+
+    // A read-only store, as used by replicas, neither creates nor rewrites the file
+    FileUserStore(string filePath, bool openReadOnly = false) : path(move(filePath)), readOnly(openReadOnly) {
+        error_code ec;
+        bool found = load();
+        if (!found && !readOnly && !filesystem::exists(BlockChecksums::sumsPathOf(path), ec)) {
+            users["admin"] = makeAccount("admin", "admin123", static_cast<Roles>(Role::Admin));
+            users["pharmacist"] = makeAccount("pharmacist", "pharma123", static_cast<Roles>(Role::Pharmacist));
+            for (auto& entry : users) entry.second.passwordExpired = true;
+            save();
+        } else if (users.empty()) {
+            cerr << "Warning: " << path << (found ? " holds no usable accounts" : " is missing")
+                 << "; nobody can log in until it is fixed\n";
+        }
+    }
+
+    Roles authenticate(const string& name, const string& password) override {
+        lock_guard<mutex> lock(mtx);
+        reloadIfChanged();
+        auto it = users.find(name);
+        if (it == users.end()) {
+            // Hash anyway so an unknown name takes as long to reject as a wrong password
+            PasswordHash::pbkdf2(password, "unknown-user", HASH_ITERATIONS);
+            return 0;
+        }
+        UserAccount& account = it->second;
+        if (!PasswordHash::sameHash(hashOf(password, account.salt, account.iterations), account.hash)) return 0;
+        if (account.iterations < HASH_ITERATIONS && !readOnly) {
+            bool expired = account.passwordExpired;
+            account = makeAccount(account.name, password, account.roles);
+            account.passwordExpired = expired;
+            save();
+        }
+        return account.roles;
+    }
+
+    bool passwordExpired(const string& name) override {
+        lock_guard<mutex> lock(mtx);
+        auto it = users.find(name);
+        return it != users.end() && it->second.passwordExpired;
+    }
+
+    vector<UserAccount> accounts() override {
+        lock_guard<mutex> lock(mtx);
+        reloadIfChanged();
+        vector<UserAccount> result;
+        result.reserve(users.size());
+        for (const auto& entry : users) result.push_back(entry.second);
+        return result;
+    }
+
+    bool addUser(const string& name, const string& password, Roles roles) override {
+        if (readOnly || !validName(name) || roles == 0) return false;
+        lock_guard<mutex> lock(mtx);
+        reloadIfChanged();
+        if (users.count(name)) return false;
+        users[name] = makeAccount(name, password, roles);
+        return save();
+    }
+
+    bool setPassword(const string& name, const string& password) override {
+        if (readOnly) return false;
+        lock_guard<mutex> lock(mtx);
+        reloadIfChanged();
+        auto it = users.find(name);
+        if (it == users.end()) return false;
+        it->second = makeAccount(name, password, it->second.roles);
+        return save();
+    }
+
+    bool removeUser(const string& name) override {
+        if (readOnly) return false;
+        lock_guard<mutex> lock(mtx);
+        reloadIfChanged();
+        if (users.erase(name) == 0) return false;
+        return save();
+    }
+
+    static bool validName(const string& name) {
+        return !name.empty() && name.find_first_of(",|\r\n") == string::npos && Utils::trimView(name) == name;
+    }
+
+private:
+    string path;
+    bool readOnly;
+    mutex mtx;
+    map<string, UserAccount> users;  // Sorted, so the file and listings keep a stable order
+    pair<filesystem::file_time_type, uintmax_t> stamp;  // Modification time and size when last read or written
+
+    static pair<filesystem::file_time_type, uintmax_t> stampOf(const string& filePath) {
+        error_code ec;
+        auto time = filesystem::last_write_time(filePath, ec);
+        if (ec) return {};
+        uintmax_t size = filesystem::file_size(filePath, ec);
+        return { time, ec ? 0 : size };
+    }
+
+    // Replaces the accounts with the file's; false if it cannot be opened
+    bool load() {
+        ifstream file(path);
+        if (!file.is_open()) return false;
+        stamp = stampOf(path);
+        users.clear();
+        string line;
+        int lineNumber = 0;
+        UserAccount account;
+        while (getline(file, line)) {
+            lineNumber++;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (Utils::trimView(line).empty()) continue;
+            if (UserAccount::fromFileString(line, account)) users[account.name] = account;
+            else cerr << "Warning: " << path << " line " << lineNumber << " is not a valid account\n";
+        }
+        return true;
+    }
+
+    // Caller holds mtx. Picks up accounts another process changed; a file
+    // that has since vanished leaves the accounts already read in place
+    void reloadIfChanged() {
+        auto now = stampOf(path);
+        if (now != pair<filesystem::file_time_type, uintmax_t>{} && now != stamp) load();
+    }
+
+    static string hashOf(const string& password, const string& salt, uint32_t iterations) {
+        PasswordHash::Digest digest = PasswordHash::pbkdf2(password, salt, iterations);
+        return PasswordHash::toHex(digest.data(), digest.size());
+    }
+
+    static UserAccount makeAccount(const string& name, const string& password, Roles roles) {
+        UserAccount account;
+        account.name = name;
+        account.roles = roles;
+        account.iterations = HASH_ITERATIONS;
+        account.salt = PasswordHash::randomHex(16);
+        account.hash = hashOf(password, account.salt, account.iterations);
+        return account;
+    }
+
+    // Caller holds mtx
+    bool save() {
+        string content;
+        for (const auto& entry : users) content.append(entry.second.toFileString()).append(1, '\n');
+        {
+            ofstream file(path + ".tmp", ios::binary | ios::trunc);
+            if (!file.is_open()) return false;
+            file << content;
+        }
+        error_code ec;
+        filesystem::rename(path + ".tmp", path, ec);
+        if (ec) return false;
+        stamp = stampOf(path);
+        BlockChecksums::seal(path, content);
+        return true;
+    }
+};
+
+// Logged-in sessions by token. Logging in pays for the slow password hash
+// once; after that each request is checked with one hash-map lookup. A
+// session unused for IDLE_TIMEOUT expires.
+class SessionCache {
+public:
+    struct Session {
+        string user;
+        Roles roles = 0;
+        chrono::steady_clock::time_point lastUsed;
+    };
+
+    static constexpr chrono::minutes IDLE_TIMEOUT{ 30 };
+
+    string issue(const string& user, Roles roles) {
+        lock_guard<mutex> lock(mtx);
+        string token = PasswordHash::randomHex(16);
+        sessions[token] = Session{ user, roles, chrono::steady_clock::now() };
+        return token;
+    }
+
+    // Copies out and refreshes the token's session; false once it has expired or been revoked
+    bool validate(const string& token, Session& session) {
+        lock_guard<mutex> lock(mtx);
+        auto it = sessions.find(token);
+        if (it == sessions.end()) return false;
+        auto now = chrono::steady_clock::now();
+        if (now - it->second.lastUsed > IDLE_TIMEOUT) {
+            sessions.erase(it);
+            return false;
+        }
+        it->second.lastUsed = now;
+        session = it->second;
+        return true;
+    }
+
+    void revoke(const string& token) {
+        lock_guard<mutex> lock(mtx);
+        sessions.erase(token);
+    }
+
+    // Ends a user's other sessions, e.g. after their password changes
+    void revokeUser(const string& user, const string& keepToken = "") {
+        lock_guard<mutex> lock(mtx);
+        for (auto it = sessions.begin(); it != sessions.end();) {
+            if (it->second.user == user && it->first != keepToken) it = sessions.erase(it);
+            else ++it;
+        }
+    }
+
+private:
+    mutex mtx;
+    unordered_map<string, Session> sessions;
+};
+
+// Pharmacy System interface
+class IPharmacySystem {
+public:
+    virtual ~IPharmacySystem() = default;
+    virtual void run() = 0;
+};
+
+// Concrete Pharmacy System implementation
+class PharmacySystem : public IPharmacySystem {
+    friend class PharmacyBench;  // bench/allocation_bench.cpp
+    friend class PharmacyTests;  // tests/finalproject_tests.cpp
+
+private:
+    vector<unique_ptr<IMedicine>> medicines;
+    vector<unique_ptr<IPrescription>> prescriptions;
+    LotIndex lots;
+    string dataRoot;  // Directory holding this store's data files
+    FileLogger* logger;
+    string currentUser;
+    unique_ptr<IUserStore> users;
+    SessionCache sessions;
+    string sessionToken;  // The logged-in user's session; empty when nobody is logged in
+    PaymentPipeline payments;
+    StockReservations reservations;
+    unordered_map<string, BillingReceipt> fulfilments;  // Keyed by prescription ID
+    BlockChecksums fulfilmentSums;  // fulfilments.txt only grows, so its sums are extended per bill
+    unordered_set<string> damagedFiles;  // Keep their old sums, so the damage shows until --repair runs
+    unordered_set<string> billingInFlight;
+    InventoryVersions inventory;  // Published after every catalogue change
+    MedicineSearchIndex searchIndex;  // Rebuilt lazily when the inventory version moves
+    SalesAnalytics analytics;
+    DemandForecaster forecaster;
+    PatientHistoryIndex patientHistory;  // Follows every prescription add and delete
+    unordered_map<string, size_t> prescriptionSlots;  // ID to position in prescriptions; rebuilt when found stale
+    PrescriptionArchive archive;  // Billed and long-idle prescriptions, read on demand
+    unordered_map<int, string> medicinesOnDisk;  // Each lot's row as last read from or written to medicines.txt
+    FileWatcher medicinesWatcher;  // Notices other programs editing medicines.txt
+    pair<filesystem::file_time_type, uintmax_t> medicinesStamp;  // Time and size as last read or written here
+    InventoryHistory history;  // Every published inventory, for as-of queries
+    ChangeFeed changes;  // Sequence-numbered events for downstream tools
+    TaskScheduler::TaskId reportRefresh = 0;  // Pending background rewrite of the compliance report
+    mutex reportMutex;  // Serialises writers and readers of compliance_report.txt
+    atomic<uint64_t> reportVersion{ 0 };  // Inventory version the report file was written from
+    atomic<int64_t> reportWrittenAt{ 0 };
+    InteractionTable interactions;
+    unique_ptr<ReplicationPublisher> replication;  // Feeds read-only replicas; created once the data is loaded
+    int analyticsListener = 0;
+
+    static constexpr chrono::milliseconds RESERVATION_TIMEOUT{ 30000 };
+    static constexpr size_t REPORT_FLUSH_BYTES = 1 << 16;  // Report tables stream out in chunks this size
+    static constexpr int32_t RECENT_MEDICATION_DAYS = 90;  // Window checked for drug interactions
+    static constexpr int32_t ARCHIVE_AFTER_DAYS = 365;  // Unbilled prescriptions older than this go cold
+    static constexpr chrono::milliseconds RESERVATION_SWEEP{ 1000 };
+    static constexpr chrono::milliseconds REPORT_REFRESH_DELAY{ 2000 };  // Lets a burst of edits settle first
+    static constexpr chrono::minutes REPORT_REFRESH_PERIOD{ 15 };
+    static constexpr int64_t REPORT_REUSE_SECONDS = 60;  // A report this fresh is shown without rewriting it
+
+    // Units of a product across all its lots that are not held by an in-flight payment
+    int availableQuantity(string_view medicineName) {
+        return lots.totalQuantity(medicineName) - reservations.held(Utils::toLower(medicineName));
+    }
+
+    string dataFile(const string& fileName) const {
+        return Utils::dataPath(dataRoot, fileName);
+    }
+
+    // Lot ID from the last column of a medicines.txt row, or -1 for rows written before IDs
+    static int lotIdOf(string_view row) {
+        size_t comma = row.rfind(',');
+        if (comma == string_view::npos || count(row.begin(), row.end(), ',') < 4) return -1;
+        string_view field = Utils::trimView(row.substr(comma + 1));
+        int id = -1;
+        auto [end, error] = from_chars(field.data(), field.data() + field.size(), id);
+        return error == errc() && end == field.data() + field.size() ? id : -1;
+    }
+
+    // Costs a stat per file unless one changed since this program last wrote it; then its
+    // blocks are checked, so damage is reported before the loaders run into it. Returns the
+    // changed files that passed, whose sums may be brought up to date once they are loaded.
+    vector<string> verifyDataFiles() {
+        vector<string> changed;
+        for (const char* name : { "medicines.txt", "prescriptions.txt", "fulfilments.txt" }) {
+            string path = dataFile(name);
+            error_code ec;
+            if (filesystem::exists(path, ec) && !BlockChecksums::unchanged(path)) changed.push_back(path);
+        }
+        if (changed.empty()) return changed;
+        vector<string> intact;
+        for (const auto& report : BlockChecksums::verifyAll(changed)) {
+            for (const auto& damage : report.damaged) {
+                cerr << "Warning: lines " << damage.firstLine << "-" << damage.lastLine << " of " << report.path
+                     << " do not match their checksum; the file was damaged or edited while closed\n";
+            }
+            if (report.damaged.empty()) {
+                intact.push_back(report.path);
+            } else {
+                damagedFiles.insert(report.path);
+                cerr << "Warning: " << report.path << " keeps its old checksums until --repair is run\n";
+            }
+        }
+        return intact;
+    }
+
+    // Rewrites the sums of a data file this program just wrote, unless it was found damaged
+    void sealDataFile(const string& path, string_view content) {
+        if (!damagedFiles.count(path)) BlockChecksums::seal(path, content);
+    }
+
+    // Rows that cannot be read are kept aside in "<file>.rejected" rather than lost
+    void setAside(const string& fileName, const string& rows) {
+        ofstream file(dataFile(fileName + ".rejected"), ios::app);
+        file << rows;
+    }
+
+    void loadMedicines() {
+        medicines.clear();
+        medicinesStamp = fileStamp(dataFile("medicines.txt"));
+        bool missingIds = false;
+        string rejected;
+        ifstream file(dataFile("medicines.txt"));
+        if (file.is_open()) {
+            string line;
+            int lineNumber = 0;
+            while (getline(file, line)) {
+                lineNumber++;
+                if (Utils::trimView(line).empty()) continue;
+                missingIds = missingIds || lotIdOf(line) < 0;
+                try {
+                    medicines.push_back(Medicine::fromFileString(line));
+                } catch (const exception& e) {
+                    rejected.append(line).append(1, '\n');
+                    cerr << "Warning: medicines.txt line " << lineNumber << " is unreadable (" << e.what() << ")";
+                    // The inventory history holds the lot as it was last saved
+                    int id = lotIdOf(line);
+                    auto saved = history.latest().find(id);
+                    if (saved != history.latest().end()) {
+                        const InventoryHistory::Lot& lot = saved->second;
+                        medicines.push_back(make_unique<Medicine>(lot.name, lot.quantity, lot.expiryDate,
+                                                                  lot.priceCents, lot.id));
+                        cerr << "; lot " << id << " restored from the inventory history";
+                    }
+                    cerr << "\n";
+                }
+            }
+            file.close();
+        }
+        lots.rebuild(medicines);
+        if (!rejected.empty()) setAside("medicines.txt", rejected);
+        // Rows are matched to lots by ID when the file changes, so every row needs one on disk
+        if (missingIds || !rejected.empty()) {
+            writeMedicinesFile();
+        } else {
+            medicinesOnDisk.clear();
+            for (const auto& med : medicines) medicinesOnDisk[med->getId()] = med->toFileString();
+        }
+        publishInventory();
+    }
+
+    // Every catalogue change is published through here, so the history sees all of them.
+    // Callers that know which lots they touched name them; otherwise every lot is compared.
+    void publishInventory(const vector<const IMedicine*>* changed = nullptr, const vector<int>& removed = {}) {
+        inventory.publish(medicines);
+        string deltaLines;
+        if (changed) {
+            vector<InventoryHistory::Lot> changedLots;
+            changedLots.reserve(changed->size());
+            for (const IMedicine* med : *changed) {
+                changedLots.push_back({ med->getId(), med->getName(), med->getQuantity(), med->getExpiryDate(),
+                                        med->getPriceCents() });
+            }
+            deltaLines = history.record(changedLots, removed, time(nullptr));
+        } else {
+            deltaLines = history.recordAll(*inventory.acquire(), time(nullptr));
+        }
+        if (replication) replication->publishLots(deltaLines);
+    }
+
+    // Feed events go out once the change they describe has been saved
+    void emitLot(ChangeFeed::Type type, const IMedicine& lot) {
+        changes.emit(type, to_string(lot.getId()), lot.toFileString());
+    }
+
+    void emitPrescription(ChangeFeed::Type type, const IPrescription& pres) {
+        changes.emit(type, pres.getId(), pres.toFileString());
+    }
+
+    // Edits made to medicines.txt elsewhere are merged first, so saving never overwrites them
+    void saveMedicines(const vector<const IMedicine*>& changed, const vector<int>& removed = {}) {
+        bool merged = medicinesChangedElsewhere() && mergeExternalMedicines();
+        writeMedicinesFile();
+        if (merged) publishInventory();
+        else publishInventory(&changed, removed);
+        scheduleReportRefresh();
+    }
+
+    // Through a temporary file, so a reader or a crash never sees half a catalogue
+    void writeMedicinesFile() {
+        string path = dataFile("medicines.txt");
+        medicinesOnDisk.clear();
+        string content;
+        for (const auto& med : medicines) {
+            string row = med->toFileString();
+            content.append(row).append(1, '\n');
+            medicinesOnDisk[med->getId()] = move(row);
+        }
+        {
+            ofstream file(path + ".tmp", ios::binary | ios::trunc);
+            if (!file.is_open()) return;
+            file << content;
+        }
+        error_code ec;
+        filesystem::rename(path + ".tmp", path, ec);
+        if (ec) return;
+        medicinesStamp = fileStamp(path);
+        sealDataFile(path, content);
+    }
+
+    static pair<filesystem::file_time_type, uintmax_t> fileStamp(const string& path) {
+        error_code ec;
+        auto modified = filesystem::last_write_time(path, ec);
+        if (ec) return {};
+        uintmax_t size = filesystem::file_size(path, ec);
+        return { modified, ec ? 0 : size };
+    }
+
+    // The watcher also fires on this process's own writes; those leave the stamp as recorded
+    bool medicinesChangedElsewhere() {
+        medicinesWatcher.consumeChange();
+        return fileStamp(dataFile("medicines.txt")) != medicinesStamp;
+    }
+
+    // Picks up changes another program made to medicines.txt, if the watcher saw any
+    void syncExternalChanges() {
+        if (!medicinesWatcher.consumeChange()) return;
+        if (fileStamp(dataFile("medicines.txt")) == medicinesStamp) return;
+        if (mergeExternalMedicines()) publishInventory();
+    }
+
+    // Diffs medicines.txt against the rows we last read or wrote and applies only
+    // the rows that differ, each through the lot index. A lot this session changed
+    // since then keeps the local edit. Returns true if any lot changed.
+    bool mergeExternalMedicines() {
+        medicinesStamp = fileStamp(dataFile("medicines.txt"));  // Taken first, so an edit made mid-read shows next time
+        ifstream file(dataFile("medicines.txt"));
+        if (!file.is_open()) return false;
+        unordered_map<int, unique_ptr<IMedicine>> onDisk;
+        unordered_map<int, string> rows;
+        bool missingIds = false;
+        string line;
+        bool unreadable = false;
+        while (getline(file, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (Utils::trimView(line).empty()) continue;
+            int id = lotIdOf(line);
+            try {
+                unique_ptr<IMedicine> med = Medicine::fromFileString(line);
+                missingIds = missingIds || id < 0;
+                id = med->getId();
+                rows[id] = med->toFileString();
+                onDisk[id] = move(med);
+            } catch (const exception&) {
+                // Leave a lot whose row is mid-edit or damaged as it was
+                auto previous = medicinesOnDisk.find(id);
+                if (previous != medicinesOnDisk.end()) rows[id] = previous->second;
+                unreadable = true;
+            }
+        }
+        file.close();
+        // A file that read cleanly has been accepted, so its checksums follow the edit
+        if (!unreadable && !damagedFiles.count(dataFile("medicines.txt"))) BlockChecksums::seal(dataFile("medicines.txt"));
+
+        unordered_map<int, IMedicine*> byId;
+        for (const auto& med : medicines) byId[med->getId()] = med.get();
+        size_t added = 0, updated = 0, removed = 0, kept = 0;
+
+        for (auto& [id, med] : onDisk) {
+            auto previous = medicinesOnDisk.find(id);
+            if (previous != medicinesOnDisk.end() && previous->second == rows[id]) continue;
+            auto local = byId.find(id);
+            if (local == byId.end()) {
+                if (previous != medicinesOnDisk.end()) {
+                    kept++;  // Deleted here, edited there: the deletion stands
+                    continue;
+                }
+                lots.addLot(med.get());
+                emitLot(ChangeFeed::Type::MedicineAdded, *med);
+                medicines.push_back(move(med));
+                added++;
+                continue;
+            }
+            IMedicine& lot = *local->second;
+            if (previous != medicinesOnDisk.end() && lot.toFileString() != previous->second) {
+                kept++;
+                continue;
+            }
+            if (lot.getName() != med->getName()) {
+                // A renamed lot moves to another product, so it is swapped out whole
+                lots.removeLot(&lot);
+                lots.addLot(med.get());
+                auto slot = find_if(medicines.begin(), medicines.end(),
+                                    [&lot](const unique_ptr<IMedicine>& m) { return m.get() == &lot; });
+                *slot = move(med);
+                emitLot(ChangeFeed::Type::MedicineUpdated, **slot);
+            } else {
+                if (lot.getQuantity() != med->getQuantity()) lots.setQuantity(lot, med->getQuantity());
+                if (lot.getExpiryDate() != med->getExpiryDate()) lots.setExpiryDate(lot, med->getExpiryDate());
+                lot.setPriceCents(med->getPriceCents());
+                emitLot(ChangeFeed::Type::MedicineUpdated, lot);
+            }
+            updated++;
+        }
+
+        for (const auto& [id, previous] : medicinesOnDisk) {
+            if (rows.count(id)) continue;
+            auto local = byId.find(id);
+            if (local == byId.end()) continue;
+            if (local->second->toFileString() != previous) {
+                kept++;
+                continue;
+            }
+            lots.removeLot(local->second);
+            medicines.erase(find_if(medicines.begin(), medicines.end(),
+                                    [lot = local->second](const unique_ptr<IMedicine>& m) { return m.get() == lot; }));
+            changes.emit(ChangeFeed::Type::MedicineDeleted, to_string(id), previous);
+            removed++;
+        }
+
+        medicinesOnDisk = move(rows);
+        if (added + updated + removed + kept == 0) return false;
+        // Rows that arrived without an ID got one just now; write it back so they match next time
+        if (missingIds) writeMedicinesFile();
+        logger->log(LogOp::Import, "Merged external changes to medicines.txt: " + to_string(added) + " added, " +
+                    to_string(updated) + " updated, " + to_string(removed) + " removed, " + to_string(kept) +
+                    " kept local", currentUser);
+        return added + updated + removed > 0;
+    }
+
+    // Only the working set stays loaded: billed and long-idle prescriptions found
+    // here are moved to the archive and the active file is rewritten without them
+    void loadPrescriptions() {
+        prescriptions.clear();
+        vector<unique_ptr<IPrescription>> cold;
+        int32_t cutoff = Utils::localDay(time(nullptr)) - ARCHIVE_AFTER_DAYS;
+        string rejected;
+        ifstream file(dataFile("prescriptions.txt"));
+        if (file.is_open()) {
+            string line;
+            int lineNumber = 0;
+            while (getline(file, line)) {
+                lineNumber++;
+                if (Utils::trimView(line).empty()) continue;
+                unique_ptr<IPrescription> pres;
+                try {
+                    pres = Prescription::fromFileString(line);
+                } catch (const exception& e) {
+                    cerr << "Warning: prescriptions.txt line " << lineNumber << " is unreadable (" << e.what()
+                         << "); set aside in prescriptions.txt.rejected\n";
+                    rejected.append(line).append(1, '\n');
+                    continue;
+                }
+                bool idle = pres->getStatus() == FulfilmentStatus::Billed ||
+                            Utils::dayFromDate(pres->getDate(), cutoff) < cutoff;
+                (idle ? cold : prescriptions).push_back(move(pres));
+            }
             file.close();
         }
+        if (!rejected.empty()) setAside("prescriptions.txt", rejected);
+        if (!cold.empty()) archive.append(cold);
+        if (!cold.empty() || !rejected.empty()) savePrescriptions();
+        for (const auto& pres : cold) emitPrescription(ChangeFeed::Type::PrescriptionArchived, *pres);
+        patientHistory.rebuild(prescriptions);
     }
 
     void savePrescriptions() {
-        ofstream file("prescriptions.txt");
+        ofstream file(dataFile("prescriptions.txt"));
         if (file.is_open()) {
+            string content;
             for (const auto& pres : prescriptions) {
-                file << pres->toFileString() << "\n";
+                content.append(pres->toFileString()).append(1, '\n');
+            }
+            file << content;
+            file.close();
+            sealDataFile(dataFile("prescriptions.txt"), content);
+        }
+        if (replication) replication->publishPrescriptions(prescriptions);
+    }
+
+    // Keeps the receipts of active prescriptions and any bill left pending; the
+    // rest belong to archived prescriptions, which can no longer be billed
+    void loadFulfilments() {
+        fulfilments.clear();
+        unordered_set<string_view> active;
+        for (const auto& pres : prescriptions) active.insert(pres->getId());
+        ifstream file(dataFile("fulfilments.txt"));
+        if (file.is_open()) {
+            string line;
+            BillingReceipt receipt;
+            while (getline(file, line)) {
+                if (BillingReceipt::fromFileString(line, receipt) &&
+                    (active.count(receipt.prescriptionId) || !receipt.pendingLots.empty() ||
+                     fulfilments.count(receipt.prescriptionId))) {
+                    string key = receipt.prescriptionId;
+                    fulfilments.insert_or_assign(move(key), move(receipt));  // The done row follows the pending one
+                }
             }
             file.close();
         }
     }
 
-    string getDateIn30Days(const string& currentDate) {
-        int year = stoi(currentDate.substr(0, 4));
-        int month = stoi(currentDate.substr(5, 2));
-        int day = stoi(currentDate.substr(8, 2));
+    // Fulfilments are append-only, so recording a bill never rewrites history
+    void appendFulfilment(const BillingReceipt& receipt) {
+        ofstream file(dataFile("fulfilments.txt"), ios::app);
+        if (file.is_open()) {
+            string row = receipt.toFileString() + "\n";
+            file << row;
+            file.close();
+            fulfilmentSums.append(row);
+        }
+    }
+
+    // Finishes bills cut off between their pending and done rows. A lot still at
+    // its quantity from before the bill gets the dispense applied; one that is
+    // not had it saved already, so a bill is never dispensed twice.
+    void finishInterruptedBills() {
+        vector<const IMedicine*> finishedLots;
+        bool statusChanged = false;
+        for (auto& [id, receipt] : fulfilments) {
+            if (receipt.pendingLots.empty()) continue;
+            string_view rest(receipt.pendingLots);
+            while (!rest.empty()) {
+                size_t space = rest.find(' ');
+                string entry(rest.substr(0, space));
+                rest.remove_prefix(space == string_view::npos ? rest.size() : space + 1);
+                int lotId = 0, before = 0, after = 0;
+                if (sscanf(entry.c_str(), "%d:%d:%d", &lotId, &before, &after) != 3) continue;
+                auto lot = find_if(medicines.begin(), medicines.end(),
+                                   [lotId](const unique_ptr<IMedicine>& med) { return med->getId() == lotId; });
+                if (lot != medicines.end() && (*lot)->getQuantity() == before) {
+                    lots.setQuantity(**lot, after);
+                    finishedLots.push_back(lot->get());
+                }
+            }
+            receipt.pendingLots.clear();
+            appendFulfilment(receipt);
+            for (auto& pres : prescriptions) {
+                if (pres->getId() != id) continue;
+                pres->setStatus(FulfilmentStatus::Billed);
+                statusChanged = true;
+            }
+            cerr << "Note: finished the interrupted bill for prescription " << id << "\n";
+        }
+        if (!finishedLots.empty()) saveMedicines(finishedLots);
+        if (statusChanged) savePrescriptions();
+    }
+
+    void printReceipt(const BillingReceipt& receipt) {
+        cout << "Receipt: " << receipt.reference << "\n"
+             << "Prescription ID: " << receipt.prescriptionId << "\n"
+             << "Medicine: " << receipt.medicineName << " x" << receipt.quantity << "\n"
+             << "Total: " << Utils::formatCents(receipt.totalCents) << "\n"
+             << "Method: " << receipt.method << "\n"
+             << "Billed at: " << receipt.timestamp << "\n";
+    }
+
+    static string getDateIn30Days(const string& currentDate) {
+        int year = stoi(currentDate.substr(0, 4));
+        int month = stoi(currentDate.substr(5, 2));
+        int day = stoi(currentDate.substr(8, 2));
+
+        tm timeStruct = {0};
+        timeStruct.tm_year = year - 1900;
+        timeStruct.tm_mon = month - 1;
+        timeStruct.tm_mday = day + 30;
+        mktime(&timeStruct);
+
+        char buffer[11];
+        strftime(buffer, sizeof(buffer), "%Y-%m-%d", &timeStruct);
+        return string(buffer);
+    }
+
+    // The background refresh usually has the report ready; it is only rewritten here
+    // when the inventory has moved on since or the file has grown stale
+    void generateComplianceReport() {
+        bool current = reportVersion == inventory.acquire()->version &&
+                       time(nullptr) - reportWrittenAt < REPORT_REUSE_SECONDS;
+        if (!current && !writeComplianceReport()) {
+            cout << "Error creating compliance report.\n";
+            return;
+        }
+        cout << "Compliance report generated successfully.\n";
+        logger->log(LogOp::Report, "Generated compliance report", currentUser);
+    }
+
+    // Safe to run on a scheduler thread: it reads only the inventory snapshot,
+    // the forecaster and the reservation table, which all lock for themselves
+    bool writeComplianceReport() {
+        lock_guard<mutex> lock(reportMutex);
+        uint64_t version = inventory.acquire()->version;
+        ofstream reportFile(dataFile("compliance_report.txt"));
+        if (!reportFile.is_open()) return false;
+
+        string currentDate = Utils::getCurrentTimestamp().substr(0, 10);
+        reportFile << "Compliance Report - " << currentDate << "\n";
+        reportFile << "========================================\n\n";
+        writeComplianceSections(reportFile);
+
+        reportFile.close();
+        reportVersion = version;
+        reportWrittenAt = time(nullptr);
+        return true;
+    }
+
+    // Rewrites the compliance report in the background once catalogue edits pause
+    void scheduleReportRefresh() {
+        TaskScheduler& scheduler = TaskScheduler::shared();
+        scheduler.cancel(reportRefresh);
+        reportRefresh = scheduler.schedule([this] { writeComplianceReport(); }, REPORT_REFRESH_DELAY,
+                                           TaskScheduler::Priority::Low, this).id;
+    }
+
+    // Upkeep for the length of a session; all of it is owned by this store
+    void startHousekeeping() {
+        TaskScheduler& scheduler = TaskScheduler::shared();
+        // Lapsed payment holds go back on sale even when no new bill comes along to expire them
+        scheduler.every([this] { reservations.advance(); }, RESERVATION_SWEEP, TaskScheduler::Priority::Normal, this);
+        scheduler.every([this] { writeComplianceReport(); }, REPORT_REFRESH_PERIOD, TaskScheduler::Priority::Low, this);
+    }
+
+    // Cancels this store's scheduled work and waits for any of it already running
+    void stopHousekeeping() {
+        TaskScheduler::shared().drain(this);
+    }
 
-        tm timeStruct = {0};
-        timeStruct.tm_year = year - 1900;
-        timeStruct.tm_mon = month - 1;
-        timeStruct.tm_mday = day + 30;
-        mktime(&timeStruct);
+public:
+    static constexpr size_t LISTING_PAGE_ROWS = 100;
 
-        char buffer[11];
-        strftime(buffer, sizeof(buffer), "%Y-%m-%d", &timeStruct);
-        return string(buffer);
+    // Prompt shown between pages of a long listing
+    static bool continuePaging(size_t shown, size_t total) {
+        string answer = Utils::getInput("-- " + to_string(shown) + " of " + to_string(total) +
+                                        " rows. Enter for more, q to stop: ");
+        return answer != "q" && answer != "Q";
     }
 
-    void generateComplianceReport() {
-        ofstream reportFile("compliance_report.txt");
-        if (!reportFile.is_open()) {
-            cout << "Error creating compliance report.\n";
-            return;
-        }
+    // Compliance report sections for the multi-store report; the reorder suggestions
+    // follow the stock sections. Everything is read from one inventory snapshot, so
+    // billing can carry on meanwhile.
+    void writeComplianceSections(ostream& reportFile) {
+        shared_ptr<const InventorySnapshot> view = inventory.acquire();
+        writeStockSections(reportFile, *view);
+        writeReorderSuggestions(reportFile, *view);
+    }
 
+    // Low stock and expiring sections; they need nothing but the snapshot, so replicas print them too
+    static void writeStockSections(ostream& reportFile, const InventorySnapshot& view) {
         string currentDate = Utils::getCurrentTimestamp().substr(0, 10);
+        string dateIn30Days = getDateIn30Days(currentDate);
+        reportFile << "Inventory as of " << view.takenAt << " (version " << view.version << ")\n\n";
 
-        reportFile << "Compliance Report - " << currentDate << "\n";
-        reportFile << "========================================\n\n";
-
+        // Stock levels are judged per product, summed over all of its lots
         reportFile << "Low Stock Medicines (Quantity < 10):\n";
-        bool hasLowStock = false;
-        for (const auto& med : medicines) {
-            if (med->getQuantity() < 10) {
-                reportFile << "- " << med->getName() << ": " << med->getQuantity() << " remaining\n";
-                hasLowStock = true;
+        TableRenderer lowStock({ { "Medicine", 30 }, { "Remaining", 10, TableRenderer::Align::Right } });
+        for (const auto& product : view.products) {
+            const string& name = view.lots[product.second.front()].name;
+            int total = view.totalQuantity(name);
+            if (total < 10) {
+                lowStock.text(name).integer(total);
+                lowStock.endRow();
             }
+            if (lowStock.bufferedBytes() > REPORT_FLUSH_BYTES) lowStock.flushTo(reportFile);
         }
-        if (!hasLowStock) reportFile << "No low stock medicines.\n";
-        reportFile << "\n";
+        writeSection(reportFile, lowStock, "No low stock medicines.\n");
 
         reportFile << "Medicines Expiring Soon (within 30 days):\n";
-        bool hasExpiringSoon = false;
-        for (const auto& med : medicines) {
-            string expiry = med->getExpiryDate();
-            if (expiry > currentDate && expiry <= getDateIn30Days(currentDate)) {
-                reportFile << "- " << med->getName() << ": Expires on " << expiry << "\n";
-                hasExpiringSoon = true;
+        TableRenderer expiring({ { "Medicine", 30 }, { "Lot", 8 }, { "Expires", 12 } });
+        for (const auto& lot : view.lots) {
+            if (lot.expiryDate > currentDate && lot.expiryDate <= dateIn30Days) {
+                expiring.text(lot.name).integer(lot.id).text(lot.expiryDate);
+                expiring.endRow();
+            }
+            if (expiring.bufferedBytes() > REPORT_FLUSH_BYTES) expiring.flushTo(reportFile);
+        }
+        writeSection(reportFile, expiring, "No medicines expiring soon.\n");
+
+        // Billing never dispenses these; they are listed so they can be pulled from the shelves
+        reportFile << "Expired Stock (not dispensed):\n";
+        TableRenderer expired({ { "Medicine", 30 }, { "Lot", 8 }, { "Expired", 12 },
+                                { "Units", 10, TableRenderer::Align::Right } });
+        for (const auto& lot : view.lots) {
+            if (lot.quantity > 0 && lot.expiryDate < currentDate) {
+                expired.text(lot.name).integer(lot.id).text(lot.expiryDate).integer(lot.quantity);
+                expired.endRow();
             }
+            if (expired.bufferedBytes() > REPORT_FLUSH_BYTES) expired.flushTo(reportFile);
         }
-        if (!hasExpiringSoon) reportFile << "No medicines expiring soon.\n";
+        writeSection(reportFile, expired, "No expired stock.\n");
+    }
 
-        reportFile.close();
-        cout << "Compliance report generated successfully.\n";
-        FileLogger::getInstance()->log("Generated compliance report", currentUser);
+    // One pass over the products: forecast demand, project run-out and expiry losses, suggest reorders
+    void writeReorderSuggestions(ostream& reportFile, const InventorySnapshot& view) {
+        int32_t today = Utils::localDay(time(nullptr));
+        reportFile << "Demand Forecast and Reorder Suggestions (lead time "
+                   << DemandForecaster::LEAD_TIME_DAYS << " days):\n";
+        using Align = TableRenderer::Align;
+        TableRenderer table({ { "Medicine", 26 }, { "Units/day", 10, Align::Right }, { "Sellable", 10, Align::Right },
+                              { "Expiring", 10, Align::Right }, { "Runs out", 12 }, { "Reorder", 8, Align::Right } });
+        for (const auto& product : view.products) {
+            if (product.second.empty()) continue;
+            const string& name = view.lots[product.second.front()].name;
+            DemandForecaster::Forecast forecast =
+                forecaster.assess(view, product.second, reservations.held(product.first), today);
+            if (forecast.unitsPerDay <= 0 && forecast.expiringUnits == 0) continue;
+            table.text(name).decimal(forecast.unitsPerDay, 2).integer(forecast.usableStock)
+                .integer(forecast.expiringUnits)
+                .text(forecast.runOutDay >= 0 ? Utils::dayLabel(forecast.runOutDay) : string("-"));
+            if (forecast.reorderQuantity > 0) table.integer(forecast.reorderQuantity);
+            else table.text("-");
+            table.endRow();
+            if (table.bufferedBytes() > REPORT_FLUSH_BYTES) table.flushTo(reportFile);
+        }
+        writeSection(reportFile, table, "No current demand or expected expiry losses.\n");
+    }
+
+    // Finishes a report table, or prints the note when it has no rows
+    static void writeSection(ostream& reportFile, TableRenderer& table, const char* emptyNote) {
+        if (table.rows() == 0) reportFile << emptyNote;
+        else table.flushTo(reportFile);
+        reportFile << "\n";
+    }
+
+    // Unheld, unexpired units of a medicine across its lots, for cross-store stock queries.
+    // Runs on query threads, so it reads the published snapshot rather than the live lots.
+    int stockOf(string_view medicineName) {
+        return inventory.acquire()->sellableQuantity(medicineName, Utils::localDay(time(nullptr))) -
+               reservations.held(Utils::toLower(medicineName));
+    }
+
+    // The active prescription with this ID, or nullptr. Positions shift when
+    // prescriptions are removed, so a lookup that finds a stale one rebuilds the map.
+    const IPrescription* activePrescription(const string& id) {
+        auto it = prescriptionSlots.find(id);
+        if (it == prescriptionSlots.end() || it->second >= prescriptions.size() ||
+            prescriptions[it->second]->getId() != id) {
+            prescriptionSlots.clear();
+            prescriptionSlots.reserve(prescriptions.size());
+            for (size_t i = 0; i < prescriptions.size(); i++) prescriptionSlots.emplace(prescriptions[i]->getId(), i);
+            it = prescriptionSlots.find(id);
+            if (it == prescriptionSlots.end()) return nullptr;
+        }
+        return prescriptions[it->second].get();
+    }
+
+    // Runs a named TransactionQuery over this store's log; false if the name is unknown
+    bool runQuery(const string& query, const string& from, const string& to, ostream& out) {
+        TransactionQuery table(*logger, from, to);
+        out << table.size() << " records scanned.\n";
+        return table.run(query, out, [this](int id) { return medicineNameById(id); });
+    }
+
+    // For --import-interactions: writes the starter table into a store that has
+    // none, for its staff to review; an existing table is never replaced
+    static bool importStarterInteractions(const string& root, ostream& out) {
+        string path = Utils::dataPath(root, "interactions.txt");
+        error_code ec;
+        if (filesystem::exists(path, ec)) {
+            out << path << " already exists; edit it instead\n";
+            return false;
+        }
+        InteractionTable table;
+        table.seedDefaults();
+        if (!table.save(path)) {
+            out << "Cannot write " << path << "\n";
+            return false;
+        }
+        out << "Wrote a starter table of " << table.size() << " drug interactions to " << path
+            << "; review it for this store\n";
+        return true;
     }
 
+    // For --query: reads the log and the catalogue without opening the store,
+    // so it never writes to files a running store shares
+    static bool runQuery(const string& root, const string& query, const string& from, const string& to,
+                         ostream& out) {
+        unique_ptr<FileLogger> log = FileLogger::openReadOnly(root);
+        unordered_map<int, string> names;
+        ifstream file(Utils::dataPath(root, "medicines.txt"));
+        string line;
+        while (getline(file, line)) {
+            if (lotIdOf(line) < 0) continue;
+            try {
+                unique_ptr<Medicine> med = Medicine::fromFileString(line);
+                names[med->getId()] = med->getName();
+            } catch (...) {
+            }
+        }
+        TransactionQuery table(*log, from, to);
+        out << table.size() << " records scanned.\n";
+        return table.run(query, out, [&names](int id) {
+            auto it = names.find(id);
+            return it != names.end() ? it->second : "#" + to_string(id) + " (removed)";
+        });
+    }
+
+private:
+
     bool authenticateUser() {
     Utils::clearScreen();
     cout << "=== PHARMACY MANAGEMENT SYSTEM ===\n";
@@ -570,16 +6766,12 @@ private:
     string username = Utils::getInput("Username: ");
     string password = Utils::getInput("Password: ");
 
-    if (username == "admin" && password == "admin123") {
-        currentUser = username;
-        currentRole = "Admin";
-        FileLogger::getInstance()->log("Logged in as Admin", username);
-        return true;
-    } 
-    else if (username == "pharmacist" && password == "pharma123") {
+    Roles roles = users->authenticate(username, password);
+    if (roles != 0 && users->passwordExpired(username) && !chooseNewPassword(username, password)) return false;
+    if (roles != 0) {
         currentUser = username;
-        currentRole = "Pharmacist";
-        FileLogger::getInstance()->log("Logged in as Pharmacist", username);
+        sessionToken = sessions.issue(username, roles);
+        logger->log(LogOp::Login, "Logged in as " + UserAccount::roleNames(roles), username);
         return true;
     }
 
@@ -588,18 +6780,144 @@ private:
     return false;
 }
 
+    // A starter account must take a password of its user's choosing before it is used
+    bool chooseNewPassword(const string& username, const string& oldPassword) {
+        cout << "This account still has its initial password. Choose a new one to continue.\n";
+        string password = Utils::getInput("New password: ");
+        string repeat = Utils::getInput("Repeat new password: ");
+        if (password.empty() || password != repeat || password == oldPassword) {
+            cout << "The new password must be non-empty, typed the same twice and differ from the old one.\n";
+            Utils::pause();
+            return false;
+        }
+        if (!users->setPassword(username, password)) {
+            cout << "Could not save the new password.\n";
+            Utils::pause();
+            return false;
+        }
+        logger->log(LogOp::Other, "Replaced initial password", username);
+        return true;
+    }
+
+    // Checks the current session still exists and holds the role; an expired one is reported here
+    bool authorized(Role role) {
+        SessionCache::Session session;
+        bool valid = sessions.validate(sessionToken, session);
+        if (valid && hasRole(session.roles, role)) return true;
+        cout << (valid ? "This account may not use that menu.\n" : "Your session has expired. Please log in again.\n");
+        Utils::pause();
+        return false;
+    }
+
+    void userAccountsMenu() {
+        bool running = true;
+
+        while (running) {
+            if (!authorized(Role::Admin)) return;
+            Utils::clearScreen();
+            cout << "=== USER ACCOUNTS ===\n";
+            TableRenderer table({ { "Username", 20 }, { "Roles", 20 } });
+            for (const auto& account : users->accounts()) {
+                table.text(account.name).text(UserAccount::roleNames(account.roles)).endRow();
+            }
+            table.flushTo(cout);
+            cout << "\n1. Add User\n"
+                 << "2. Change Password\n"
+                 << "3. Remove User\n"
+                 << "4. Back to Admin Menu\n"
+                 << "Enter your choice: ";
+            int choice = Utils::getIntInput("");
+
+            switch (choice) {
+                case 1: {
+                    string name = Utils::getInput("Username: ");
+                    if (!FileUserStore::validName(name)) {
+                        cout << "Usernames must be non-empty and may not contain commas or '|'.\n";
+                        break;
+                    }
+                    Roles roles = UserAccount::parseRoles(Utils::getInput("Roles (admin, pharmacist or admin|pharmacist): "));
+                    if (roles == 0) {
+                        cout << "Unknown role.\n";
+                        break;
+                    }
+                    string password = Utils::getInput("Password: ");
+                    if (password.empty()) {
+                        cout << "Password may not be empty.\n";
+                    } else if (users->addUser(name, password, roles)) {
+                        logger->log(LogOp::Other, "Added user " + name + " (" + UserAccount::roleNames(roles) + ")",
+                                    currentUser);
+                        cout << "User added.\n";
+                    } else {
+                        cout << "Could not add user; the name may already be taken.\n";
+                    }
+                    break;
+                }
+                case 2: {
+                    string name = Utils::getInput("Username: ");
+                    string password = Utils::getInput("New password: ");
+                    if (password.empty()) {
+                        cout << "Password may not be empty.\n";
+                    } else if (users->setPassword(name, password)) {
+                        // Anyone still logged in with the old password has to log in again
+                        sessions.revokeUser(name, sessionToken);
+                        logger->log(LogOp::Other, "Changed password for " + name, currentUser);
+                        cout << "Password changed.\n";
+                    } else {
+                        cout << "No such user.\n";
+                    }
+                    break;
+                }
+                case 3: {
+                    string name = Utils::getInput("Username: ");
+                    vector<UserAccount> accounts = users->accounts();
+                    auto target = find_if(accounts.begin(), accounts.end(),
+                                          [&](const UserAccount& account) { return account.name == name; });
+                    size_t admins = 0;
+                    for (const auto& account : accounts) {
+                        if (hasRole(account.roles, Role::Admin)) admins++;
+                    }
+                    if (target == accounts.end()) {
+                        cout << "No such user.\n";
+                    } else if (name == currentUser) {
+                        cout << "You cannot remove the account you are logged in with.\n";
+                    } else if (hasRole(target->roles, Role::Admin) && admins == 1) {
+                        cout << "The last admin account cannot be removed.\n";
+                    } else if (users->removeUser(name)) {
+                        sessions.revokeUser(name);
+                        logger->log(LogOp::Other, "Removed user " + name, currentUser);
+                        cout << "User removed.\n";
+                    } else {
+                        cout << "Could not remove user.\n";
+                    }
+                    break;
+                }
+                case 4: running = false; continue;
+                default: cout << "Invalid choice. Please try again.\n";
+            }
+            Utils::pause();
+        }
+    }
 
     void adminMenu() {
         int choice = 0;
         bool running = true;
         
         while (running) {
+            if (!authorized(Role::Admin)) return;
+            syncExternalChanges();
             Utils::clearScreen();
             cout << "=== ADMIN MENU ===\n"
                  << "1. Medicine Management\n"
                  << "2. View Compliance Report\n"
                  << "3. View Transaction Logs\n"
-                 << "4. Logout\n"
+                 << "4. Payment Gateway Simulator\n"
+                 << "5. Transaction Queries\n"
+                 << "6. Sales Analytics\n"
+                 << "7. Inventory Valuation\n"
+                 << "8. Inventory As Of\n"
+                 << "9. Replication Status\n"
+                 << "10. User Accounts\n"
+                 << "11. Logout\n"
                  << "Enter your choice: ";
             choice = Utils::getIntInput("");
 
@@ -608,24 +6926,34 @@ private:
                 case 2: {
                     generateComplianceReport();
                     cout << "\n=== Compliance Report ===\n";
-                    ifstream reportFile("compliance_report.txt");
-                    if (reportFile.is_open()) {
-                        string line;
-                        while (getline(reportFile, line)) {
-                            cout << line << "\n";
-                        }
-                        reportFile.close();
+                    // Only the read holds the lock; the scheduled rewrites must not wait on the prompt
+                    string report;
+                    {
+                        lock_guard<mutex> lock(reportMutex);
+                        ifstream reportFile(dataFile("compliance_report.txt"));
+                        report.assign(istreambuf_iterator<char>(reportFile), istreambuf_iterator<char>());
                     }
+                    cout << report;
                     Utils::pause();
                     break;
                 }
                 case 3: {
+                    // Leaving both bounds blank shows the whole history
+                    string from = Utils::getInput("Show logs from (YYYY-MM-DD, blank for all): ");
+                    string to = Utils::getInput("Show logs up to (YYYY-MM-DD, blank for all): ");
                     cout << "\n=== Transaction Logs ===\n";
-                    FileLogger::getInstance()->viewLogs();
+                    logger->viewLogs(from, to);
                     Utils::pause();
                     break;
                 }
-                case 4: running = false; break;
+                case 4: runPaymentSimulation(); break;
+                case 5: transactionQueryMenu(); break;
+                case 6: salesAnalyticsMenu(); break;
+                case 7: inventoryValuationReport(); break;
+                case 8: inventoryAsOfMenu(); break;
+                case 9: replicationStatus(); break;
+                case 10: userAccountsMenu(); break;
+                case 11: running = false; break;
                 default: cout << "Invalid choice. Please try again.\n"; Utils::pause();
             }
         }
@@ -636,13 +6964,16 @@ private:
         bool running = true;
         
         while (running) {
+            syncExternalChanges();
             Utils::clearScreen();
             cout << "=== MEDICINE MANAGEMENT ===\n"
                  << "1. Add Medicine\n"
                  << "2. View All Medicines\n"
                  << "3. Update Medicine\n"
                  << "4. Delete Medicine\n"
-                 << "5. Back to Admin Menu\n"
+                 << "5. Import Medicines from CSV\n"
+                 << "6. Export Medicines to CSV\n"
+                 << "7. Back to Admin Menu\n"
                  << "Enter your choice: ";
             choice = Utils::getIntInput("");
 
@@ -651,7 +6982,9 @@ private:
                 case 2: viewAllMedicines(); break;
                 case 3: updateMedicine(); break;
                 case 4: deleteMedicine(); break;
-                case 5: running = false; break;
+                case 5: importMedicines(); break;
+                case 6: exportMedicines(); break;
+                case 7: running = false; break;
                 default: cout << "Invalid choice. Please try again.\n"; Utils::pause();
             }
         }
@@ -683,10 +7016,10 @@ private:
 
         string expiryDate = Utils::getDateInput("Enter expiry date");
 
-        float price = 0.0f;
+        int64_t price = 0;
         bool priceValid = false;
         while (!priceValid) {
-            price = Utils::getFloatInput("Enter price: ");
+            price = Utils::getMoneyInput("Enter price: ");
             priceValid = (price > 0);
             if (!priceValid) {
                 cout << "Price must be positive.\n";
@@ -694,86 +7027,165 @@ private:
         }
 
         try {
-            bool medicineUpdated = false;
-            for (auto& med : medicines) {
-                if (Utils::toLower(med->getName()) == Utils::toLower(name) &&
-                    med->getExpiryDate() == expiryDate &&
-                    abs(med->getPrice() - price) < 0.001f) {
-                    
-                    int oldQuantity = med->getQuantity();
-                    med->setQuantity(oldQuantity + quantity);
-                    medicineUpdated = true;
-                    
-                    cout << "\nMedicine already exists! Quantity updated.\n"
-                         << "Previous quantity: " << oldQuantity << "\n"
-                         << "Added quantity: " << quantity << "\n"
-                         << "New total quantity: " << med->getQuantity() << "\n";
-                    
-                    FileLogger::getInstance()->log(
-                        "Updated medicine quantity: " + name + 
-                        " (" + to_string(oldQuantity) + "→" + to_string(med->getQuantity()) + ")", 
-                        currentUser
-                    );
-                    break;
-                }
-            }
-
-            if (!medicineUpdated) {
+            // A delivery matching an existing lot (name, expiry and price) tops it up;
+            // anything else becomes a new lot of the product
+            IMedicine* lot = lots.findLot(name, expiryDate, price);
+            ChangeFeed::Type change = lot ? ChangeFeed::Type::MedicineUpdated : ChangeFeed::Type::MedicineAdded;
+            if (lot) {
+                int oldQuantity = lot->getQuantity();
+                lots.setQuantity(*lot, oldQuantity + quantity);
+                
+                cout << "\nMedicine already exists! Quantity updated.\n"
+                     << "Previous quantity: " << oldQuantity << "\n"
+                     << "Added quantity: " << quantity << "\n"
+                     << "New total quantity: " << lot->getQuantity() << "\n";
+                
+                logger->log(LogEvent{
+                    LogOp::UpdateMedicine, lot->getId(), quantity, 0, 0,
+                    "Updated medicine quantity: " + name + 
+                    " (" + to_string(oldQuantity) + "→" + to_string(lot->getQuantity()) + ")"
+                }, currentUser);
+            } else {
                 medicines.push_back(make_unique<Medicine>(name, quantity, expiryDate, price));
+                lot = medicines.back().get();
+                lots.addLot(lot);
                 cout << "\nNew medicine added successfully!\n";
-                FileLogger::getInstance()->log(
+                logger->log(LogEvent{
+                    LogOp::AddMedicine, medicines.back()->getId(), quantity, 0, 0,
                     "Added new medicine: " + name + 
                     " (Qty: " + to_string(quantity) + 
                     ", Exp: " + expiryDate + 
-                    ", Price: $" + to_string(price) + ")", 
-                    currentUser
-                );
+                    ", Price: " + Utils::formatCents(price) + ")"
+                }, currentUser);
             }
 
-            saveMedicines();
+            saveMedicines({ lot });
+            emitLot(change, *lot);
         } catch (const exception& e) {
             cout << "Error: " << e.what() << "\n";
         }
         Utils::pause();
     }
 
+    // Bulk version of addMedicine: rows merge into lots with the same name, expiry
+    // and price, looked up through a hash key, and the catalogue is saved once
+    void importMedicines() {
+        Utils::clearScreen();
+        cout << "=== IMPORT MEDICINES FROM CSV ===\n";
+        string path = Utils::getInput("Enter CSV file path: ");
+
+        auto lotKey = [](string_view name, const string& expiry, int64_t priceCents) {
+            return Utils::toLower(name) + "|" + expiry + "|" + to_string(priceCents);
+        };
+        unordered_map<string, IMedicine*> existing;
+        existing.reserve(medicines.size());
+        for (const auto& med : medicines) {
+            existing.emplace(lotKey(med->getName(), med->getExpiryDate(), med->getPriceCents()), med.get());
+        }
+
+        size_t merged = 0;
+        size_t added = 0;
+        size_t rowsRead = 0;
+        vector<pair<IMedicine*, ChangeFeed::Type>> touched;  // One feed event per lot, in import order
+        unordered_set<IMedicine*> seen;
+        vector<CatalogueImporter::Rejection> rejects;
+        bool ok = CatalogueImporter::import(path, [&](CatalogueImporter::Row& row) {
+            string key = lotKey(row.name, row.expiryDate, row.priceCents);
+            auto it = existing.find(key);
+            if (it != existing.end()) {
+                if (row.quantity > numeric_limits<int>::max() - it->second->getQuantity()) {
+                    rejects.push_back({ row.lineNumber, "Merged quantity would exceed the largest stock a lot can hold",
+                                        row.name + "," + to_string(row.quantity) + "," + row.expiryDate + "," +
+                                            Utils::centsToDecimal(row.priceCents) });
+                    return;
+                }
+                lots.setQuantity(*it->second, it->second->getQuantity() + row.quantity);
+                if (seen.insert(it->second).second) touched.emplace_back(it->second, ChangeFeed::Type::MedicineUpdated);
+                merged++;
+            } else {
+                medicines.push_back(make_unique<Medicine>(move(row.name), row.quantity, move(row.expiryDate), row.priceCents));
+                lots.addLot(medicines.back().get());
+                existing.emplace(move(key), medicines.back().get());
+                seen.insert(medicines.back().get());
+                touched.emplace_back(medicines.back().get(), ChangeFeed::Type::MedicineAdded);
+                added++;
+            }
+        }, rejects, rowsRead);
+
+        if (!ok) {
+            cout << "Could not open " << path << ".\n";
+            Utils::pause();
+            return;
+        }
+
+        if (merged + added > 0) {
+            vector<const IMedicine*> changed;
+            changed.reserve(touched.size());
+            for (const auto& entry : touched) changed.push_back(entry.first);
+            saveMedicines(changed);
+            for (const auto& [lot, change] : touched) emitLot(change, *lot);
+        }
+
+        if (!rejects.empty()) {
+            ofstream rejectFile(dataFile("import_rejects.txt"));
+            for (const auto& reject : rejects) {
+                rejectFile << "Line " << reject.lineNumber << ": " << reject.reason << " | " << reject.line << "\n";
+            }
+            size_t shown = min<size_t>(rejects.size(), 10);
+            cout << "Rejected rows (first " << shown << "):\n";
+            for (size_t i = 0; i < shown; i++) {
+                cout << "- Line " << rejects[i].lineNumber << ": " << rejects[i].reason << "\n";
+            }
+            cout << "All rejected rows were written to import_rejects.txt\n";
+        }
+
+        cout << "\nRows read: " << rowsRead << "\n"
+             << "Merged into existing lots: " << merged << "\n"
+             << "New lots added: " << added << "\n"
+             << "Rejected: " << rejects.size() << "\n";
+        logger->log(LogOp::Import,
+            "Imported medicines from " + path + " (Merged: " + to_string(merged) +
+            ", Added: " + to_string(added) + ", Rejected: " + to_string(rejects.size()) + ")",
+            currentUser
+        );
+        Utils::pause();
+    }
+
+    void exportMedicines() {
+        Utils::clearScreen();
+        cout << "=== EXPORT MEDICINES TO CSV ===\n";
+        string path = Utils::getInput("Enter CSV file path: ");
+        if (CatalogueImporter::exportTo(path, medicines)) {
+            cout << "Exported " << medicines.size() << " medicines to " << path << ".\n";
+            logger->log(LogOp::Export, "Exported medicines to " + path, currentUser);
+        } else {
+            cout << "Could not write " << path << ".\n";
+        }
+        Utils::pause();
+    }
+
     void viewAllMedicines() {
+        syncExternalChanges();
         Utils::clearScreen();
         cout << "=== ALL MEDICINES ===\n";
         
-        if (medicines.empty()) {
+        shared_ptr<const InventorySnapshot> view = inventory.acquire();
+        if (view->lots.empty()) {
             cout << "No medicines found.\n";
             Utils::pause();
             return;
         }
 
-        cout << left 
-             << setw(5) << "ID" 
-             << setw(25) << "Medicine Name" 
-             << setw(10) << "Quantity" 
-             << setw(15) << "Expiry Date" 
-             << setw(10) << "Price" 
-             << "\n";
-
-        cout << setfill('-') 
-             << setw(5) << "" << " " 
-             << setw(25) << "" << " " 
-             << setw(10) << "" << " " 
-             << setw(15) << "" << " " 
-             << setw(10) << "" 
-             << setfill(' ') << "\n";
-
-        for (const auto& med : medicines) {
-            cout << left 
-                 << setw(5) << med->getId() 
-                 << setw(25) << med->getName().substr(0, 24)
-                 << setw(10) << med->getQuantity()
-                 << setw(15) << med->getExpiryDate()
-                 << "$" << fixed << setprecision(2) << med->getPrice()
-                 << "\n";
+        TableRenderer table({ { "ID", 6 }, { "Medicine Name", 26 }, { "Quantity", 11 },
+                              { "Expiry Date", 16 }, { "Price", 11 } });
+        table.reserveRows(view->lots.size());
+        for (const auto& lot : view->lots) {
+            table.integer(lot.id).text(lot.name).integer(lot.quantity).text(lot.expiryDate).text(Utils::formatCents(lot.priceCents));
+            table.endRow();
         }
+        table.writePaged(cout, LISTING_PAGE_ROWS, continuePaging);
 
-        cout << "\nTotal medicines: " << medicines.size() << "\n";
+        cout << "\nTotal medicines: " << view->lots.size() << "\n";
         Utils::pause();
     }
 
@@ -822,34 +7234,36 @@ private:
                             cout << "Quantity cannot be negative.\n";
                         }
                     }
-                    med->setQuantity(newQty);
+                    lots.setQuantity(*med, newQty);
                     break;
                 }
                 case 2: {
                     string newExpiry = Utils::getDateInput("Enter new expiry date");
-                    med->setExpiryDate(newExpiry);
+                    lots.setExpiryDate(*med, move(newExpiry));
                     break;
                 }
                 case 3: {
-                    float newPrice = 0.0f;
+                    int64_t newPrice = 0;
                     bool valid = false;
                     while (!valid) {
-                        newPrice = Utils::getFloatInput("Enter new price: ");
+                        newPrice = Utils::getMoneyInput("Enter new price: ");
                         valid = (newPrice > 0);
                         if (!valid) {
                             cout << "Price must be positive.\n";
                         }
                     }
-                    med->setPrice(newPrice);
+                    med->setPriceCents(newPrice);
                     break;
                 }
                 case 4: return;
                 default: cout << "Invalid choice.\n"; Utils::pause(); return;
             }
 
-            saveMedicines();
+            saveMedicines({ med.get() });
+            emitLot(ChangeFeed::Type::MedicineUpdated, *med);
             cout << "Medicine updated successfully.\n";
-            FileLogger::getInstance()->log("Updated medicine: " + med->getName(), currentUser);
+            logger->log(LogEvent{ LogOp::UpdateMedicine, med->getId(), 0, 0, 0, "Updated medicine: " + med->getName() },
+                        currentUser);
         } catch (const exception& e) {
             cout << "Error: " << e.what() << "\n";
         }
@@ -877,10 +7291,14 @@ private:
     }
 
     string medName = (*it)->getName();
+    string row = (*it)->toFileString();
+    lots.removeLot(it->get());
     medicines.erase(it);
-    saveMedicines();
+    saveMedicines({}, { medicineId });
+    changes.emit(ChangeFeed::Type::MedicineDeleted, to_string(medicineId), row);
     cout << "Medicine " << medName << " (ID: " << medicineId << ") deleted successfully.\n";
-    FileLogger::getInstance()->log("Deleted medicine: " + medName + " (ID: " + to_string(medicineId) + ")", currentUser);
+    logger->log(LogEvent{ LogOp::DeleteMedicine, medicineId, 0, 0, 0,
+                          "Deleted medicine: " + medName + " (ID: " + to_string(medicineId) + ")" }, currentUser);
     Utils::pause();
 }
 
@@ -889,12 +7307,15 @@ private:
         bool running = true;
         
         while (running) {
+            if (!authorized(Role::Pharmacist)) return;
+            syncExternalChanges();
             Utils::clearScreen();
             cout << "=== PHARMACIST MENU ===\n"
                  << "1. Prescription Management\n"
                  << "2. Process Billing\n"
                  << "3. View Medicines\n"
-                 << "4. Logout\n"
+                 << "4. Search Medicines\n"
+                 << "5. Logout\n"
                  << "Enter your choice: ";
             choice = Utils::getIntInput("");
 
@@ -902,7 +7323,8 @@ private:
                 case 1: prescriptionManagementMenu(); break;
                 case 2: processBilling(); break;
                 case 3: viewAllMedicines(); break;
-                case 4: running = false; break;
+                case 4: searchMedicines(); break;
+                case 5: running = false; break;
                 default: cout << "Invalid choice. Please try again.\n"; Utils::pause();
             }
         }
@@ -913,13 +7335,15 @@ private:
         bool running = true;
         
         while (running) {
+            syncExternalChanges();
             Utils::clearScreen();
             cout << "=== PRESCRIPTION MANAGEMENT ===\n"
                  << "1. Add Prescription\n"
                  << "2. View All Prescriptions\n"
                  << "3. Update Prescription\n"
                  << "4. Delete Prescription\n"
-                 << "5. Back to Pharmacist Menu\n"
+                 << "5. View Patient History\n"
+                 << "6. Back to Pharmacist Menu\n"
                  << "Enter your choice: ";
             choice = Utils::getIntInput("");
 
@@ -928,12 +7352,54 @@ private:
                 case 2: viewAllPrescriptions(); break;
                 case 3: updatePrescription(); break;
                 case 4: deletePrescription(); break;
-                case 5: running = false; break;
+                case 5: viewPatientHistory(); break;
+                case 6: running = false; break;
                 default: cout << "Invalid choice. Please try again.\n"; Utils::pause();
             }
         }
     }
 
+    // Asks until the answer names a catalogue product, in stock or not; billing checks
+    // the quantity. Anything else gets up to five
+    // completions or typo corrections to pick from instead of a full catalogue dump.
+    string promptMedicineName(const string& prompt) {
+        while (true) {
+            string input = Utils::trim(Utils::getInput(prompt));
+            searchIndex.refresh(*inventory.acquire());
+            vector<MedicineSearchIndex::Match> matches = searchIndex.search(input, 5);
+            if (lots.contains(input) && !matches.empty()) return matches.front().name;
+            if (matches.empty()) {
+                cout << "Medicine not found in inventory. Try again.\n";
+                continue;
+            }
+            cout << "No exact match. Did you mean:\n";
+            for (size_t i = 0; i < matches.size(); ++i) {
+                cout << "  " << i + 1 << ". " << matches[i].name << "\n";
+            }
+            int choice = Utils::getIntInput("Pick a number (0 to type again): ");
+            if (choice >= 1 && choice <= static_cast<int>(matches.size())) {
+                return matches[static_cast<size_t>(choice - 1)].name;
+            }
+        }
+    }
+
+    void searchMedicines() {
+        Utils::clearScreen();
+        cout << "=== SEARCH MEDICINES ===\n";
+        string query = Utils::getInput("Name or part of a name: ");
+        shared_ptr<const InventorySnapshot> view = inventory.acquire();
+        searchIndex.refresh(*view);
+        vector<MedicineSearchIndex::Match> matches = searchIndex.search(query, 10);
+        if (matches.empty()) {
+            cout << "No matching medicines.\n";
+        }
+        for (const auto& match : matches) {
+            cout << "- " << match.name << " (" << view->totalQuantity(match.name) << " in stock)"
+                 << (match.distance > 0 ? "  [close match]" : "") << "\n";
+        }
+        Utils::pause();
+    }
+
     void addPrescription() {
         Utils::clearScreen();
         cout << "=== ADD NEW PRESCRIPTION ===\n";
@@ -945,6 +7411,14 @@ private:
             idValid = !id.empty();
             if (!idValid) {
                 cout << "ID cannot be empty.\n";
+                continue;
+            }
+            // IDs key billing idempotency, so they must never be reused
+            idValid = fulfilments.count(id) == 0 && !archive.contains(id) &&
+                none_of(prescriptions.begin(), prescriptions.end(),
+                        [&id](const unique_ptr<IPrescription>& pres) { return pres->getId() == id; });
+            if (!idValid) {
+                cout << "Prescription ID already exists.\n";
             }
         }
 
@@ -958,30 +7432,14 @@ private:
             }
         }
 
-        viewAllMedicines();
         if (medicines.empty()) {
             cout << "No medicines available to prescribe.\n";
             Utils::pause();
             return;
         }
 
-        string medicineName;
-        bool medicineExists = false;
-        int availableStock = 0;
-        
-        while (!medicineExists) {
-            medicineName = Utils::getInput("Enter medicine name: ");
-            for (const auto& med : medicines) {
-                if (Utils::toLower(med->getName()) == Utils::toLower(medicineName)) {
-                    medicineExists = true;
-                    availableStock = med->getQuantity();
-                    break;
-                }
-            }
-            if (!medicineExists) {
-                cout << "Medicine not found in inventory. Try again.\n";
-            }
-        }
+        string medicineName = promptMedicineName("Enter medicine name: ");
+        int availableStock = availableQuantity(medicineName);
 
         int quantity = 0;
         bool quantityValid = false;
@@ -998,6 +7456,10 @@ private:
         }
 
         string date = Utils::getDateInput("Enter prescription date");
+        if (!confirmInteractions(patientName, medicineName, date, nullptr)) {
+            Utils::pause();
+            return;
+        }
 
         string prescribingDoctor;
         bool doctorValid = false;
@@ -1010,10 +7472,13 @@ private:
         }
 
         try {
-            prescriptions.push_back(make_unique<Prescription>(id, patientName, medicineName, quantity, date, prescribingDoctor));
+            prescriptions.push_back(make_unique<Prescription>(move(id), move(patientName), move(medicineName),
+                                                              quantity, move(date), move(prescribingDoctor)));
+            patientHistory.add(*prescriptions.back());
             cout << "\nPrescription added successfully!\n";
             savePrescriptions();
-            FileLogger::getInstance()->log("Added prescription ID: " + id, currentUser);
+            emitPrescription(ChangeFeed::Type::PrescriptionAdded, *prescriptions.back());
+            logger->log(LogOp::AddPrescription, "Added prescription ID: " + prescriptions.back()->getId(), currentUser);
         } catch (const exception& e) {
             cout << "Error: " << e.what() << "\n";
         }
@@ -1026,15 +7491,119 @@ private:
         if (prescriptions.empty()) {
             cout << "No prescriptions found.\n";
         } else {
+            size_t idWidth = 12;
+            for (const auto& pres : prescriptions) idWidth = max(idWidth, pres->getId().size() + 1);
+            TableRenderer table({ { "#", 6 }, { "ID", idWidth }, { "Patient", 20 }, { "Medicine", 20 },
+                                  { "Qty", 6, TableRenderer::Align::Right }, { "Date", 12 }, { "Doctor", 18 },
+                                  { "Status", 8 } });
+            table.reserveRows(prescriptions.size());
             for (size_t i = 0; i < prescriptions.size(); i++) {
-                cout << "Prescription #" << i + 1 << ":\n";
-                prescriptions[i]->display();
-                cout << "-----------------\n";
+                const auto& pres = prescriptions[i];
+                table.integer(static_cast<int64_t>(i + 1)).text(pres->getId()).text(pres->getPatientName())
+                    .text(pres->getMedicineName()).integer(pres->getQuantity()).text(pres->getDate())
+                    .text(pres->getPrescribingDoctor()).text(Prescription::statusName(pres->getStatus()));
+                table.endRow();
             }
+            table.writePaged(cout, LISTING_PAGE_ROWS, continuePaging);
+        }
+        Utils::pause();
+    }
+
+    // Lists one patient's prescriptions, newest first: the active ones from the
+    // history index, then whatever the archive holds for them
+    void viewPatientHistory() {
+        Utils::clearScreen();
+        cout << "=== PATIENT HISTORY ===\n";
+        string patientName = Utils::getInput("Enter patient name: ");
+
+        struct Row {
+            int32_t day;
+            string date, id, medicine, doctor;
+            int quantity;
+            FulfilmentStatus status;
+            bool archived;
+        };
+        vector<Row> rows;
+        auto addRow = [&rows](const IPrescription& pres, bool archived) {
+            rows.push_back({ Utils::dayFromDate(pres.getDate(), 0), pres.getDate(), pres.getId(),
+                             pres.getMedicineName(), pres.getPrescribingDoctor(), pres.getQuantity(),
+                             pres.getStatus(), archived });
+        };
+        for (const auto& entry : patientHistory.history(patientName)) {
+            if (const IPrescription* pres = activePrescription(entry.id)) addRow(*pres, false);
+        }
+        archive.forEachForPatient(patientName, INT32_MIN, INT32_MAX,
+                                  [&addRow](const IPrescription& pres) { addRow(pres, true); });
+        if (rows.empty()) {
+            cout << "No prescriptions found for " << patientName << ".\n";
+            Utils::pause();
+            return;
         }
+        stable_sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) { return a.day > b.day; });
+
+        size_t idWidth = 12;
+        for (const Row& row : rows) idWidth = max(idWidth, row.id.size() + 1);
+        TableRenderer table({ { "Date", 12 }, { "ID", idWidth }, { "Medicine", 20 },
+                              { "Qty", 6, TableRenderer::Align::Right }, { "Doctor", 18 }, { "Status", 8 },
+                              { "Tier", 8 } });
+        table.reserveRows(rows.size());
+        for (const Row& row : rows) {
+            table.text(row.date).text(row.id).text(row.medicine).integer(row.quantity).text(row.doctor)
+                .text(Prescription::statusName(row.status)).text(row.archived ? "Archive" : "Active");
+            table.endRow();
+        }
+        table.writePaged(cout, LISTING_PAGE_ROWS, continuePaging);
         Utils::pause();
     }
 
+    // Checks a medicine against the patient's other prescriptions dated within
+    // RECENT_MEDICATION_DAYS of it. Every hit is shown; a major one has to be
+    // confirmed by the pharmacist, and the override goes into the log.
+    bool confirmInteractions(const string& patientName, const string& medicineName, const string& date,
+                             const IPrescription* self) {
+        struct Hit {
+            string medicine, id, date;  // Copied, since archived records do not outlive the lookup
+            const InteractionTable::Interaction* interaction;
+        };
+        vector<Hit> hits;
+        bool major = false;
+        auto check = [&](const IPrescription& other) {
+            if (&other == self) return;
+            const auto* interaction = interactions.find(medicineName, other.getMedicineName());
+            if (!interaction) return;
+            hits.push_back({ other.getMedicineName(), other.getId(), other.getDate(), interaction });
+            major = major || interaction->severity == InteractionTable::Severity::Major;
+        };
+        int32_t day = Utils::dayFromDate(date, 0);
+        int32_t fromDay = day - RECENT_MEDICATION_DAYS;
+        int32_t toDay = day + RECENT_MEDICATION_DAYS;
+        patientHistory.forEachInRange(patientName, fromDay, toDay, [&](const PatientHistoryIndex::Entry& entry) {
+            if (const IPrescription* pres = activePrescription(entry.id)) check(*pres);
+        });
+        // Recently billed prescriptions are what the patient is taking now, and those live in the archive
+        archive.forEachForPatient(patientName, fromDay, toDay, check);
+        if (hits.empty()) return true;
+
+        cout << "\nInteraction warning for " << patientName << " (" << medicineName << "):\n";
+        TableRenderer table({ { "Severity", 10 }, { "With", 20 }, { "Prescription", 14 }, { "Date", 12 },
+                              { "Note", 40 } });
+        for (const Hit& hit : hits) {
+            table.text(InteractionTable::severityName(hit.interaction->severity)).text(hit.medicine).text(hit.id)
+                .text(hit.date).text(hit.interaction->note);
+            table.endRow();
+        }
+        table.write(cout);
+        if (!major) return true;
+
+        string answer = Utils::getInput("Major interaction found. Dispense anyway? (y/n): ");
+        if (answer != "y" && answer != "Y") {
+            cout << "Cancelled.\n";
+            return false;
+        }
+        logger->log(LogOp::Other, "Overrode interaction warning: " + medicineName + " for " + patientName, currentUser);
+        return true;
+    }
+
     void updatePrescription() {
         viewAllPrescriptions();
         if (prescriptions.empty()) {
@@ -1042,14 +7611,21 @@ private:
             return;
         }
 
-        int index = Utils::getIntInput("Enter prescription number to update: ") - 1;
-        if (index < 0 || index >= static_cast<int>(prescriptions.size())) {
+        int number = Utils::getIntInput("Enter prescription number to update: ");
+        if (number < 1 || static_cast<size_t>(number) > prescriptions.size()) {
             cout << "Invalid prescription number.\n";
             Utils::pause();
             return;
         }
+        size_t index = static_cast<size_t>(number - 1);
 
         auto& pres = prescriptions[index];
+        // A billed prescription is the record of what was dispensed and paid for
+        if (pres->getStatus() == FulfilmentStatus::Billed) {
+            cout << "Prescription " << pres->getId() << " has been billed and can no longer be changed.\n";
+            Utils::pause();
+            return;
+        }
         cout << "Current details:\n";
         pres->display();
 
@@ -1064,39 +7640,28 @@ private:
              << "Enter your choice: ";
         choice = Utils::getIntInput("");
 
+        string patientName = pres->getPatientName();
+        string medicineName = pres->getMedicineName();
+        int quantity = pres->getQuantity();
+        string date = pres->getDate();
+        string doctor = pres->getPrescribingDoctor();
         try {
             switch (choice) {
                 case 1: {
                     string newName;
                     bool valid = false;
                     while (!valid) {
-                        newName = Utils::getInput("Enter new patient name: ");
+                        newName = Utils::trim(Utils::getInput("Enter new patient name: "));
                         valid = !newName.empty();
                         if (!valid) {
                             cout << "Name cannot be empty.\n";
                         }
                     }
-                    // Would need a setter in Prescription class
-                    cout << "Update functionality not fully implemented.\n";
+                    patientName = newName;
                     break;
                 }
                 case 2: {
-                    viewAllMedicines();
-                    string newMed;
-                    bool medicineExists = false;
-                    while (!medicineExists) {
-                        newMed = Utils::getInput("Enter new medicine name: ");
-                        for (const auto& med : medicines) {
-                            if (Utils::toLower(med->getName()) == Utils::toLower(newMed)) {
-                                medicineExists = true;
-                                break;
-                            }
-                        }
-                        if (!medicineExists) {
-                            cout << "Medicine not found in inventory. Try again.\n";
-                        }
-                    }
-                    cout << "Update functionality not fully implemented.\n";
+                    medicineName = promptMedicineName("Enter new medicine name: ");
                     break;
                 }
                 case 3: {
@@ -1109,146 +7674,584 @@ private:
                             cout << "Quantity must be positive.\n";
                         }
                     }
-                    cout << "Update functionality not fully implemented.\n";
+                    quantity = newQty;
                     break;
                 }
                 case 4: {
-                    string newDate = Utils::getDateInput("Enter new prescription date");
-                    cout << "Update functionality not fully implemented.\n";
+                    date = Utils::getDateInput("Enter new prescription date");
                     break;
                 }
                 case 5: {
                     string newDoctor;
                     bool valid = false;
                     while (!valid) {
-                        newDoctor = Utils::getInput("Enter new doctor's name: ");
+                        newDoctor = Utils::trim(Utils::getInput("Enter new doctor's name: "));
                         valid = !newDoctor.empty();
                         if (!valid) {
                             cout << "Doctor's name cannot be empty.\n";
                         }
                     }
-                    cout << "Update functionality not fully implemented.\n";
+                    doctor = newDoctor;
                     break;
                 }
                 case 6: return;
                 default: cout << "Invalid choice.\n"; Utils::pause(); return;
             }
 
-            savePrescriptions();
-            cout << "Prescription updated successfully.\n";
-            FileLogger::getInstance()->log("Updated prescription ID: " + pres->getId(), currentUser);
-        } catch (const exception& e) {
-            cout << "Error: " << e.what() << "\n";
+            // Saving, the change feed and the log only hear about a field that really changed
+            if (patientName == pres->getPatientName() && medicineName == pres->getMedicineName() &&
+                quantity == pres->getQuantity() && date == pres->getDate() && doctor == pres->getPrescribingDoctor()) {
+                cout << "No changes made.\n";
+                Utils::pause();
+                return;
+            }
+            if ((medicineName != pres->getMedicineName() || patientName != pres->getPatientName() ||
+                 date != pres->getDate()) &&
+                !confirmInteractions(patientName, medicineName, date, pres.get())) {
+                Utils::pause();
+                return;
+            }
+            auto updated = make_unique<Prescription>(pres->getId(), patientName, medicineName, quantity, date,
+                                                     doctor, pres->getStatus());
+            patientHistory.remove(*pres);
+            pres = move(updated);
+            patientHistory.add(*pres);
+
+            savePrescriptions();
+            emitPrescription(ChangeFeed::Type::PrescriptionUpdated, *pres);
+            cout << "Prescription updated successfully.\n";
+            logger->log(LogOp::UpdatePrescription, "Updated prescription ID: " + pres->getId(), currentUser);
+        } catch (const exception& e) {
+            cout << "Error: " << e.what() << "\n";
+        }
+        Utils::pause();
+    }
+
+    void deletePrescription() {
+        viewAllPrescriptions();
+        if (prescriptions.empty()) {
+            Utils::pause();
+            return;
+        }
+
+        int number = Utils::getIntInput("Enter prescription number to delete: ");
+        if (number < 1 || static_cast<size_t>(number) > prescriptions.size()) {
+            cout << "Invalid prescription number.\n";
+            Utils::pause();
+            return;
+        }
+        size_t index = static_cast<size_t>(number - 1);
+
+        if (prescriptions[index]->getStatus() == FulfilmentStatus::Billed) {
+            cout << "Prescription " << prescriptions[index]->getId() << " has been billed and cannot be deleted.\n";
+            Utils::pause();
+            return;
+        }
+        string presId = prescriptions[index]->getId();
+        string row = prescriptions[index]->toFileString();
+        patientHistory.remove(*prescriptions[index]);
+        prescriptions.erase(prescriptions.begin() + static_cast<ptrdiff_t>(index));
+        savePrescriptions();
+        changes.emit(ChangeFeed::Type::PrescriptionDeleted, presId, row);
+        cout << "Prescription deleted successfully.\n";
+        logger->log(LogOp::DeletePrescription, "Deleted prescription ID: " + presId, currentUser);
+        Utils::pause();
+    }
+
+    void processBilling() {
+        syncExternalChanges();
+        Utils::clearScreen();
+        cout << "=== PROCESS BILLING ===\n";
+
+        viewAllPrescriptions();
+        if (prescriptions.empty()) {
+            Utils::pause();
+            return;
+        }
+
+        int number = Utils::getIntInput("Enter prescription number to bill: ");
+        if (number < 1 || static_cast<size_t>(number) > prescriptions.size()) {
+            cout << "Invalid prescription number.\n";
+            Utils::pause();
+            return;
+        }
+        size_t index = static_cast<size_t>(number - 1);
+
+        auto& pres = prescriptions[index];
+        const string& medicineName = pres->getMedicineName();
+        int quantity = pres->getQuantity();
+
+        // The prescription ID is the idempotency key: a retried bill replays the original receipt
+        auto billed = fulfilments.find(pres->getId());
+        if (billed != fulfilments.end()) {
+            cout << "Prescription " << pres->getId() << " has already been billed.\n";
+            printReceipt(billed->second);
+            Utils::pause();
+            return;
+        }
+        // The status saved with the prescription still counts if fulfilments.txt lost the receipt
+        if (pres->getStatus() == FulfilmentStatus::Billed) {
+            cout << "Prescription " << pres->getId() << " has already been billed; its receipt is not on file.\n";
+            Utils::pause();
+            return;
+        }
+        if (billingInFlight.count(pres->getId())) {
+            cout << "Prescription " << pres->getId() << " is already being billed.\n";
+            Utils::pause();
+            return;
+        }
+
+        if (!lots.contains(medicineName)) {
+            cout << "Medicine not found in inventory.\n";
+            Utils::pause();
+            return;
+        }
+
+        string productKey = Utils::toLower(medicineName);
+        vector<const IMedicine*> expired = lots.expiredLots(medicineName);
+        for (const IMedicine* lot : expired) {
+            cout << "Lot #" << lot->getId() << " (Exp: " << lot->getExpiryDate() << ", " << lot->getQuantity()
+                 << " units) has expired and will not be dispensed.\n";
+        }
+        if (availableQuantity(medicineName) < quantity) {
+            cout << "Error: Only " << availableQuantity(medicineName) << " units available.\n";
+            Utils::pause();
+            return;
         }
-        Utils::pause();
-    }
 
-    void deletePrescription() {
-        viewAllPrescriptions();
-        if (prescriptions.empty()) {
+        // Other prescriptions may have been added since this one was checked
+        if (!confirmInteractions(pres->getPatientName(), medicineName, pres->getDate(), pres.get())) {
             Utils::pause();
             return;
         }
 
-        int index = Utils::getIntInput("Enter prescription number to delete: ") - 1;
-        if (index < 0 || index >= static_cast<int>(prescriptions.size())) {
-            cout << "Invalid prescription number.\n";
+        // Hold the stock for the whole payment so concurrent sessions cannot oversell it;
+        // the hold lapses on its own if the payment never completes
+        uint64_t holdId = reservations.reserve(productKey, quantity, RESERVATION_TIMEOUT);
+
+        // Quote from the lots FEFO dispensing would draw on, which may carry different prices
+        int64_t total = 0;
+        cout << "\n=== BILLING DETAILS ===\n"
+             << "Medicine: " << medicineName << "\n"
+             << "Quantity: " << quantity << "\n";
+        for (const auto& step : lots.planDispense(medicineName, quantity)) {
+            total += step.lot->getPriceCents() * step.quantity;
+            cout << "  Lot #" << step.lot->getId() << " (Exp: " << step.lot->getExpiryDate() << "): "
+                 << step.quantity << " x " << Utils::formatCents(step.lot->getPriceCents()) << "\n";
+        }
+        cout << "Total: " << Utils::formatCents(total) << "\n\n";
+
+        int method = Utils::getIntInput("Select payment method:\n" + PaymentMethods::menu() + "Enter choice: ");
+        if (method < 1 || method > static_cast<int>(PaymentMethods::size())) {
+            reservations.release(holdId);
+            cout << "Invalid payment method.\n";
             Utils::pause();
             return;
         }
+        const auto& strategy = PaymentMethods::at(static_cast<size_t>(method - 1));
+        PaymentRequest request = PaymentMethods::prepareRequest(strategy, total);
+
+        // Inventory is committed from the completion callback once the gateway answers;
+        // lots are chosen again at that point because the catalogue may change meanwhile
+        bool viaGateway = !request.settledLocally;
+        billingInFlight.insert(pres->getId());
+        uint64_t paymentId = payments.submit(move(request),
+            [this, prescriptionId = pres->getId(), productKey, quantity, holdId]
+            (const PaymentRequest& req, const PaymentResult& result) {
+                billingInFlight.erase(prescriptionId);
+                completeBilling(prescriptionId, productKey, quantity, holdId, req, result);
+            });
 
-        string presId = prescriptions[index]->getId();
-        prescriptions.erase(prescriptions.begin() + index);
-        savePrescriptions();
-        cout << "Prescription deleted successfully.\n";
-        FileLogger::getInstance()->log("Deleted prescription ID: " + presId, currentUser);
+        if (viaGateway) {
+            cout << "Waiting for " << PaymentMethods::getName(strategy) << " gateway...\n";
+        }
+        payments.waitFor(paymentId);
         Utils::pause();
     }
 
-    void processBilling() {
-        Utils::clearScreen();
-        cout << "=== PROCESS BILLING ===\n";
-
-        viewAllPrescriptions();
-        if (prescriptions.empty()) {
-            Utils::pause();
+    void completeBilling(const string& prescriptionId, const string& productKey, int quantity, uint64_t holdId,
+                         const PaymentRequest& request, const PaymentResult& result) {
+        cout << result.message << "\n";
+        if (!result.approved) {
+            reservations.release(holdId);
+            cout << "\nPayment failed. Transaction cancelled.\n";
             return;
         }
 
-        int index = Utils::getIntInput("Enter prescription number to bill: ") - 1;
-        if (index < 0 || index >= static_cast<int>(prescriptions.size())) {
-            cout << "Invalid prescription number.\n";
-            Utils::pause();
+        // A hold that timed out no longer guarantees the stock, so re-check what is unheld
+        bool held = reservations.commit(holdId);
+        int usable = held ? lots.totalQuantity(productKey) : availableQuantity(productKey);
+        vector<LotIndex::DispenseStep> steps;
+        if (usable >= quantity) steps = lots.dispense(productKey, quantity);
+        if (steps.empty()) {
+            cout << "\nStock changed while payment was in flight. Payment " << result.reference
+                 << " must be refunded.\n";
+            logger->log(LogEvent{ LogOp::Refund, 0, quantity, request.amountCents,
+                                  PaymentMethods::codeOf(request.method),
+                                  "Payment " + result.reference + " flagged for refund: stock unavailable" },
+                        currentUser);
             return;
         }
 
-        auto& pres = prescriptions[index];
-        string medicineName = pres->getMedicineName();
-        int quantity = pres->getQuantity();
+        const string& medicineName = steps.front().lot->getName();
+        BillingReceipt receipt{ prescriptionId, result.reference, request.method, medicineName,
+                                quantity, request.amountCents, Utils::getCurrentTimestamp(), "" };
+        for (const auto& step : steps) {
+            if (!receipt.pendingLots.empty()) receipt.pendingLots += " ";
+            receipt.pendingLots += to_string(step.lot->getId()) + ":" +
+                                   to_string(step.lot->getQuantity() + step.quantity) + ":" +
+                                   to_string(step.lot->getQuantity());
+        }
+        // Written before the stock so a restart can finish the bill instead of dispensing it again
+        appendFulfilment(receipt);
+
+        vector<const IMedicine*> dispensed;
+        dispensed.reserve(steps.size());
+        for (const auto& step : steps) dispensed.push_back(step.lot);
+        saveMedicines(dispensed);
+        for (const auto& step : steps) {
+            changes.emit(ChangeFeed::Type::StockDispensed, to_string(step.lot->getId()),
+                         to_string(step.quantity) + "," + to_string(step.lot->getQuantity()) + "," + prescriptionId);
+        }
 
-        auto medicineIt = find_if(medicines.begin(), medicines.end(),
-            [&medicineName](const unique_ptr<IMedicine>& med) {
-                return Utils::toLower(med->getName()) == Utils::toLower(medicineName);
+        string lotsUsed;
+        for (const auto& step : steps) {
+            if (!lotsUsed.empty()) lotsUsed += " ";
+            lotsUsed += "#" + to_string(step.lot->getId()) + "x" + to_string(step.quantity);
+        }
+        logger->log(LogEvent{
+            LogOp::Bill, steps.front().lot->getId(), quantity,
+            request.amountCents, PaymentMethods::codeOf(request.method),
+            "Billed " + medicineName + " x" + to_string(quantity) + 
+            ", Remaining: " + to_string(lots.totalQuantity(productKey)) + 
+            ", Method: " + request.method + ", Lots: " + lotsUsed
+        }, currentUser);
+
+        receipt.pendingLots.clear();
+        appendFulfilment(receipt);
+        fulfilments.insert_or_assign(prescriptionId, move(receipt));
+
+        auto presIt = find_if(prescriptions.begin(), prescriptions.end(),
+            [&prescriptionId](const unique_ptr<IPrescription>& pres) {
+                return pres->getId() == prescriptionId;
             });
+        if (presIt != prescriptions.end()) {
+            (*presIt)->setStatus(FulfilmentStatus::Billed);
+            savePrescriptions();
+            emitPrescription(ChangeFeed::Type::PrescriptionUpdated, **presIt);
+        }
+        
+        cout << "\nTransaction completed successfully!\n";
+    }
 
-        if (medicineIt == medicines.end()) {
-            cout << "Medicine not found in inventory.\n";
+    string medicineNameById(int id) const {
+        for (const auto& med : medicines) {
+            if (med->getId() == id) return med->getName();
+        }
+        return "#" + to_string(id) + " (removed)";
+    }
+
+    void inventoryValuationReport() {
+        Utils::clearScreen();
+        cout << "=== INVENTORY VALUATION ===\n";
+        shared_ptr<const InventorySnapshot> view = inventory.acquire();
+        auto started = chrono::steady_clock::now();
+        InventoryValuation valuation = InventoryValuation::compute(*view, Utils::localDay(time(nullptr)), 30);
+        auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - started);
+
+        using Align = TableRenderer::Align;
+        TableRenderer summary({ { "Measure", 34 }, { "Value", 18, Align::Right } });
+        summary.text("Units in stock").integer(valuation.totalUnits);
+        summary.endRow();
+        summary.text("Total stock value").text(Utils::formatCents(valuation.totalCents));
+        summary.endRow();
+        summary.text("Already expired").text(Utils::formatCents(valuation.expiredCents));
+        summary.endRow();
+        summary.text("At risk (expires within 30 days)").text(Utils::formatCents(valuation.atRiskCents));
+        summary.endRow();
+        summary.write(cout);
+
+        cout << "\nValue by unit price band:\n";
+        TableRenderer bands({ { "Price band", 26 }, { "Units", 12, Align::Right }, { "Value", 18, Align::Right },
+                              { "Share", 8, Align::Right } });
+        for (size_t band = 0; band < InventoryValuation::BANDS; ++band) {
+            double share = valuation.totalCents > 0
+                ? 100.0 * static_cast<double>(valuation.bandCents[band]) / static_cast<double>(valuation.totalCents) : 0.0;
+            bands.text(InventoryValuation::bandLabel(band)).integer(valuation.bandUnits[band])
+                .text(Utils::formatCents(valuation.bandCents[band])).decimal(share, 1);
+            bands.endRow();
+        }
+        bands.write(cout);
+        cout << "\nValued " << view->lots.size() << " lots (inventory version " << view->version << ") in "
+             << elapsed.count() << " us.\n";
+        Utils::pause();
+    }
+
+    // Stock at the end of a past day, rebuilt from the inventory history.
+    // Giving a second day compares the two per product instead.
+    void inventoryAsOfMenu() {
+        Utils::clearScreen();
+        cout << "=== INVENTORY AS OF ===\n";
+        string first = Utils::getDateInput("As of date");
+        string second = Utils::getInput("Compare with (YYYY-MM-DD, blank for none): ");
+        if (!second.empty() && !Utils::isValidDate(second)) {
+            cout << "Invalid date.\n";
+            Utils::pause();
+            return;
+        }
+        string filter = Utils::toLower(Utils::getInput("Medicine (blank for all): "));
+        auto matches = [&filter](const InventoryHistory::Lot& lot) {
+            return filter.empty() || Utils::toLower(lot.name) == filter;
+        };
+
+        auto start = chrono::steady_clock::now();
+        InventoryHistory::State then = history.stateAt(Utils::parseTimestamp(first + " 23:59:59"));
+        InventoryHistory::State later;
+        if (!second.empty()) later = history.stateAt(Utils::parseTimestamp(second + " 23:59:59"));
+        double millis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        if (second.empty()) {
+            cout << "\n--- Stock at end of " << first << " ---\n";
+            TableRenderer table({ { "Lot", 6 }, { "Medicine", 25 }, { "Quantity", 10, TableRenderer::Align::Right },
+                                  { "Expiry Date", 12 }, { "Price", 12, TableRenderer::Align::Right } });
+            int64_t units = 0;
+            for (const auto& [id, lot] : then) {
+                if (!matches(lot)) continue;
+                table.integer(id).text(lot.name).integer(lot.quantity).text(lot.expiryDate)
+                    .text(Utils::formatCents(lot.priceCents));
+                table.endRow();
+                units += lot.quantity;
+            }
+            table.writePaged(cout, LISTING_PAGE_ROWS, continuePaging);
+            cout << "Total units: " << units << "\n";
+        } else {
+            // Products are compared by summing their lots on each day
+            struct Change {
+                string name;
+                int64_t before = 0;
+                int64_t after = 0;
+            };
+            map<string, Change> products;
+            for (const auto& [id, lot] : then) {
+                if (!matches(lot)) continue;
+                Change& change = products[Utils::toLower(lot.name)];
+                change.name = lot.name;
+                change.before += lot.quantity;
+            }
+            for (const auto& [id, lot] : later) {
+                if (!matches(lot)) continue;
+                Change& change = products[Utils::toLower(lot.name)];
+                change.name = lot.name;
+                change.after += lot.quantity;
+            }
+            cout << "\n--- Stock at end of " << first << " vs " << second << " ---\n";
+            TableRenderer table({ { "Medicine", 25 }, { first, 12, TableRenderer::Align::Right },
+                                  { second, 12, TableRenderer::Align::Right },
+                                  { "Change", 10, TableRenderer::Align::Right } });
+            for (const auto& entry : products) {
+                const Change& change = entry.second;
+                int64_t delta = change.after - change.before;
+                table.text(change.name).integer(change.before).integer(change.after)
+                    .text((delta > 0 ? "+" : "") + to_string(delta));
+                table.endRow();
+            }
+            table.writePaged(cout, LISTING_PAGE_ROWS, continuePaging);
+        }
+        cout << "(rebuilt in " << fixed << setprecision(2) << millis << " ms)\n";
+        logger->log(LogOp::Report, "Viewed inventory as of " + first + (second.empty() ? "" : " vs " + second),
+                    currentUser);
+        Utils::pause();
+    }
+
+    // Replicas attached to this store and how far each is behind
+    void replicationStatus() {
+        Utils::clearScreen();
+        cout << "=== REPLICATION STATUS ===\n";
+        if (!replication || !replication->listening()) {
+            cout << "Replication is off: another process is already serving this data root, "
+                 << "or local sockets are unavailable.\n";
             Utils::pause();
             return;
         }
+        uint64_t sequence = replication->sequence();
+        vector<ReplicationPublisher::ReplicaStatus> replicas = replication->status();
+        cout << "Socket: " << replication->path() << "\n"
+             << "Latest change: #" << sequence << "\n"
+             << "Change feed: event #" << changes.sequence() << ", " << changes.socketConsumers()
+             << " socket consumer(s)" << (changes.listening() ? "" : " (socket off)") << "\n\n";
+        if (replicas.empty()) {
+            cout << "No replicas connected.\n";
+        } else {
+            using Align = TableRenderer::Align;
+            TableRenderer table({ { "Replica", 8 }, { "Applied", 10, Align::Right }, { "Behind", 8, Align::Right },
+                                  { "Lag (ms)", 10, Align::Right }, { "Queued bytes", 13, Align::Right } });
+            for (const auto& replica : replicas) {
+                table.integer(replica.id).integer(static_cast<int64_t>(replica.ackedSequence))
+                    .integer(static_cast<int64_t>(sequence - min(sequence, replica.ackedSequence)))
+                    .decimal(replica.lagMillis, 2).integer(static_cast<int64_t>(replica.queuedBytes));
+                table.endRow();
+            }
+            table.flushTo(cout);
+        }
+        Utils::pause();
+    }
 
-        if ((*medicineIt)->getQuantity() < quantity) {
-            cout << "Error: Only " << (*medicineIt)->getQuantity() << " units available.\n";
+    void salesAnalyticsMenu() {
+        Utils::clearScreen();
+        cout << "=== SALES ANALYTICS ===\n";
+        int32_t firstDay = 0, lastDay = 0;
+        if (!analytics.bounds(firstDay, lastDay)) {
+            cout << "No sales recorded yet.\n";
+            Utils::pause();
+            return;
+        }
+        string from = Utils::getInput("From (YYYY-MM-DD, blank for first sale): ");
+        string to = Utils::getInput("Up to (YYYY-MM-DD, blank for today): ");
+        int32_t fromDay = Utils::dayFromDate(from, firstDay);
+        int32_t toDay = Utils::dayFromDate(to, max(lastDay, Utils::localDay(time(nullptr))));
+        if (toDay < fromDay) {
+            cout << "The end date is before the start date.\n";
             Utils::pause();
             return;
         }
+        int32_t dayCount = toDay - fromDay + 1;
+
+        cout << "\n--- Daily Revenue (" << Utils::dayLabel(fromDay) << " to " << Utils::dayLabel(toDay) << ") ---\n"
+             << left << setw(12) << "Date" << right << setw(8) << "Bills" << setw(8) << "Units"
+             << setw(14) << "Revenue" << "\n";
+        for (const auto& day : analytics.dailyRevenue(fromDay, toDay)) {
+            cout << left << setw(12) << Utils::dayLabel(day.day) << right << setw(8) << day.bills
+                 << setw(8) << day.units << setw(14) << Utils::formatCents(day.revenueCents) << "\n";
+        }
 
-        float total = (*medicineIt)->getPrice() * quantity;
-        cout << "\n=== BILLING DETAILS ===\n"
-             << "Medicine: " << (*medicineIt)->getName() << "\n"
-             << "Quantity: " << quantity << "\n"
-             << "Price per unit: $" << fixed << setprecision(2) << (*medicineIt)->getPrice() << "\n"
-             << "Total: $" << fixed << setprecision(2) << total << "\n\n";
-
-        unique_ptr<IBillingStrategy> strategy;
-        int method = Utils::getIntInput("Select payment method:\n1. Cash\n2. GCash\n3. PayMaya\nEnter choice: ");
-        switch (method) {
-            case 1: strategy = make_unique<CashBilling>(); break;
-            case 2: strategy = make_unique<GCashBilling>(); break;
-            case 3: strategy = make_unique<PayMayaBilling>(); break;
-            default: 
-                cout << "Invalid payment method.\n";
-                Utils::pause();
-                return;
+        cout << "\n--- Top Selling Medicines ---\n";
+        for (const auto& med : analytics.topMedicines(fromDay, toDay, 10)) {
+            cout << left << setw(30) << med.name << right << setw(8) << med.units
+                 << setw(14) << Utils::formatCents(med.revenueCents) << "\n";
         }
 
-        if (strategy->processPayment(total)) {
-            (*medicineIt)->setQuantity((*medicineIt)->getQuantity() - quantity);
-            saveMedicines();
-            
-            FileLogger::getInstance()->log(
-                "Billed " + (*medicineIt)->getName() + " x" + to_string(quantity) + 
-                ", Remaining: " + to_string((*medicineIt)->getQuantity()) + 
-                ", Method: " + strategy->getName(),
-                currentUser
-            );
-            
-            cout << "\nTransaction completed successfully!\n";
-        } else {
-            cout << "\nPayment failed. Transaction cancelled.\n";
+        cout << "\n--- Pharmacist Throughput ---\n";
+        for (const auto& user : analytics.pharmacistThroughput(fromDay, toDay)) {
+            cout << left << setw(20) << user.name << right << setw(8) << user.bills << " bills"
+                 << setw(14) << Utils::formatCents(user.revenueCents)
+                 << setw(10) << fixed << setprecision(1) << static_cast<double>(user.bills) / dayCount << "/day\n";
+        }
+
+        // Velocity is units sold per calendar day in the range; cover is how long current stock lasts at that pace
+        cout << "\n--- Stock Velocity ---\n"
+             << left << setw(30) << "Medicine" << right << setw(10) << "Units/day" << setw(8) << "Stock"
+             << setw(14) << "Days of cover" << "\n";
+        shared_ptr<const InventorySnapshot> view = inventory.acquire();
+        for (const auto& product : view->products) {
+            const string& name = view->lots[product.second.front()].name;
+            int64_t sold = analytics.unitsSold(name, fromDay, toDay);
+            double perDay = static_cast<double>(sold) / dayCount;
+            int stock = view->totalQuantity(name) - reservations.held(product.first);
+            cout << left << setw(30) << name << right << setw(10) << fixed << setprecision(2) << perDay
+                 << setw(8) << stock << setw(14);
+            if (perDay > 0) cout << setprecision(1) << stock / perDay;
+            else cout << "-";
+            cout << "\n";
+        }
+        Utils::pause();
+    }
+
+    void transactionQueryMenu() {
+        Utils::clearScreen();
+        cout << "=== TRANSACTION QUERIES ===\n"
+             << "1. Revenue by payment method per day\n"
+             << "2. Units dispensed by medicine\n"
+             << "3. Records by operation\n"
+             << "4. Activity by user\n"
+             << "5. Back\n";
+        int choice = Utils::getIntInput("Enter your choice: ");
+        if (choice < 1 || choice > 4) return;
+        string from = Utils::getInput("From (YYYY-MM-DD, blank for all): ");
+        string to = Utils::getInput("Up to (YYYY-MM-DD, blank for all): ");
+        cout << "\n";
+        runQuery(TransactionQuery::QUERIES[choice - 1], from, to, cout);
+        Utils::pause();
+    }
+
+    // Fires a batch of simulated GCash/PayMaya payments through the pipeline to measure throughput
+    void runPaymentSimulation() {
+        Utils::clearScreen();
+        cout << "=== PAYMENT GATEWAY SIMULATOR ===\n";
+        const auto& config = payments.getGatewayConfig();
+        cout << "Latency: " << config.latencyMs << "ms (+/- " << config.jitterMs << "ms), "
+             << "Failure rate: " << fixed << setprecision(2) << config.failureRate * 100 << "%\n";
+
+        int count = 0;
+        while (count <= 0) {
+            count = Utils::getIntInput("Number of payments to simulate: ");
+            if (count <= 0) cout << "Count must be positive.\n";
         }
+
+        size_t approved = 0;
+        size_t declined = 0;
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < count; i++) {
+            string_view method = (i % 2 == 0) ? GCashBilling::getName() : PayMayaBilling::getName();
+            payments.submit(PaymentRequest{ string(method), "SIM-" + to_string(i), 100, false },
+                [&approved, &declined](const PaymentRequest&, const PaymentResult& result) {
+                    result.approved ? approved++ : declined++;
+                });
+        }
+        payments.waitAll();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        cout << "Completed " << count << " payments in " << fixed << setprecision(3) << seconds << "s ("
+             << setprecision(1) << (seconds > 0 ? count / seconds : 0.0) << " payments/s)\n"
+             << "Approved: " << approved << ", Declined: " << declined << "\n";
+        logger->log("Ran payment gateway simulation (" + to_string(count) + " payments)", currentUser);
         Utils::pause();
     }
 
 public:
-    PharmacySystem() {
+    explicit PharmacySystem(string root = "")
+        : dataRoot(move(root)), logger(FileLogger::getInstance(dataRoot)),
+          payments(SimulatedPaymentGateway::Config::load(dataFile("gateway_config.txt"))),
+          fulfilmentSums(dataFile("fulfilments.txt")),
+          archive(dataFile("prescriptions_archive.dat"), dataFile("prescriptions_archive.idx")),
+          medicinesWatcher(dataFile("medicines.txt")), history(dataFile("inventory_history")),
+          changes(dataFile("changes.log"), dataFile("changes.idx"), dataFile("changes.sock")) {
+        vector<string> changedFiles = verifyDataFiles();  // Only those without damage
+        users = make_unique<FileUserStore>(dataFile("users.txt"));
         loadMedicines();
         loadPrescriptions();
+        loadFulfilments();
+        finishInterruptedBills();
+        // Whatever the loaders kept is the files' content from here on
+        for (const auto& path : changedFiles) {
+            if (!BlockChecksums::unchanged(path)) BlockChecksums::seal(path);
+        }
+        if (!interactions.load(dataFile("interactions.txt"))) {
+            cerr << "Note: " << dataFile("interactions.txt") << " is missing, so prescriptions are not checked for "
+                 << "drug interactions; write one, or start from the built-in table with --import-interactions\n";
+        }
+        analytics.rebuild(*logger);
+        analytics.forEachMedicineDay([this](const string& name, int32_t day, int64_t units) {
+            forecaster.recordSale(name, day, units);
+        });
+        analyticsListener = logger->subscribe(
+            [this](const TransactionRecord& record, string_view action, string_view user) {
+                analytics.record(record, action, user);
+                if (record.op == LogOp::Bill) {
+                    forecaster.recordSale(SalesAnalytics::billedMedicine(action), Utils::localDay(record.timestamp),
+                                          record.quantity);
+                }
+            });
+        replication = make_unique<ReplicationPublisher>(dataFile("replication.sock"));
+        replication->seed(*inventory.acquire(), prescriptions);
     }
 
-    ~PharmacySystem() override = default;
+    ~PharmacySystem() override {
+        stopHousekeeping();
+        logger->unsubscribe(analyticsListener);
+    }
 
     void run() override {
+        startHousekeeping();
         bool programRunning = true;
         
         while (programRunning) {
@@ -1272,7 +8275,14 @@ public:
             // Main menu loop
             bool sessionActive = true;
             while (sessionActive) {
-                if (currentRole == "Admin") {
+                SessionCache::Session session;
+                sessions.validate(sessionToken, session);
+                bool admin = hasRole(session.roles, Role::Admin);
+                if (admin && hasRole(session.roles, Role::Pharmacist)) {
+                    string menu = Utils::getInput("Open the (a)dmin or (p)harmacist menu? ");
+                    admin = menu != "p" && menu != "P";
+                }
+                if (admin) {
                     adminMenu();
                 } else {
                     pharmacistMenu();
@@ -1280,7 +8290,9 @@ public:
                 
                 // User chose to logout
                 cout << "Logging out... tip: Be sure to save your work and adhere to pharmacy policy\n";
-                FileLogger::getInstance()->log("Logged out", currentUser);
+                logger->log(LogOp::Logout, "Logged out", currentUser);
+                sessions.revoke(sessionToken);
+                sessionToken.clear();
                 
                 // Prompt for relogin or exit
                 string choice;
@@ -1297,13 +8309,540 @@ public:
             }
         }
         
+        // Shutdown hook: nothing scheduled for this store may outlive the session
+        stopHousekeeping();
         cout << "Thank you for using the Pharmacy Management System. Goodbye!\n";
     }
 };
 
-int main() {
-    unique_ptr<IPharmacySystem> system = make_unique<PharmacySystem>();
+// Hosts many branches in one process. Each store is a shard with its own data
+// root and in-memory state; cross-store queries fan out to every shard in parallel.
+class MultiStorePharmacy : public IPharmacySystem {
+private:
+    struct Store {
+        string name;
+        string dataRoot;
+        unique_ptr<PharmacySystem> system;
+    };
+
+    vector<Store> stores;
+
+    // Each line of the config is "store name=data root directory"
+    void loadStores(const string& configPath) {
+        ifstream config(configPath);
+        string line;
+        while (getline(config, line)) {
+            size_t eq = line.find('=');
+            if (line.empty() || line[0] == '#' || eq == string::npos) continue;
+            string name = Utils::trim(line.substr(0, eq));
+            string root = Utils::trim(line.substr(eq + 1));
+            if (!name.empty()) stores.push_back(Store{ move(name), move(root), nullptr });
+        }
+
+        // Shards load independently, so they are read from disk concurrently
+        vector<future<unique_ptr<PharmacySystem>>> loading;
+        for (const auto& store : stores) {
+            loading.push_back(async(launch::async, [root = store.dataRoot]() {
+                return make_unique<PharmacySystem>(root);
+            }));
+        }
+        for (size_t i = 0; i < stores.size(); i++) {
+            stores[i].system = loading[i].get();
+        }
+    }
+
+    // Runs query against every shard on its own thread; results come back in store order
+    template <typename Query>
+    auto queryAll(Query query) -> vector<decltype(query(declval<PharmacySystem&>()))> {
+        using Result = decltype(query(declval<PharmacySystem&>()));
+        vector<future<Result>> pending;
+        for (auto& store : stores) {
+            pending.push_back(async(launch::async, [&store, &query]() { return query(*store.system); }));
+        }
+        vector<Result> results;
+        for (auto& f : pending) results.push_back(f.get());
+        return results;
+    }
+
+    void findMedicineAcrossStores() {
+        Utils::clearScreen();
+        cout << "=== FIND MEDICINE ACROSS STORES ===\n";
+        string name = Utils::getInput("Enter medicine name: ");
+        vector<int> stock = queryAll([&name](PharmacySystem& store) { return store.stockOf(name); });
+
+        bool found = false;
+        for (size_t i = 0; i < stores.size(); i++) {
+            if (stock[i] > 0) {
+                cout << "- " << stores[i].name << ": " << stock[i] << " units available\n";
+                found = true;
+            }
+        }
+        if (!found) cout << "No store has " << name << " in stock.\n";
+        Utils::pause();
+    }
+
+    void generateCombinedComplianceReport() {
+        vector<string> sections = queryAll([](PharmacySystem& store) {
+            ostringstream section;
+            store.writeComplianceSections(section);
+            return section.str();
+        });
+
+        ofstream reportFile("combined_compliance_report.txt");
+        if (!reportFile.is_open()) {
+            cout << "Error creating combined compliance report.\n";
+            Utils::pause();
+            return;
+        }
+        reportFile << "Combined Compliance Report - " << Utils::getCurrentTimestamp().substr(0, 10) << "\n";
+        reportFile << "========================================\n";
+        for (size_t i = 0; i < stores.size(); i++) {
+            reportFile << "\n=== Store: " << stores[i].name << " ===\n" << sections[i];
+        }
+        reportFile.close();
+
+        cout << "\n=== Combined Compliance Report ===\n";
+        ifstream report("combined_compliance_report.txt");
+        string line;
+        while (getline(report, line)) cout << line << "\n";
+        Utils::pause();
+    }
+
+    void selectStore() {
+        Utils::clearScreen();
+        cout << "=== SELECT STORE ===\n";
+        for (size_t i = 0; i < stores.size(); i++) {
+            cout << i + 1 << ". " << stores[i].name << " (" << stores[i].dataRoot << ")\n";
+        }
+        int index = Utils::getIntInput("Enter store number: ") - 1;
+        if (index < 0 || index >= static_cast<int>(stores.size())) {
+            cout << "Invalid store number.\n";
+            Utils::pause();
+            return;
+        }
+        stores[static_cast<size_t>(index)].system->run();
+    }
+
+public:
+    explicit MultiStorePharmacy(const string& configPath) {
+        loadStores(configPath);
+    }
+
+    ~MultiStorePharmacy() override = default;
+
+    void run() override {
+        if (stores.empty()) {
+            cout << "No stores configured.\n";
+            return;
+        }
+
+        bool running = true;
+        while (running) {
+            Utils::clearScreen();
+            cout << "=== MULTI-STORE PHARMACY (" << stores.size() << " stores) ===\n"
+                 << "1. Open Store\n"
+                 << "2. Find Medicine Across Stores\n"
+                 << "3. Combined Compliance Report\n"
+                 << "4. Exit\n"
+                 << "Enter your choice: ";
+            int choice = Utils::getIntInput("");
+
+            switch (choice) {
+                case 1: selectStore(); break;
+                case 2: findMedicineAcrossStores(); break;
+                case 3: generateCombinedComplianceReport(); break;
+                case 4: running = false; break;
+                default: cout << "Invalid choice. Please try again.\n"; Utils::pause();
+            }
+        }
+    }
+};
+
+// Read-only copy of a store, fed by that store's ReplicationPublisher. A
+// background thread applies the stream as it arrives and acknowledges it;
+// the menu serves listings, searches and the stock sections of the
+// compliance report from the copy, so reporting load never reaches the
+// primary process. Reconnects, with a full resync, if the primary restarts.
+class ReplicaSystem : public IPharmacySystem {
+private:
+    string socketPath;
+    FileUserStore users;  // The primary's accounts, read but never rewritten
+    mutex stateMutex;  // Guards lots and prescriptions against the follower thread
+    map<int, InventorySnapshot::Lot> lots;
+    map<string, unique_ptr<IPrescription>> prescriptions;
+    InventoryVersions inventory;
+    MedicineSearchIndex searchIndex;
+
+    thread follower;
+    atomic<bool> stopping{ false };
+    int wakePipe[2] = { -1, -1 };
+
+    atomic<bool> connected{ false };
+    atomic<bool> synced{ false };
+    atomic<uint64_t> appliedSequence{ 0 };
+    atomic<uint64_t> primarySequence{ 0 };  // Newest sequence the primary has announced
+    atomic<int64_t> lastLagMicros{ 0 };
+    atomic<int64_t> maxLagMicros{ 0 };
+    atomic<int64_t> lastHeardMicros{ 0 };
+    atomic<uint64_t> resyncs{ 0 };
+    bool publishPending = false;  // Follower thread only: lot changes not yet in a snapshot
+    int64_t lastPublishMicros = 0;
+
+    static constexpr int RECONNECT_MILLIS = 1000;
+    static constexpr int PUBLISH_INTERVAL_MILLIS = 100;  // Least time between snapshots while changes stream in
+
+    static int64_t nowMicros() {
+        return chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    void follow() {
+        string buffer;
+        vector<char> chunk(1 << 16);
+        while (!stopping) {
+            int fd = LocalSocket::connectTo(socketPath);
+            if (fd < 0) {
+                LocalSocket::waitReadable(-1, wakePipe[0], RECONNECT_MILLIS);
+                continue;
+            }
+            connected = true;
+            buffer.clear();
+            while (!stopping) {
+                if (!LocalSocket::waitReadable(fd, wakePipe[0], publishPending ? PUBLISH_INTERVAL_MILLIS : RECONNECT_MILLIS)) {
+                    publishIfDue(false);
+                    continue;
+                }
+                long got = LocalSocket::receive(fd, chunk.data(), chunk.size());
+                if (got < 0) break;
+                if (got == 0) continue;
+                buffer.append(chunk.data(), static_cast<size_t>(got));
+                size_t consumed = apply(buffer);
+                buffer.erase(0, consumed);
+                string ack = "A," + to_string(appliedSequence.load()) + "," + to_string(lastLagMicros.load()) + "\n";
+                if (!LocalSocket::sendAll(fd, ack)) break;
+            }
+            connected = false;
+            synced = false;
+            LocalSocket::closeFd(fd);
+        }
+    }
+
+    // Applies every complete line in the buffer; returns how many bytes were used
+    size_t apply(const string& buffer) {
+        size_t consumed = 0;
+        bool lotsChanged = false;
+        bool syncFinished = false;
+        {
+            lock_guard<mutex> lock(stateMutex);
+            size_t newline;
+            while ((newline = buffer.find('\n', consumed)) != string::npos) {
+                string_view line(buffer.data() + consumed, newline - consumed);
+                consumed = newline + 1;
+                string_view kind = Utils::nextField(line);
+                string_view sequenceText = Utils::nextField(line);
+                string_view sentText = Utils::nextField(line);
+                uint64_t sequence = 0;
+                int64_t sentAt = 0;
+                from_chars(sequenceText.data(), sequenceText.data() + sequenceText.size(), sequence);
+                from_chars(sentText.data(), sentText.data() + sentText.size(), sentAt);
+                int64_t now = nowMicros();
+                lastHeardMicros = now;
+                if (sequence > primarySequence) primarySequence = sequence;
+                if (kind == "H") continue;
+
+                if (kind == "B") {
+                    lots.clear();
+                    prescriptions.clear();
+                    synced = false;
+                    lotsChanged = true;
+                } else if (kind == "R") {
+                    synced = true;
+                    syncFinished = true;
+                    resyncs++;
+                } else if (kind == "I") {
+                    int64_t at = 0;
+                    char op = 0;
+                    InventoryHistory::Lot lot;
+                    if (!InventoryHistory::parseDelta(line, at, op, lot)) continue;
+                    if (op == 'D') lots.erase(lot.id);
+                    else lots[lot.id] = move(lot);
+                    lotsChanged = true;
+                } else if (kind == "P") {
+                    string_view op = Utils::nextField(line);
+                    if (op == "D") {
+                        prescriptions.erase(string(line));
+                    } else {
+                        try {
+                            unique_ptr<IPrescription> pres = Prescription::fromFileString(line);
+                            string id = pres->getId();
+                            prescriptions[id] = move(pres);
+                        } catch (const exception&) {
+                            cerr << "Replica: skipped an unreadable prescription\n";
+                        }
+                    }
+                }
+                appliedSequence = sequence;
+                lastLagMicros = now - sentAt;
+                if (lastLagMicros > maxLagMicros) maxLagMicros = lastLagMicros.load();
+            }
+        }
+        if (lotsChanged) publishPending = true;
+        publishIfDue(syncFinished);
+        return consumed;
+    }
+
+    // A resync is published once, when its last lot has arrived; after that
+    // a burst of changes makes a snapshot at most every PUBLISH_INTERVAL_MILLIS,
+    // and the follower's idle wake-up publishes whatever is left
+    void publishIfDue(bool syncFinished) {
+        if (!publishPending || !synced) return;
+        int64_t now = nowMicros();
+        if (!syncFinished && now - lastPublishMicros < PUBLISH_INTERVAL_MILLIS * 1000) return;
+        publish();
+        publishPending = false;
+        lastPublishMicros = now;
+    }
+
+    // Queries read published snapshots, never the follower's working maps
+    void publish() {
+        vector<unique_ptr<IMedicine>> medicines;
+        {
+            lock_guard<mutex> lock(stateMutex);
+            medicines.reserve(lots.size());
+            for (const auto& entry : lots) {
+                const auto& lot = entry.second;
+                try {
+                    medicines.push_back(make_unique<Medicine>(lot.name, lot.quantity, lot.expiryDate,
+                                                              lot.priceCents, lot.id));
+                } catch (const exception&) {
+                    cerr << "Replica: skipped an unreadable lot\n";
+                }
+            }
+        }
+        inventory.publish(medicines);
+    }
+
+    void viewMedicines() {
+        Utils::clearScreen();
+        cout << "=== ALL MEDICINES (replica) ===\n";
+        shared_ptr<const InventorySnapshot> view = inventory.acquire();
+        if (view->lots.empty()) {
+            cout << "No medicines found.\n";
+            Utils::pause();
+            return;
+        }
+        TableRenderer table({ { "ID", 6 }, { "Medicine Name", 26 }, { "Quantity", 11 },
+                              { "Expiry Date", 16 }, { "Price", 11 } });
+        table.reserveRows(view->lots.size());
+        for (const auto& lot : view->lots) {
+            table.integer(lot.id).text(lot.name).integer(lot.quantity).text(lot.expiryDate)
+                .text(Utils::formatCents(lot.priceCents));
+            table.endRow();
+        }
+        table.writePaged(cout, PharmacySystem::LISTING_PAGE_ROWS, PharmacySystem::continuePaging);
+        cout << "\nTotal medicines: " << view->lots.size() << "\n";
+        Utils::pause();
+    }
+
+    void viewPrescriptions() {
+        Utils::clearScreen();
+        cout << "=== ALL PRESCRIPTIONS (replica) ===\n";
+        unique_lock<mutex> lock(stateMutex);
+        size_t idWidth = 12;
+        for (const auto& entry : prescriptions) idWidth = max(idWidth, entry.second->getId().size() + 1);
+        TableRenderer table({ { "#", 6 }, { "ID", idWidth }, { "Patient", 20 }, { "Medicine", 20 },
+                              { "Qty", 6, TableRenderer::Align::Right }, { "Date", 12 }, { "Doctor", 18 },
+                              { "Status", 8 } });
+        table.reserveRows(prescriptions.size());
+        int64_t number = 1;
+        for (const auto& entry : prescriptions) {
+            const IPrescription& pres = *entry.second;
+            table.integer(number++).text(pres.getId()).text(pres.getPatientName()).text(pres.getMedicineName())
+                .integer(pres.getQuantity()).text(pres.getDate()).text(pres.getPrescribingDoctor())
+                .text(Prescription::statusName(pres.getStatus()));
+            table.endRow();
+        }
+        lock.unlock();
+        if (table.rows() == 0) cout << "No prescriptions found.\n";
+        else table.writePaged(cout, PharmacySystem::LISTING_PAGE_ROWS, PharmacySystem::continuePaging);
+        Utils::pause();
+    }
+
+    void searchMedicines() {
+        Utils::clearScreen();
+        cout << "=== SEARCH MEDICINES (replica) ===\n";
+        string query = Utils::getInput("Name or part of a name: ");
+        shared_ptr<const InventorySnapshot> view = inventory.acquire();
+        searchIndex.refresh(*view);
+        vector<MedicineSearchIndex::Match> matches = searchIndex.search(query, 10);
+        if (matches.empty()) {
+            cout << "No matching medicines.\n";
+        }
+        for (const auto& match : matches) {
+            cout << "- " << match.name << " (" << view->totalQuantity(match.name) << " in stock)"
+                 << (match.distance > 0 ? "  [close match]" : "") << "\n";
+        }
+        Utils::pause();
+    }
+
+    void stockReport() {
+        Utils::clearScreen();
+        cout << "=== STOCK REPORT (replica) ===\n";
+        PharmacySystem::writeStockSections(cout, *inventory.acquire());
+        cout << "Demand forecasts need the sales log and are only in the primary's compliance report.\n";
+        Utils::pause();
+    }
+
+    void replicationStatus() {
+        Utils::clearScreen();
+        cout << "=== REPLICATION STATUS ===\n";
+        uint64_t applied = appliedSequence;
+        uint64_t announced = primarySequence;
+        int64_t heard = lastHeardMicros;
+        cout << "Primary socket: " << socketPath << "\n"
+             << "Connected: " << (connected ? "yes" : "no") << (connected && !synced ? " (syncing)" : "") << "\n"
+             << "Applied sequence: " << applied << "\n"
+             << "Primary sequence: " << announced << " (" << (announced > applied ? announced - applied : 0)
+             << " behind)\n"
+             << fixed << setprecision(2)
+             << "Last apply lag: " << static_cast<double>(lastLagMicros) / 1000.0 << " ms\n"
+             << "Worst apply lag: " << static_cast<double>(maxLagMicros) / 1000.0 << " ms\n"
+             << "Last heard from primary: "
+             << (heard == 0 ? string("never") : to_string((nowMicros() - heard) / 1000) + " ms ago") << "\n"
+             << "Full syncs: " << resyncs << "\n";
+        Utils::pause();
+    }
+
+public:
+    // Follows the primary whose data lives in primaryRoot, and logs in against its accounts
+    explicit ReplicaSystem(const string& primaryRoot)
+        : socketPath(Utils::dataPath(primaryRoot, "replication.sock")),
+          users(Utils::dataPath(primaryRoot, "users.txt"), true) {
+        LocalSocket::openWakePipe(wakePipe);
+        follower = thread(&ReplicaSystem::follow, this);
+    }
+
+    ~ReplicaSystem() override {
+        stopping = true;
+        LocalSocket::wake(wakePipe[1]);
+        if (follower.joinable()) follower.join();
+        LocalSocket::closeFd(wakePipe[0]);
+        LocalSocket::closeFd(wakePipe[1]);
+    }
+
+    void run() override {
+        Utils::clearScreen();
+        cout << "=== PHARMACY REPLICA (read-only) ===\n";
+        string username = Utils::getInput("Username: ");
+        string password = Utils::getInput("Password: ");
+        if (users.authenticate(username, password) == 0) {
+            cout << "Invalid username or password.\n";
+            return;
+        }
+        if (users.passwordExpired(username)) {
+            cout << "This account still has its initial password; change it on the primary first.\n";
+            return;
+        }
+
+        bool running = true;
+        while (running) {
+            Utils::clearScreen();
+            cout << "=== PHARMACY REPLICA (read-only) ===\n"
+                 << "1. View Medicines\n"
+                 << "2. View Prescriptions\n"
+                 << "3. Search Medicines\n"
+                 << "4. Stock Report\n"
+                 << "5. Replication Status\n"
+                 << "6. Exit\n"
+                 << "Enter your choice: ";
+            int choice = Utils::getIntInput("");
+
+            switch (choice) {
+                case 1: viewMedicines(); break;
+                case 2: viewPrescriptions(); break;
+                case 3: searchMedicines(); break;
+                case 4: stockReport(); break;
+                case 5: replicationStatus(); break;
+                case 6: running = false; break;
+                default: cout << "Invalid choice. Please try again.\n"; Utils::pause();
+            }
+        }
+    }
+};
+
+// The bench and test programs include this file for its classes and bring their own main
+#ifndef PHARMACY_NO_MAIN
+int main(int argc, char* argv[]) {
+    // --data-root <dir> runs a single store from another directory;
+    // --stores <config> hosts every branch listed in the config file;
+    // --replica <dir> opens a read-only copy of the store running from that directory;
+    // --verify <dir> checks a data root's files against their checksums, --repair <dir> also fixes them;
+    // --changes <dir> [--after <sequence>] prints the store's change feed as it grows
+    // --import-interactions <dir> writes the built-in drug interaction table into a store that has none;
+    // --query <revenue|units|operations|users> [--from YYYY-MM-DD] [--to YYYY-MM-DD]
+    // prints a report from the transaction log and exits;
+    string dataRoot;
+    string storesConfig;
+    string replicaOf;
+    string verifyRoot;
+    bool repair = false;
+    string changesOf;
+    uint64_t changesAfter = 0;
+    string query, from, to;
+    string interactionsRoot;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string flag = argv[i];
+        if (flag == "--data-root") dataRoot = argv[i + 1];
+        else if (flag == "--stores") storesConfig = argv[i + 1];
+        else if (flag == "--replica") replicaOf = argv[i + 1];
+        else if (flag == "--changes") changesOf = argv[i + 1];
+        else if (flag == "--after") changesAfter = strtoull(argv[i + 1], nullptr, 10);
+        else if (flag == "--verify" || flag == "--repair") {
+            verifyRoot = argv[i + 1];
+            repair = flag == "--repair";
+        }
+        else if (flag == "--query") query = argv[i + 1];
+        else if (flag == "--from") from = argv[i + 1];
+        else if (flag == "--to") to = argv[i + 1];
+        else if (flag == "--import-interactions") interactionsRoot = argv[i + 1];
+    }
+
+    if (!interactionsRoot.empty()) {
+        return PharmacySystem::importStarterInteractions(interactionsRoot, cout) ? 0 : 1;
+    }
+
+    if (!changesOf.empty()) {
+        string socketPath = Utils::dataPath(changesOf, "changes.sock");
+        if (ChangeFeed::follow(socketPath, changesAfter, cout) != 0) {
+            cerr << "No store is serving " << socketPath << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!verifyRoot.empty()) {
+        int status = IntegrityCheck(verifyRoot).run(cout, repair);
+        TaskScheduler::shared().shutdown();
+        return status;
+    }
+
+    if (!query.empty()) {
+        bool known = PharmacySystem::runQuery(dataRoot, query, from, to, cout);
+        if (!known) cerr << "Unknown query: " << query << " (use revenue, units, operations or users)\n";
+        TaskScheduler::shared().shutdown();
+        return known ? 0 : 1;
+    }
+
+    unique_ptr<IPharmacySystem> system;
+    if (!replicaOf.empty()) {
+        system = make_unique<ReplicaSystem>(replicaOf);
+    } else if (!storesConfig.empty()) {
+        system = make_unique<MultiStorePharmacy>(storesConfig);
+    } else {
+        system = make_unique<PharmacySystem>(dataRoot);
+    }
     system->run();
+    FileLogger::shutdownAll();
+    TaskScheduler::shared().shutdown();
      return 0;
 }
-
+#endif
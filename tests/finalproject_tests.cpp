@@ -0,0 +1,283 @@
+// Focused checks for the parts of the store whose mistakes are silent: money
+// parsing, password hashing, log compression, FEFO dispensing, CSV import,
+// billing idempotency and the inventory history. Prints each failure and
+// exits non-zero if there was one.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 -pthread tests/finalproject_tests.cpp -o finalproject_tests
+//   ./finalproject_tests
+#define PHARMACY_NO_MAIN
+#include "../finalproject.cpp"
+
+namespace {
+    int failures = 0;
+
+    void check(bool condition, const string& what) {
+        if (condition) return;
+        cerr << "FAIL: " << what << "\n";
+        failures++;
+    }
+
+    // A fresh directory under the system temp directory
+    string scratchDirectory(const string& name) {
+        filesystem::path path = filesystem::temp_directory_path() / ("finalproject_tests_" + name);
+        error_code ec;
+        filesystem::remove_all(path, ec);
+        filesystem::create_directories(path, ec);
+        return path.string();
+    }
+
+    void testParseCents() {
+        struct Case {
+            const char* text;
+            bool valid;
+            int64_t cents;
+        };
+        const Case cases[] = {
+            { "12", true, 1200 },     { "12.5", true, 1250 },   { "12.34", true, 1234 },
+            { "12.345", true, 1235 }, { "12.344", true, 1234 }, { " 0.99 ", true, 99 },
+            { ".5", true, 50 },       { "7.", true, 700 },      { "", false, 0 },
+            { ".", false, 0 },        { "-1", false, 0 },       { "1.2.3", false, 0 },
+            { "12a", false, 0 },      { "1e3", false, 0 },      { "1234567890123456", false, 0 },
+        };
+        for (const Case& c : cases) {
+            int64_t cents = -1;
+            bool valid = Utils::parseCents(c.text, cents);
+            check(valid == c.valid, string("parseCents(\"") + c.text + "\") validity");
+            if (valid && c.valid) check(cents == c.cents, string("parseCents(\"") + c.text + "\") = " + to_string(cents));
+        }
+    }
+
+    // PBKDF2-HMAC-SHA256 vectors; the RFC 7914 ones are 64 bytes long, of which
+    // the first block is the 32-byte digest computed here
+    void testPbkdf2() {
+        struct Vector {
+            const char* password;
+            const char* salt;
+            uint32_t iterations;
+            const char* hex;
+        };
+        const Vector vectors[] = {
+            { "password", "salt", 1, "120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b" },
+            { "password", "salt", 2, "ae4d0c95af6b46d32d0adff928f06dd02a303f8ef3c251dfd6e2d85a95474c43" },
+            { "password", "salt", 4096, "c5e478d59288c841aa530db6845c4c8d962893a001ce4e11a4963873aa98134a" },
+            { "passwd", "salt", 1, "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc" },
+            { "Password", "NaCl", 80000, "4ddcd8f60b98be21830cee5ef22701f9641a4418d04c0414aeff08876b34ab56" },
+        };
+        for (const Vector& v : vectors) {
+            PasswordHash::Digest digest = PasswordHash::pbkdf2(v.password, v.salt, v.iterations);
+            check(PasswordHash::toHex(digest.data(), digest.size()) == v.hex,
+                  string("pbkdf2(") + v.password + ", " + v.salt + ", " + to_string(v.iterations) + ")");
+        }
+    }
+
+    void testCompressionRoundTrip() {
+        mt19937 random(42);
+        string noise(1 << 16, '\0');
+        for (char& c : noise) c = static_cast<char>(random() & 0xFF);
+        string repetitive;
+        for (int i = 0; i < 5000; i++) repetitive += "ID: " + to_string(i) + " | User: pharmacist | Action: Billed\n";
+        const string inputs[] = { "", "a", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", "abcabcabcabcXabcabc",
+                                  string(100000, 'z'), noise, repetitive };
+        for (const string& input : inputs) {
+            string packed = Compression::compress(input);
+            string unpacked;
+            check(Compression::decompress(packed, unpacked) && unpacked == input,
+                  "compression round trip of " + to_string(input.size()) + " bytes");
+        }
+        check(Compression::compress(repetitive).size() < repetitive.size() / 4, "repetitive log text compresses");
+
+        string packed = Compression::compress(repetitive);
+        string unpacked;
+        check(!Compression::decompress(packed.substr(0, packed.size() / 2), unpacked), "truncated stream is rejected");
+        check(!Compression::decompress("not compressed", unpacked), "stream without the magic is rejected");
+    }
+
+    void testFefoOrdering() {
+        vector<unique_ptr<IMedicine>> medicines;
+        medicines.push_back(make_unique<Medicine>("Amoxicillin", 5, "2099-03-01", 100, 1));
+        medicines.push_back(make_unique<Medicine>("Amoxicillin", 5, "2099-01-01", 100, 2));
+        medicines.push_back(make_unique<Medicine>("Amoxicillin", 5, "2020-01-01", 100, 3));  // Expired
+        medicines.push_back(make_unique<Medicine>("Amoxicillin", 4, "2099-01-01", 120, 4));
+        LotIndex lots;
+        lots.rebuild(medicines);
+
+        check(lots.totalQuantity("amoxicillin") == 14, "expired lots do not count as stock");
+        check(lots.expiredLots("Amoxicillin").size() == 1, "the expired lot is reported");
+        check(lots.planDispense("Amoxicillin", 15).empty(), "a dispense larger than the stock is refused");
+
+        vector<LotIndex::DispenseStep> plan = lots.planDispense("Amoxicillin", 12);
+        check(medicines[2]->getQuantity() == 5, "planning leaves stock alone");
+        vector<LotIndex::DispenseStep> steps = lots.dispense("Amoxicillin", 12);
+        check(steps.size() == 3 && plan.size() == 3, "dispense spans three lots");
+        if (steps.size() == 3) {
+            // Same expiry breaks ties on lot ID; the later expiry comes last
+            check(steps[0].lot->getId() == 2 && steps[0].quantity == 5, "first step takes the earliest lot");
+            check(steps[1].lot->getId() == 4 && steps[1].quantity == 4, "second step takes the tied lot");
+            check(steps[2].lot->getId() == 1 && steps[2].quantity == 3, "last step takes the later expiry");
+        }
+        check(medicines[2]->getQuantity() == 5, "the expired lot is never dispensed");
+        check(lots.totalQuantity("Amoxicillin") == 2, "stock total follows the dispense");
+    }
+
+    void testCsvImportRejects() {
+        string root = scratchDirectory("csv");
+        string path = Utils::dataPath(root, "import.csv");
+        ofstream(path) << "name,quantity,expiry,price\n"
+                       << "Paracetamol,10,2099-01-01,1.50\n"
+                       << ",10,2099-01-01,1.50\n"
+                       << "Ibuprofen,-3,2099-01-01,1.50\n"
+                       << "Ibuprofen,3,2099-02-30,1.50\n"
+                       << "Ibuprofen,3,2099-01-01,abc\n"
+                       << "Ibuprofen,3,2099-01-01,1.50,extra\n"
+                       << "\n"
+                       << "Aspirin,7,2099-06-01,0.25\r\n";
+        vector<CatalogueImporter::Row> rows;
+        vector<CatalogueImporter::Rejection> rejects;
+        size_t rowsRead = 0;
+        bool ok = CatalogueImporter::import(path, [&rows](CatalogueImporter::Row& row) { rows.push_back(row); },
+                                            rejects, rowsRead);
+        check(ok, "the CSV file opens");
+        check(rowsRead == 7, "the header and blank line are not rows");
+        check(rows.size() == 2, "two rows are accepted");
+        if (rows.size() == 2) {
+            check(rows[0].name == "Paracetamol" && rows[0].quantity == 10 && rows[0].priceCents == 150,
+                  "first accepted row");
+            check(rows[1].name == "Aspirin" && rows[1].priceCents == 25 && rows[1].lineNumber == 9,
+                  "a CRLF row is accepted with its line number");
+        }
+        const pair<size_t, const char*> expected[] = {
+            { 3, "Missing medicine name" },
+            { 4, "Quantity must be a positive whole number" },
+            { 5, "Invalid expiry date" },
+            { 6, "Price must be a positive number" },
+            { 7, "Too many columns" },
+        };
+        check(rejects.size() == size(expected), "five rows are rejected");
+        for (size_t i = 0; i < min(rejects.size(), size(expected)); i++) {
+            check(rejects[i].lineNumber == expected[i].first && rejects[i].reason == expected[i].second,
+                  "rejection of line " + to_string(expected[i].first));
+        }
+        check(!CatalogueImporter::import(Utils::dataPath(root, "missing.csv"), [](CatalogueImporter::Row&) {},
+                                         rejects, rowsRead),
+              "a missing file is reported");
+    }
+
+    void testInventoryHistoryReplay() {
+        string root = scratchDirectory("history");
+        using Lot = InventoryHistory::Lot;
+        {
+            InventoryHistory history(root);
+            history.record({ Lot{ 1, "Aspirin", 10, "2099-01-01", 100 }, Lot{ 2, "Ibuprofen", 4, "2099-01-01", 250 } },
+                           {}, 100);
+            history.record({ Lot{ 1, "Aspirin", 6, "2099-01-01", 100 } }, {}, 200);
+            check(history.record({ Lot{ 1, "Aspirin", 6, "2099-01-01", 100 } }, {}, 250).empty(),
+                  "an unchanged lot records nothing");
+            history.record({}, { 2 }, 300);
+            // Enough changes for a background checkpoint, then a few more after it
+            for (int i = 0; i < 600; i++) history.record({ Lot{ 3, "Cetirizine", i, "2099-01-01", 50 } }, {}, 400 + i);
+            // Written in the background; drain() would cancel it, so wait for it instead
+            for (int i = 0; i < 500 && history.checkpointCount() == 0; i++) this_thread::sleep_for(chrono::milliseconds(10));
+            check(history.checkpointCount() == 1, "a checkpoint was written");
+        }
+
+        InventoryHistory history(root);  // Replayed from disk
+        check(history.stateAt(50).empty(), "nothing before the first change");
+        InventoryHistory::State at150 = history.stateAt(150);
+        check(at150.size() == 2 && at150[1].quantity == 10 && at150[2].quantity == 4, "state at 150");
+        InventoryHistory::State at250 = history.stateAt(250);
+        check(at250.size() == 2 && at250[1].quantity == 6, "state at 250");
+        InventoryHistory::State at350 = history.stateAt(350);
+        check(at350.size() == 1 && at350.count(1) == 1, "a removed lot is gone at 350");
+        check(history.stateAt(400 + 99)[3].quantity == 99, "state inside the replayed deltas");
+        check(history.stateAt(400 + 590)[3].quantity == 590, "state after the checkpoint");
+        check(history.latest().size() == 2 && history.latest().at(3).quantity == 599, "latest state after reopening");
+    }
+}
+
+// Drives a real store in a scratch directory through its private billing code
+class PharmacyTests {
+public:
+    struct Quiet {
+        struct Discard : streambuf {
+            int overflow(int c) override { return c; }
+        } discard;
+        istringstream input;
+        streambuf* shownTo;
+        streambuf* readFrom;
+
+        explicit Quiet(const string& script) : input(script) {
+            shownTo = cout.rdbuf(&discard);
+            readFrom = cin.rdbuf(input.rdbuf());
+        }
+        ~Quiet() {
+            cin.rdbuf(readFrom);
+            cout.rdbuf(shownTo);
+        }
+    };
+
+    static const IMedicine* lot(const PharmacySystem& store, int id) {
+        for (const auto& med : store.medicines) {
+            if (med->getId() == id) return med.get();
+        }
+        return nullptr;
+    }
+
+    static void testBillingIdempotency() {
+        string root = scratchDirectory("billing");
+        string today = Utils::getCurrentTimestamp().substr(0, 10);
+        ofstream(Utils::dataPath(root, "medicines.txt")) << "Aspirin,10,2099-01-01,1.00,1\n"
+                                                         << "Ibuprofen,10,2099-01-01,2.00,2\n";
+        ofstream(Utils::dataPath(root, "prescriptions.txt")) << "RX1,Ann,Aspirin,2," << today << ",Dr Lee\n"
+                                                             << "RX2,Bob,Ibuprofen,3," << today << ",Dr Lee\n";
+        ofstream(Utils::dataPath(root, "interactions.txt")) << "";
+
+        {
+            PharmacySystem store(root);
+            {
+                Quiet quiet("\n1\n1\n\n\n1\n\n");  // Bill the first prescription in cash, then try again
+                store.processBilling();
+                store.processBilling();
+            }
+            check(lot(store, 1) && lot(store, 1)->getQuantity() == 8, "a bill dispenses once");
+            check(store.fulfilments.size() == 1 && store.fulfilments.count("RX1"), "one receipt is kept");
+
+            // A crash between the pending row and the saved stock leaves only the pending row
+            BillingReceipt pending{ "RX2", "CASH-TEST", "Cash", "Ibuprofen", 3, 600, Utils::getCurrentTimestamp(),
+                                    "2:10:7" };
+            store.appendFulfilment(pending);
+        }
+        {
+            PharmacySystem store(root);
+            check(lot(store, 1) && lot(store, 1)->getQuantity() == 8, "the finished bill is not repeated");
+            check(lot(store, 2) && lot(store, 2)->getQuantity() == 7, "the interrupted bill is finished");
+            auto receipt = store.fulfilments.find("RX2");
+            check(receipt != store.fulfilments.end() && receipt->second.pendingLots.empty(),
+                  "the interrupted bill's receipt is completed");
+            bool billed = false;
+            for (const auto& pres : store.prescriptions) {
+                if (pres->getId() == "RX2") billed = pres->getStatus() == FulfilmentStatus::Billed;
+            }
+            check(billed, "the interrupted bill's prescription is marked billed");
+        }
+        {
+            PharmacySystem store(root);
+            check(lot(store, 2) && lot(store, 2)->getQuantity() == 7, "a finished recovery is not applied again");
+        }
+    }
+};
+
+int main() {
+    testParseCents();
+    testPbkdf2();
+    testCompressionRoundTrip();
+    testFefoOrdering();
+    testCsvImportRejects();
+    testInventoryHistoryReplay();
+    PharmacyTests::testBillingIdempotency();
+
+    FileLogger::shutdownAll();
+    TaskScheduler::shared().shutdown();
+    if (failures == 0) cout << "All tests passed\n";
+    return failures == 0 ? 0 : 1;
+}